@@ -24,18 +24,19 @@ namespace backtester
     class Backtester
     {
     private:
-        static size_t findEntryPoint(const std::vector<bool> &strategySignals, unsigned cursor);
+        static size_t findEntryPoint(const Signal &strategySignals, unsigned cursor);
 
-        static size_t exitPosition(const std::string &stock, unsigned entryTime, double profitTake, double stopLoss,
-                                   double transactionCost);
+        static size_t exitPosition(const Evaluator &evaluator, const std::string &stock, unsigned entryTime,
+                                   double profitTake, double stopLoss, double transactionCost);
 
-        static std::vector<TimingStrategySignal> getTimingStrategySignals(std::vector<bool> strategyValues);
+        static std::vector<TimingStrategySignal> getTimingStrategySignals(Signal strategyValues);
 
     public:
 
         /**
          * Simulates the operation of the strategy in the stock market given the historical data in the dataset. The exit
          * strategy is set in terms of profit taking and stop loss parameters.
+         * @param evaluator The evaluator of the dataset where the strategy was evaluated.
          * @param strategySignals List of signals returned from the evaluation of the strategy function.
          * @param stock The name of the stock to backtest.
          * @param profitTake Percentage profit to exit the position.
@@ -46,13 +47,14 @@ namespace backtester
          * @return A list containing all the ExecutionData.
          */
         static std::vector<ExecutionData>
-        BacktestStoplossProfittake(const std::vector<bool> &strategySignals, const std::string &stock,
-                                   double profitTake,
-                                   double stopLoss, double transactionCost, int minibatchSize = -1);
+        BacktestStoplossProfittake(const Evaluator &evaluator, const Signal &strategySignals,
+                                   const std::string &stock, double profitTake, double stopLoss,
+                                   double transactionCost, int minibatchSize = -1);
 
         /**
          * Simulates the operation of the strategy in the stock market given the historical data in the dataset. The exit
          * strategy is set in terms of a time period to hold onto the asset.
+         * @param evaluator The evaluator of the dataset where the strategy was evaluated.
          * @param strategySignals List of signals returned from the evaluation of the strategy function.
          * @param stock The name of the stock to backtest.
          * @param timePeriod Time period to hold an asset.
@@ -62,12 +64,13 @@ namespace backtester
          * @return A list containing all the ExecutionData.
          */
         static std::vector<ExecutionData>
-        BacktestTimestopHit(const std::vector<bool> &strategySignals, const std::string &stock, int timePeriod,
-                            int minibatchSize = -1);
+        BacktestTimestopHit(const Evaluator &evaluator, const Signal &strategySignals,
+                            const std::string &stock, int timePeriod, int minibatchSize = -1);
 
         /**
          * Simulates the operation of the strategy in the stock market given the historical data in the dataset. The exit
          * strategy is given by the strategy signals.
+         * @param evaluator The evaluator of the dataset where the strategy was evaluated.
          * @param strategySignals List of signals returned from the evaluation of the strategy function.
          * @param stock The name of the stock to backtest.
          * @param transactionCost Percentage cost of a transaction.
@@ -75,8 +78,8 @@ namespace backtester
          * @return A list containing all the ExecutionData.
          */
         static std::vector<ExecutionData>
-        BacktestMarketTiming(const std::vector<bool> &strategySignals, const std::string &stock,
-                             int minibatchSize = -1);
+        BacktestMarketTiming(const Evaluator &evaluator, const Signal &strategySignals,
+                             const std::string &stock, int minibatchSize = -1);
 
     };
 }
\ No newline at end of file
@@ -0,0 +1,112 @@
+#pragma once
+#include <list>
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include "dataset.h"
+
+namespace backtester
+{
+    //*****************************
+    //*   Pairwise correlation    *
+    //****************************/
+
+    /**
+     * Rolling correlation, covariance and beta of the daily close returns of the pairs of stocks of a dataset. The
+     * returns of all the stocks are aligned on a common calendar, the sorted union of their dates. A pair is computed
+     * the first time it is queried, in a single O(n) pass with running sums over the aligned observations of the last
+     * window calendar dates, including the current one. Only the most recently queried pairs are kept, so the memory
+     * grows with the number of stocks and not with the number of pairs, and queries of a kept pair are O(1).
+     */
+    class CorrelationMatrix
+    {
+    private:
+        /// Covariance and variances of the first and second stock of a pair i < j, as [calendar][3].
+        using PairMoments = std::vector<SeriesValue>;
+
+        /// Least recently used pairs, keyed by pair index.
+        struct PairCache
+        {
+            std::mutex mutex;
+            std::list<std::pair<size_t, std::shared_ptr<const PairMoments>>> pairs;
+            std::unordered_map<size_t, decltype(pairs)::iterator> positions;
+        };
+
+        unsigned window = 0;
+        size_t cachedPairs = 0;
+        std::vector<std::string> calendar;
+        std::vector<std::string> stocks;
+        std::unordered_map<std::string, size_t> stockIndexes;
+        std::vector<std::vector<size_t>> calendarIndexes;
+
+        /// Close returns of every stock placed on the calendar, NaN where the stock has no return.
+        std::vector<std::vector<SeriesValue>> returns;
+        std::unique_ptr<PairCache> cache = std::make_unique<PairCache>();
+
+        [[nodiscard]] size_t stockIndex(const std::string& stock) const;
+        [[nodiscard]] size_t pairIndex(size_t i, size_t j) const;
+        [[nodiscard]] std::shared_ptr<const PairMoments> pairMoments(size_t i, size_t j) const;
+        [[nodiscard]] double covariance(size_t a, size_t b, int time, double& varianceA, double& varianceB) const;
+
+    public:
+
+        /** Default number of pairs whose rolling moments are kept. */
+        static constexpr size_t defaultCachedPairs = 256;
+
+        /** Default constructor. Creates an empty matrix. */
+        CorrelationMatrix() = default;
+
+        /**
+         * Align the returns of the stocks of a dataset on their common calendar. Pairs are computed when queried.
+         * @param dataset The dataset.
+         * @param window Number of calendar dates of the rolling window.
+         * @param cachedPairs Number of most recently queried pairs whose rolling moments are kept.
+         */
+        CorrelationMatrix(const Dataset& dataset, unsigned window, size_t cachedPairs = defaultCachedPairs);
+
+        /** Returns the number of calendar dates of the rolling window, or 0 if the matrix is empty. */
+        [[nodiscard]] unsigned Window() const { return window; }
+
+        /** Returns the stocks of the matrix. */
+        [[nodiscard]] const std::vector<std::string>& Stocks() const { return stocks; }
+
+        /** Returns the common calendar of the stocks. */
+        [[nodiscard]] const std::vector<std::string>& Calendar() const { return calendar; }
+
+        /**
+         * Get the rolling correlation of the returns of two stocks.
+         * @param stockA The first stock.
+         * @param stockB The second stock.
+         * @param time The time index in the dates of the first stock.
+         * @return The correlation, or NaN if the time index is negative or the window has less than two aligned
+         * returns.
+         * @throws std::out_of_range If a stock is not in the matrix or the time index is past its dates.
+         */
+        [[nodiscard]] double Correlation(const std::string& stockA, const std::string& stockB, int time) const;
+
+        /**
+         * Get the rolling beta of the returns of a stock with respect to a benchmark stock.
+         * @param stock The stock.
+         * @param benchmark The benchmark stock.
+         * @param time The time index in the dates of the stock.
+         * @return The beta, or NaN if the time index is negative or the window has less than two aligned returns.
+         * @throws std::out_of_range If a stock is not in the matrix or the time index is past its dates.
+         */
+        [[nodiscard]] double Beta(const std::string& stock, const std::string& benchmark, int time) const;
+
+        /**
+         * Get the time series of the rolling correlation of two stocks.
+         * @return The correlations at the dates of the first stock.
+         */
+        [[nodiscard]] std::vector<double> CorrelationTimeSeries(const std::string& stockA,
+                                                                const std::string& stockB) const;
+
+        /**
+         * Get the time series of the rolling beta of a stock with respect to a benchmark stock.
+         * @return The betas at the dates of the stock.
+         */
+        [[nodiscard]] std::vector<double> BetaTimeSeries(const std::string& stock, const std::string& benchmark) const;
+    };
+}
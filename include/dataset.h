@@ -2,12 +2,21 @@
 #include <vector>
 #include <string>
 #include <map>
+#include <array>
+#include <memory>
+#include <mutex>
 #include <unordered_map>
 #include <limits>
+#include <cstdint>
+#include <stdexcept>
 #include <cereal/types/vector.hpp>
 #include <cereal/types/string.hpp>
 #include <cereal/types/unordered_map.hpp>
 #include "utilities.h"
+#include "series_value.h"
+#include "indicator_registry.h"
+#include "wavelet_tree.h"
+#include "prefix_sums.h"
 
 namespace backtester
 {
@@ -76,23 +85,451 @@ namespace backtester
     /** QuantileIndicators is an alias to an unordered_map that maps a percentile value to Indicators. */
     using QuantileIndicators = std::unordered_map<std::string, Indicators>;
 
-    /** Serializable structure that contains all the data and indicators of a single stock. */
+    /** Read-only view over a contiguous series stored in StockData. Values are always read as double. */
+    struct SeriesView
+    {
+        const SeriesValue* data = nullptr;
+        size_t size = 0;
+
+        double operator[](size_t time) const
+        {
+            return data[time];
+        }
+
+        /** Bounds-checked access. */
+        [[nodiscard]]
+        double at(size_t time) const
+        {
+            if (time >= size)
+                throw std::out_of_range("Time index " + std::to_string(time) + " is out of range.");
+            return data[time];
+        }
+
+        [[nodiscard]] const SeriesValue* begin() const { return data; }
+        [[nodiscard]] const SeriesValue* end() const { return data + size; }
+
+        /** Copy the series into a vector. */
+        [[nodiscard]]
+        std::vector<double> ToVector() const
+        {
+            return std::vector<double>(begin(), end());
+        }
+    };
+
+    /**
+     * Range quantile indexes and prefix sums of the indicator series of a stock. Each index is built the first time
+     * it is queried, so only the indicators that are actually queried take memory. Copies start empty and build their
+     * own indexes from the series they are given.
+     */
+    class StockIndexes
+    {
+    private:
+        struct State
+        {
+            std::array<std::once_flag, IndicatorRegistry::indicatorCount> quantileBuilt;
+            std::array<WaveletTree, IndicatorRegistry::indicatorCount> quantileIndexes;
+            std::array<std::once_flag, IndicatorRegistry::indicatorCount> prefixSumsBuilt;
+            std::array<PrefixSums, IndicatorRegistry::indicatorCount> prefixSumIndexes;
+            std::once_flag priceVolumeBuilt;
+            PrefixSums priceVolumeIndex;
+        };
+
+        std::unique_ptr<State> state = std::make_unique<State>();
+
+    public:
+
+        /** Default constructor. No index is built. */
+        StockIndexes() = default;
+
+        /** Copy constructor. The indexes are not copied. */
+        StockIndexes(const StockIndexes&) : StockIndexes() {}
+
+        /** Copy assignment. The indexes are discarded. */
+        StockIndexes& operator=(const StockIndexes&)
+        {
+            Reset();
+            return *this;
+        }
+
+        StockIndexes(StockIndexes&&) noexcept = default;
+        StockIndexes& operator=(StockIndexes&&) noexcept = default;
+
+        /** Discard the built indexes. They must not be in use by another thread. */
+        void Reset()
+        {
+            state = std::make_unique<State>();
+        }
+
+        /**
+         * Get the range quantile index of an indicator, building it on the first call. Concurrent callers wait for a
+         * single build.
+         * @param id The indicator.
+         * @param series The series of the indicator.
+         * @return The index.
+         */
+        [[nodiscard]]
+        const WaveletTree& Quantile(IndicatorId id, SeriesView series) const
+        {
+            const size_t index = IndicatorRegistry::Index(id);
+            std::call_once(state->quantileBuilt.at(index), [&] {
+                state->quantileIndexes[index] = WaveletTree(series.begin(), series.end());
+            });
+            return state->quantileIndexes[index];
+        }
+
+        /**
+         * Get the prefix sums of an indicator, building them on the first call.
+         * @param id The indicator.
+         * @param series The series of the indicator.
+         * @return The prefix sums.
+         */
+        [[nodiscard]]
+        const PrefixSums& Sums(IndicatorId id, SeriesView series) const
+        {
+            const size_t index = IndicatorRegistry::Index(id);
+            std::call_once(state->prefixSumsBuilt.at(index), [&] {
+                state->prefixSumIndexes[index] = PrefixSums(series.begin(), series.end());
+            });
+            return state->prefixSumIndexes[index];
+        }
+
+        /**
+         * Get the prefix sums of close price times volume, building them on the first call.
+         * @param close The close price series.
+         * @param volume The trading volume series.
+         * @return The prefix sums.
+         */
+        [[nodiscard]]
+        const PrefixSums& PriceVolumeSums(SeriesView close, SeriesView volume) const
+        {
+            std::call_once(state->priceVolumeBuilt, [&] {
+                std::vector<double> priceVolume(close.size);
+                for (size_t t = 0; t < priceVolume.size(); t++)
+                    priceVolume[t] = close[t] * volume[t];
+                state->priceVolumeIndex = PrefixSums(priceVolume);
+            });
+            return state->priceVolumeIndex;
+        }
+    };
+
+    /**
+     * Serializable structure that contains all the data and indicators of a single stock. Indicator series are
+     * stored contiguously as [indicator][time], quantiles as [percentile][indicator][time] and percentile ranks as
+     * [indicator][time], addressed by the dense identifiers of the IndicatorRegistry. Derived indicators defined by
+     * expressions are stored as [derived][time] together with their names and expressions. The range quantile
+     * index and the prefix sums of an indicator are built on their first query and discarded whenever the indicators
+     * are set or deserialized; they are not serialized.
+     */
     struct StockData
     {
+        /** Number of bits of the stored indicator values. It is recorded in the serialized data. */
+        static constexpr std::uint32_t storagePrecision = 8 * sizeof(SeriesValue);
+
         std::vector<std::string> dates;
-        Indicators indicators;
-        QuantileIndicators quantileIndicators;
+        std::vector<SeriesValue> indicatorValues;
+        std::vector<SeriesValue> quantileValues;
+        std::vector<SeriesValue> percentileRankValues;
+        std::vector<std::string> derivedNames;
+        std::vector<std::string> derivedExpressions;
+        std::vector<SeriesValue> derivedValues;
+        StockIndexes indexes;
 
         /** Default constructor. */
         StockData() = default;
 
-        /** Explicit constructor. */
+        /** Explicit constructor. Percentile ranks are optional. */
         StockData(const std::vector<std::string>& dates, const Indicators& indicators,
-                  const QuantileIndicators& quantileIndicators)
+                  const QuantileIndicators& quantileIndicators, const Indicators& percentileRanks = {})
         {
             this->dates = dates;
-            this->indicators = indicators;
-            this->quantileIndicators = quantileIndicators;
+            SetIndicators(indicators);
+            SetQuantileIndicators(quantileIndicators);
+            SetPercentileRanks(percentileRanks);
+        }
+
+        /** Returns the number of time points of the indicator series. */
+        [[nodiscard]]
+        size_t TimePoints() const
+        {
+            return indicatorValues.size() / IndicatorRegistry::indicatorCount;
+        }
+
+        /** Returns the time series of an indicator. */
+        [[nodiscard]]
+        SeriesView Series(IndicatorId id) const
+        {
+            const size_t timePoints = TimePoints();
+            return { indicatorValues.data() + IndicatorRegistry::Index(id) * timePoints, timePoints };
+        }
+
+        /** Returns the time series of an indicator quantile. */
+        [[nodiscard]]
+        SeriesView QuantileSeries(IndicatorId id, PercentileId percentile) const
+        {
+            const size_t timePoints = TimePoints();
+            const size_t row = IndicatorRegistry::Index(percentile) * IndicatorRegistry::indicatorCount
+                               + IndicatorRegistry::Index(id);
+            return { quantileValues.data() + row * timePoints, timePoints };
+        }
+
+        /** Returns the time series of the rolling percentile rank of an indicator. */
+        [[nodiscard]]
+        SeriesView PercentileRankSeries(IndicatorId id) const
+        {
+            const size_t timePoints = percentileRankValues.empty() ? 0 : TimePoints();
+            return { percentileRankValues.data() + IndicatorRegistry::Index(id) * timePoints, timePoints };
+        }
+
+        /** Returns the value of an indicator at a time index. */
+        [[nodiscard]]
+        double Value(IndicatorId id, size_t time) const
+        {
+            return indicatorValues[IndicatorRegistry::Index(id) * TimePoints() + time];
+        }
+
+        /** Returns the value of an indicator quantile at a time index. */
+        [[nodiscard]]
+        double QuantileValue(IndicatorId id, PercentileId percentile, size_t time) const
+        {
+            return QuantileSeries(id, percentile)[time];
+        }
+
+        /**
+         * Returns the rolling percentile rank of an indicator at a time index, or NaN if the percentile ranks are not
+         * stored or the time index is out of range.
+         */
+        [[nodiscard]]
+        double PercentileRank(IndicatorId id, size_t time) const
+        {
+            const SeriesView ranks = PercentileRankSeries(id);
+            return time < ranks.size ? ranks[time] : std::numeric_limits<double>::quiet_NaN();
+        }
+
+        /**
+         * Get the quantile of an indicator over a range of time indexes, using the range quantile index.
+         * @param id The indicator.
+         * @param percentile The percentile in [0, 1].
+         * @param begin First time index of the range.
+         * @param end One past the last time index of the range.
+         * @return The quantile, or NaN if the range is empty.
+         */
+        [[nodiscard]]
+        double RangeQuantile(IndicatorId id, double percentile, size_t begin, size_t end) const
+        {
+            return indexes.Quantile(id, Series(id)).Quantile(begin, end, percentile);
+        }
+
+        /**
+         * Get the mean of an indicator over a range of time indexes, using the prefix sums.
+         * @return The mean, or NaN if the range is empty or ends past the stored values.
+         */
+        [[nodiscard]]
+        double RangeMean(IndicatorId id, size_t begin, size_t end) const
+        {
+            return indexes.Sums(id, Series(id)).Mean(begin, end);
+        }
+
+        /**
+         * Get the sample standard deviation of an indicator over a range of time indexes, using the prefix sums.
+         * @return The standard deviation, or NaN if the range has less than two values or ends past the stored values.
+         */
+        [[nodiscard]]
+        double RangeStd(IndicatorId id, size_t begin, size_t end) const
+        {
+            return indexes.Sums(id, Series(id)).Std(begin, end);
+        }
+
+        /**
+         * Get the volume weighted average close price over a range of time indexes, using the prefix sums.
+         * @return The VWAP, or NaN if the range is empty or ends past the stored values.
+         */
+        [[nodiscard]]
+        double RangeVWAP(size_t begin, size_t end) const
+        {
+            if (begin >= end)
+                return std::numeric_limits<double>::quiet_NaN();
+
+            const SeriesView close = Series(IndicatorId::ClosePrice);
+            const SeriesView volume = Series(IndicatorId::TradingVolume);
+            return indexes.PriceVolumeSums(close, volume).Sum(begin, end) /
+                   indexes.Sums(IndicatorId::TradingVolume, volume).Sum(begin, end);
+        }
+
+        /**
+         * Look up a derived indicator by name.
+         * @param name The name of the derived indicator.
+         * @param index Output position of the derived indicator.
+         * @return Is the derived indicator stored?
+         */
+        bool TryDerivedIndex(const std::string& name, size_t& index) const
+        {
+            for (size_t i = 0; i < derivedNames.size(); i++)
+            {
+                if (derivedNames[i] == name)
+                {
+                    index = i;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        /** Returns the time series of the derived indicator at a position. */
+        [[nodiscard]]
+        SeriesView DerivedSeries(size_t index) const
+        {
+            const size_t timePoints = TimePoints();
+            return { derivedValues.data() + index * timePoints, timePoints };
+        }
+
+        /** Returns the value of the derived indicator at a position and a time index. */
+        [[nodiscard]]
+        double DerivedValue(size_t index, size_t time) const
+        {
+            return derivedValues[index * TimePoints() + time];
+        }
+
+        /**
+         * Store the indicator series. All the registered indicators must be present and have the same length.
+         * @param indicators The indicators keyed by name.
+         */
+        void SetIndicators(const Indicators& indicators)
+        {
+            indicatorValues.clear();
+            const size_t timePoints = seriesLength(indicators);
+            indicatorValues.reserve(IndicatorRegistry::indicatorCount * timePoints);
+            for (std::string_view name : IndicatorRegistry::indicatorNames)
+            {
+                const std::vector<double>& series = indicators.at(std::string(name));
+                indicatorValues.insert(indicatorValues.end(), series.begin(), series.end());
+            }
+            indexes.Reset();
+        }
+
+        /**
+         * Store the quantile series. All the registered percentiles and indicators must be present and have the
+         * same length as the indicator series.
+         * @param quantileIndicators The quantiles keyed by percentile and name.
+         */
+        void SetQuantileIndicators(const QuantileIndicators& quantileIndicators)
+        {
+            quantileValues.clear();
+            quantileValues.reserve(IndicatorRegistry::percentileCount * indicatorValues.size());
+            for (std::string_view percentile : IndicatorRegistry::percentileNames)
+            {
+                const Indicators& indicators = quantileIndicators.at(std::string(percentile));
+                if (seriesLength(indicators) != TimePoints())
+                    throw std::invalid_argument("Quantile series and indicator series have different lengths.");
+
+                for (std::string_view name : IndicatorRegistry::indicatorNames)
+                {
+                    const std::vector<double>& series = indicators.at(std::string(name));
+                    quantileValues.insert(quantileValues.end(), series.begin(), series.end());
+                }
+            }
+        }
+
+        /**
+         * Store the rolling percentile ranks of the indicators. Either no ranks are given, or all the registered
+         * indicators must be present and have the same length as the indicator series.
+         * @param percentileRanks The percentile ranks keyed by indicator name.
+         */
+        void SetPercentileRanks(const Indicators& percentileRanks)
+        {
+            percentileRankValues.clear();
+            if (percentileRanks.empty())
+                return;
+
+            if (seriesLength(percentileRanks) != TimePoints())
+                throw std::invalid_argument("Percentile rank series and indicator series have different lengths.");
+
+            percentileRankValues.reserve(indicatorValues.size());
+            for (std::string_view name : IndicatorRegistry::indicatorNames)
+            {
+                const std::vector<double>& series = percentileRanks.at(std::string(name));
+                percentileRankValues.insert(percentileRankValues.end(), series.begin(), series.end());
+            }
+        }
+
+        /**
+         * Append the series of a derived indicator.
+         * @param name The name of the derived indicator.
+         * @param expression The expression that defines it.
+         * @param series The time series. It must have the same length as the indicator series.
+         */
+        void AddDerivedIndicator(const std::string& name, const std::string& expression, const std::vector<double>& series)
+        {
+            if (series.size() != TimePoints())
+                throw std::invalid_argument("Derived indicator " + name + " has a different length.");
+
+            derivedNames.push_back(name);
+            derivedExpressions.push_back(expression);
+            derivedValues.insert(derivedValues.end(), series.begin(), series.end());
+        }
+
+        /** Remove all the derived indicators. */
+        void ClearDerivedIndicators()
+        {
+            derivedNames.clear();
+            derivedExpressions.clear();
+            derivedValues.clear();
+        }
+
+        /** Returns the indicator series keyed by name. */
+        [[nodiscard]]
+        Indicators IndicatorMap() const
+        {
+            Indicators indicators;
+            for (unsigned i = 0; i < IndicatorRegistry::indicatorCount; i++)
+                indicators[std::string(IndicatorRegistry::indicatorNames[i])] = Series(IndicatorId(i)).ToVector();
+
+            return indicators;
+        }
+
+        /** Returns the quantile series keyed by percentile and name. */
+        [[nodiscard]]
+        QuantileIndicators QuantileIndicatorMap() const
+        {
+            QuantileIndicators quantileIndicators;
+            for (unsigned p = 0; p < IndicatorRegistry::percentileCount; p++)
+            {
+                Indicators& indicators = quantileIndicators[std::string(IndicatorRegistry::percentileNames[p])];
+                for (unsigned i = 0; i < IndicatorRegistry::indicatorCount; i++)
+                {
+                    indicators[std::string(IndicatorRegistry::indicatorNames[i])] =
+                            QuantileSeries(IndicatorId(i), PercentileId(p)).ToVector();
+                }
+            }
+
+            return quantileIndicators;
+        }
+
+        /** Returns the percentile rank series keyed by indicator name, or an empty map if they are not stored. */
+        [[nodiscard]]
+        Indicators PercentileRankMap() const
+        {
+            Indicators percentileRanks;
+            if (percentileRankValues.empty())
+                return percentileRanks;
+
+            for (unsigned i = 0; i < IndicatorRegistry::indicatorCount; i++)
+            {
+                percentileRanks[std::string(IndicatorRegistry::indicatorNames[i])] =
+                        PercentileRankSeries(IndicatorId(i)).ToVector();
+            }
+
+            return percentileRanks;
+        }
+
+        /** Returns the derived indicator series keyed by name. */
+        [[nodiscard]]
+        Indicators DerivedIndicatorMap() const
+        {
+            Indicators derivedIndicators;
+            for (size_t i = 0; i < derivedNames.size(); i++)
+                derivedIndicators[derivedNames[i]] = DerivedSeries(i).ToVector();
+
+            return derivedIndicators;
         }
 
         /**
@@ -102,8 +539,10 @@ namespace backtester
          */
         bool operator==(const StockData& other) const
         {
-            return (dates == other.dates) && (indicators == other.indicators)
-                    && (quantileIndicators == other.quantileIndicators);
+            return (dates == other.dates) && (indicatorValues == other.indicatorValues)
+                    && (quantileValues == other.quantileValues) && (percentileRankValues == other.percentileRankValues)
+                    && (derivedNames == other.derivedNames) && (derivedExpressions == other.derivedExpressions)
+                    && (derivedValues == other.derivedValues);
         }
 
         /**
@@ -113,14 +552,45 @@ namespace backtester
          */
         bool operator!=(const StockData& other) const
         {
-            return (dates != other.dates) || (indicators != other.indicators)
-                   || (quantileIndicators != other.quantileIndicators);
+            return !(*this == other);
         }
 
         /** Serialization hook. */
-        template <class Archive> void serialize(Archive& ar)
+        template <class Archive> void save(Archive& ar) const
         {
-            ar(dates, indicators, quantileIndicators);
+            ar(storagePrecision, dates, indicatorValues, quantileValues, percentileRankValues,
+               derivedNames, derivedExpressions, derivedValues);
+        }
+
+        /**
+         * Deserialization hook.
+         * @throws std::runtime_error If the data was stored with a different precision.
+         */
+        template <class Archive> void load(Archive& ar)
+        {
+            std::uint32_t precision;
+            ar(precision);
+            if (precision != storagePrecision)
+                throw std::runtime_error("Serialized StockData has " + std::to_string(precision) +
+                                         "-bit values but this build stores " + std::to_string(storagePrecision) + ".");
+
+            ar(dates, indicatorValues, quantileValues, percentileRankValues,
+               derivedNames, derivedExpressions, derivedValues);
+            indexes.Reset();
+        }
+
+    private:
+
+        /// Length shared by all the registered series of indicators.
+        static size_t seriesLength(const Indicators& indicators)
+        {
+            const size_t length = indicators.at(std::string(IndicatorRegistry::indicatorNames[0])).size();
+            for (std::string_view name : IndicatorRegistry::indicatorNames)
+            {
+                if (indicators.at(std::string(name)).size() != length)
+                    throw std::invalid_argument("Indicator " + std::string(name) + " has a different length.");
+            }
+            return length;
         }
     };
 
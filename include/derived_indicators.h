@@ -0,0 +1,67 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <memory>
+#include "dataset.h"
+
+namespace backtester
+{
+    //*****************************
+    //*    Derived indicators     *
+    //****************************/
+
+    /**
+     * Named indicator defined by an expression over the series of a stock. The expression is compiled once and
+     * evaluated as a column pass over whole series. Supported syntax:
+     *  - Numbers, the names of registered indicators and of previously defined derived indicators.
+     *  - Arithmetic: +, -, *, / and parentheses.
+     *  - Lag(x, k): the value of x k bars ago.
+     *  - RollingSum(x, w), RollingMean(x, w), RollingStd(x, w), RollingMin(x, w), RollingMax(x, w): aggregates of
+     *    x over the last w bars, including the current one.
+     *  - Abs(x), Log(x), Min(x, y), Max(x, y).
+     * Bars without enough history for a lag or a rolling aggregate evaluate to NaN.
+     */
+    class DerivedIndicator
+    {
+    public:
+        struct Node;
+
+    private:
+        std::string name;
+        std::string expression;
+        std::shared_ptr<const Node> root;
+
+    public:
+
+        /**
+         * Compile a derived indicator.
+         * @param name The name of the derived indicator.
+         * @param expression The expression that defines it.
+         * @param previous Derived indicators that the expression may refer to.
+         * @return The compiled indicator.
+         * @throws std::invalid_argument If the name is taken or the expression is not valid.
+         */
+        static DerivedIndicator Compile(const std::string& name, const std::string& expression,
+                                        const std::vector<DerivedIndicator>& previous = {});
+
+        /** Returns the name of the derived indicator. */
+        [[nodiscard]] const std::string& Name() const { return name; }
+
+        /** Returns the expression that defines the derived indicator. */
+        [[nodiscard]] const std::string& Expression() const { return expression; }
+
+        /**
+         * Evaluate the derived indicator over a stock.
+         * @param stockData The stock. Derived indicators referenced by the expression must already be stored in it.
+         * @return The time series of the derived indicator, aligned with the indicator series.
+         */
+        [[nodiscard]] std::vector<double> Evaluate(const StockData& stockData) const;
+
+        /**
+         * Evaluate a list of derived indicators in order and store them in the stock.
+         * @param derivedIndicators The derived indicators.
+         * @param stockData The stock where the series are stored.
+         */
+        static void EvaluateAll(const std::vector<DerivedIndicator>& derivedIndicators, StockData& stockData);
+    };
+}
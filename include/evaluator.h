@@ -1,9 +1,14 @@
 #pragma once
+#include <memory>
+#include <cstdint>
 #include <utility>
 #include <angelscript.h>
 #include <scriptbuilder.h>
 #include <scriptstdstring.h>
 #include "dataset.h"
+#include "correlation.h"
+#include "strategy_signal.h"
+#include "strategy_profile.h"
 
 namespace backtester
 {
@@ -14,58 +19,240 @@ namespace backtester
     class Evaluator
     {
     private:
+        struct StrategyBatch;
+        struct SignalRecord;
 
-        static Dataset evaluatorDataset;
+        std::shared_ptr<const Dataset> dataset;
+        std::shared_ptr<const CorrelationMatrix> correlationMatrix;
+        std::vector<std::string> stocks;
+        unsigned id = 0;
+        std::string nativeCompilationDirectory;
+        std::string bytecodeCacheDirectory;
+        std::string signalCacheDirectory;
 
         static std::string strategyToFunction(const std::string& strategy);
+        static std::string strategyToBoundFunction(const std::string& strategy);
+        static std::string scoreToBoundFunction(const std::string& score);
+        enum class ScriptSeries : unsigned { Indicator, Derived, Quantile, PercentileRank };
+
+        SeriesView* scriptSeries(ScriptSeries kind, size_t index, const std::string& stock) const;
+        static SeriesView* scriptGetSeries(const std::string& indicatorName, const std::string& stock);
+        static SeriesView* scriptGetQuantileSeries(const std::string& indicatorName, const std::string& percentile,
+                                                   const std::string& stock);
+        static SeriesView* scriptGetPercentileRankSeries(const std::string& indicatorName, const std::string& stock);
+        void bindSeriesHandles(asIScriptFunction* func, const std::string& stock) const;
         static void messageCallback(const asSMessageInfo* msg, void* param);
         static void scriptingEngineLog(const std::string& log);
         static void scriptingEngineException(const std::string& exception);
         static std::string scriptingEngineLogStr(const std::string& log);
         static std::string scriptingEngineExceptionStr(const std::string& exception);
         static std::string scriptingEngineProgram(const std::string& program);
-        static void registerInterface(asIScriptEngine* engine);
-        static asIScriptEngine* startAngelscriptEngine();
+        static void registerInterface(asIScriptEngine* engine, bool profiled = false);
+        static asIScriptEngine* startAngelscriptEngine(bool profiled = false);
         static asIScriptFunction* compileAngelscriptStrategy(asIScriptEngine* engine,
-                                                             const std::string& strategyProgram);
-        static bool executeAngelscriptStrategy(asIScriptEngine* engine, asIScriptFunction* func, std::string stock,
-                                               int dayIndex);
+                                                             const std::string& strategyProgram,
+                                                             const std::string& moduleName = "StrategyModule");
+        static asIScriptEngine* threadAngelscriptEngine();
+        asIScriptFunction* cachedAngelscriptStrategy(asIScriptEngine* engine, const std::string& strategyProgram,
+                                                     unsigned capacity) const;
+        std::vector<asIScriptFunction*> cachedAngelscriptStrategies(asIScriptEngine* engine,
+                                                                    const std::vector<std::string>& programs) const;
+        static bool executeAngelscriptStrategy(asIScriptContext* ctx, asIScriptFunction* func,
+                                               const std::string& stock, int dayIndex);
+        static double executeAngelscriptScore(asIScriptContext* ctx, asIScriptFunction* func,
+                                              const std::string& stock, int dayIndex);
+        StrategyBatch prepareStrategyBatch(const std::vector<std::string>& strategyPrograms) const;
+        std::vector<size_t> runNativeStrategies(const StrategyBatch& batch, const std::string& stock,
+                                                std::vector<Signal>& strategyResults) const;
+        void runScriptStrategies(const StrategyBatch& batch, const std::vector<size_t>& scripts,
+                                 const std::string& stock, int begin, int end,
+                                 std::vector<Signal>& strategyResults) const;
+        int loadCachedSignals(const StrategyBatch& batch, const std::vector<size_t>& scripts, const std::string& stock,
+                              std::vector<Signal>& strategyResults, SignalRecord& history) const;
+        void saveCachedSignals(const StrategyBatch& batch, const std::vector<size_t>& scripts, const std::string& stock,
+                               const std::vector<Signal>& strategyResults, const SignalRecord& history) const;
+        std::vector<Signal> runStrategyBatch(const StrategyBatch& batch, const std::string& stock) const;
+        void runScriptScore(const std::string& scoreFunction, const std::string& stock, int begin, int end,
+                            std::vector<double>& scores) const;
+        std::map<std::string, Signal> selectRanked(const std::map<std::string, std::vector<double>>& scores, size_t k,
+                                                   bool lowest) const;
+        const StockData& stockData(const std::string& stock) const;
 
     public:
 
         /**
-         * Configure the dataset to be used by the strategy runner.
-         * @param dataset Pointer to the dataset object.
+         * Create an evaluator over a dataset. The dataset is shared and never modified, so several evaluators, over
+         * the same or different datasets, can be used concurrently, and all the const methods of an evaluator can be
+         * called concurrently. Native compilation and the caches are options of each evaluator, and they must not be
+         * changed while the evaluator is being used by other threads.
+         * @param dataset The dataset.
+         */
+        explicit Evaluator(std::shared_ptr<const Dataset> dataset);
+
+        /**
+         * Create an evaluator that owns a dataset.
+         * @param dataset The dataset.
          */
-        static void SetStrategyEvaluatorDataset(Dataset dataset) noexcept;
+        explicit Evaluator(Dataset dataset);
+
+        /**
+         * Prepare the rolling correlations and betas between the stocks of the dataset. Each pair is computed the
+         * first time it is queried and only the most recently queried pairs are kept. It must not be called while the
+         * evaluator is being used by other threads.
+         * @param window Number of calendar dates of the rolling window.
+         */
+        void ComputeCorrelations(unsigned window);
+
+        /** Returns the dataset of the evaluator. */
+        [[nodiscard]] const Dataset& GetDataset() const noexcept;
 
-        /** Returns the pointer to the dataset used in the strategy runner. */
-        static Dataset GetStrategyEvaluatorDataset() noexcept;
+        /** Returns the list of stocks present in the dataset. */
+        [[nodiscard]] const std::vector<std::string>& GetStocksInDataset() const noexcept;
 
-        /** Returns the list of stocks present in the strategy evaluator dataset. */
-        static std::vector<std::string> GetStocksInDataset() noexcept;
+        /** Returns true if the stock is in the dataset. */
+        [[nodiscard]] bool HasStock(const std::string& stock) const noexcept;
 
         /**
          * Try to compile the strategy program and report compilation errors if any.
          * @param strategyProgram Program as string.
+         * @param cacheDirectory Bytecode cache directory, see EnableBytecodeCache. Programs whose bytecode is cached
+         * there are valid without being compiled again. Empty to always compile.
          * @return The result of the validation.
          */
-        static std::pair<bool, std::string> ValidateStrategyProgram(const std::string& strategyProgram);
+        static std::pair<bool, std::string> ValidateStrategyProgram(const std::string& strategyProgram,
+                                                                    const std::string& cacheDirectory = "");
+
+        /**
+         * Check if a strategy program is in the subset that is evaluated natively, column-at-a-time, instead of bar by
+         * bar in the scripting engine. See StrategyExpression.
+         * @param strategyProgram Program as string.
+         * @return True if the program is evaluated natively.
+         */
+        static bool IsNativeStrategy(const std::string& strategyProgram);
+
+        /**
+         * Compile the strategies of the native subset to shared objects with the local compiler, instead of
+         * evaluating them column-at-a-time. See NativeStrategy. Strategies that fail to compile are evaluated as usual.
+         * @param cacheDirectory Directory where the compiled strategies are cached.
+         */
+        void EnableNativeCompilation(const std::string& cacheDirectory);
+
+        /** Stop compiling strategies to shared objects. */
+        void DisableNativeCompilation() noexcept;
 
         /**
-         * Runs the strategy program in each date available of the stock.
+         * Save the bytecode of the strategies compiled by the scripting engine in a cache directory, and load it
+         * instead of compiling them again, in other threads and in later runs. Bytecode is stored under the sha256 of
+         * the strategy function and of the registered interface, so it is never loaded by an engine with another
+         * interface.
+         * @param cacheDirectory Directory where the bytecode is cached.
+         */
+        void EnableBytecodeCache(const std::string& cacheDirectory);
+
+        /** Stop caching the bytecode of strategies. */
+        void DisableBytecodeCache() noexcept;
+
+        /**
+         * Save the signals of the programs run by the scripting engine in a cache directory, together with running
+         * hashes of the bars of the stock they were computed from. When the history of a stock has only been extended
+         * since then, which is checked by hashing it, the cached signals are kept and only the appended bars and a
+         * margin of bars before them are evaluated. This assumes that the signal of a bar only depends on the bars of
+         * the same stock up to a few bars ahead; programs that pass any stock argument other than stock, read the
+         * rolling correlations or may read further ahead than the margin are always evaluated in full.
+         * @param cacheDirectory Directory where the signals are cached.
+         */
+        void EnableSignalCache(const std::string& cacheDirectory);
+
+        /** Stop caching the signals of strategies. */
+        void DisableSignalCache() noexcept;
+
+        /**
+         * Runs the strategy program in each date available of the stock. Programs in the native subset are evaluated
+         * natively, compiled to a shared object if native compilation is enabled or else column-at-a-time, and the rest
+         * by the scripting engine, which is the reference implementation.
          * @param strategyProgram A string with the program to be executed.
          * @param stock Name of the stock in the dataset.
-         * @return The result of the evaluations.
+         * @return The signal of every bar.
          */
-        static std::vector<bool> RunStrategy(const std::string& strategyProgram, const std::string& stock);
+        Signal RunStrategy(const std::string& strategyProgram, const std::string& stock) const;
+
+        /**
+         * Returns the number of strategy programs compiled by the strategy runners since the start of the program.
+         * Each thread compiles a distinct program once and reuses it in later runs.
+         */
+        static size_t CompiledStrategyCount() noexcept;
 
         /**
          * Runs the strategy program for all loaded stocks.
          * @param strategyProgram A string with the program to be executed.
-         * @return The result of the evaluations for each stock.
+         * @return The signals of each stock.
+         */
+        std::map<std::string, Signal> RunStrategyAllStocks(const std::string& strategyProgram) const;
+
+        /**
+         * Runs a batch of strategy programs for all loaded stocks. Programs are compiled once. The native programs of
+         * each stock are evaluated by one task of the worker pool, and the comparisons they have in common are
+         * evaluated once (see StrategyExpressionBatch). The bars of the programs of the scripting engine are
+         * independent, so they are split into time ranges of about the same length, whatever the length of the history
+         * of each stock, which the idle workers take from the queue of the pool. Ranges start at multiples of 64 bars,
+         * so each one writes its own words of the packed signals. Each range runs every program bar by bar, while the
+         * series of the stock are in cache.
+         * @param strategyPrograms The strategy programs.
+         * @return The signals of each program, in the order of the programs, for each stock.
+         */
+        std::vector<std::map<std::string, Signal>>
+        RunStrategiesAllStocks(const std::vector<std::string>& strategyPrograms) const;
+
+        /**
+         * Runs a strategy program in the scripting engine over every bar of a stock, even if it belongs to the native
+         * subset, and measures the hits and time of each line of the program and the calls and time of each function
+         * of the scripting interface. The program is compiled in an engine of its own with line cues, so the other
+         * engines keep running without them.
+         * @param strategyProgram A string with the program to be profiled.
+         * @param stock Name of the stock in the dataset.
+         * @return The profile.
+         * @throw std::invalid_argument If the program does not compile.
+         */
+        StrategyProfile ProfileStrategy(const std::string& strategyProgram, const std::string& stock) const;
+
+        /**
+         * Runs a score program, an expression of type double instead of bool, in each date available of the stock.
+         * Programs in the native subset are evaluated column-at-a-time.
+         * @param scoreProgram A string with the program to be executed.
+         * @param stock Name of the stock in the dataset.
+         * @return The score of every bar, NaN where the program raises an exception.
+         */
+        std::vector<double> RunScore(const std::string& scoreProgram, const std::string& stock) const;
+
+        /**
+         * Runs a score program for all loaded stocks, in the worker pool like RunStrategiesAllStocks.
+         * @param scoreProgram A string with the program to be executed.
+         * @return The scores of each stock.
+         */
+        std::map<std::string, std::vector<double>> RunScoreAllStocks(const std::string& scoreProgram) const;
+
+        /**
+         * Select on each date the k stocks with the highest score, among the stocks that have a score on that date.
+         * Dates are matched across stocks by their value, and ties are broken by the order of the stock names. The
+         * k-th best score of each date is found in parallel, so a whole ranking strategy takes a single evaluation of
+         * the scores instead of one boolean pass per rank.
+         * @param scores The scores of each stock, one per date of the stock, as given by RunScoreAllStocks. NaN scores
+         * are never selected.
+         * @param k The number of stocks to select on each date.
+         * @return The signals of each stock, true on the dates where it is selected.
+         * @throw std::invalid_argument If the scores of a stock do not have one value per date.
+         */
+        std::map<std::string, Signal> SelectTopK(const std::map<std::string, std::vector<double>>& scores,
+                                                 size_t k) const;
+
+        /**
+         * Select on each date the k stocks with the lowest score. See SelectTopK.
+         * @param scores The scores of each stock, one per date of the stock.
+         * @param k The number of stocks to select on each date.
+         * @return The signals of each stock, true on the dates where it is selected.
          */
-        static std::map<std::string, std::vector<bool>> RunStrategyAllStocks(const std::string& strategyProgram);
+        std::map<std::string, Signal> SelectBottomK(const std::map<std::string, std::vector<double>>& scores,
+                                                    size_t k) const;
 
         //*****************************
         //*    Observable accessors   *
@@ -77,41 +264,177 @@ namespace backtester
          * @param time The time index.
          * @return The date.
          */
-        static std::string Date(const std::string& stock, int time);
+        std::string Date(const std::string& stock, int time) const;
 
         /**
          * Get a list of dates for a stock.
          * @param stock The stock.
          * @return The list of dates.
          */
-        static std::vector<std::string> Dates(const std::string& stock);
+        const std::vector<std::string>& Dates(const std::string& stock) const;
 
         /**
-         * Get the value of an indicator for a stock at a time index.
+         * Get the value of an indicator for a stock at a time index. Names that are not registered indicators are
+         * looked up among the derived indicators of the stock.
          * @param indicatorName The name of the indicator.
          * @param stock The stock.
          * @param time The time index.
          * @return The indicator value.
          */
-        static double Indicator(const std::string& indicatorName, const std::string& stock, int time);
+        double Indicator(const std::string& indicatorName, const std::string& stock, int time) const;
 
         /**
-         * Get the value of a quantile of an indicator for a stock at a time index.
+         * Get the value of an indicator for a stock at a time index.
+         * @param indicator The identifier of the indicator.
+         * @param stock The stock.
+         * @param time The time index.
+         * @return The indicator value.
+         */
+        double Indicator(IndicatorId indicator, const std::string& stock, int time) const;
+
+        /**
+         * Get the value of a derived indicator for a stock at a time index.
+         * @param derivedName The name of the derived indicator.
+         * @param stock The stock.
+         * @param time The time index.
+         * @return The derived indicator value. It is NaN where the history is not long enough.
+         */
+        double Derived(const std::string& derivedName, const std::string& stock, int time) const;
+
+        /**
+         * Get the value of a quantile of an indicator for a stock at a time index. The quantile is taken over the
+         * windowSize values preceding the time index. Percentiles other than the precomputed ones are answered with
+         * the range quantile index of the stock.
          * @param indicatorName The name of the indicator.
-         * @param percentile The percentile of the quantile.
+         * @param percentile The percentile of the quantile, e.g. "0.75".
          * @param stock The stock.
          * @param time The time index.
          * @return The indicator quantile value.
          */
-        static double IndQuantile(const std::string& indicatorName, const std::string& percentile, const std::string& stock, int time);
+        double IndQuantile(const std::string& indicatorName, const std::string& percentile, const std::string& stock, int time) const;
 
         /**
-         * Get the time series of an indicator for a stock.
+         * Get the value of a quantile of an indicator for a stock at a time index.
+         * @param indicator The identifier of the indicator.
+         * @param percentile The identifier of the percentile.
+         * @param stock The stock.
+         * @param time The time index.
+         * @return The indicator quantile value.
+         */
+        double IndQuantile(IndicatorId indicator, PercentileId percentile, const std::string& stock, int time) const;
+
+        /**
+         * Get a quantile of an indicator for a stock over the values preceding a time index, for any percentile and
+         * window. It is answered in O(log n) by the range quantile index of the stock.
+         * @param indicatorName The name of the indicator.
+         * @param percentile The percentile in [0, 1].
+         * @param window The number of values preceding the time index.
+         * @param stock The stock.
+         * @param time The time index.
+         * @return The quantile value. If there are less than window values before the time index, the available
+         *         ones are used. At the first time index there are none and it is NaN.
+         */
+        double IndQuantileWindow(const std::string& indicatorName, double percentile, int window,
+                                 const std::string& stock, int time) const;
+
+        /**
+         * Get a quantile of an indicator for a stock over the values preceding a time index.
+         * @param indicator The identifier of the indicator.
+         * @param percentile The percentile in [0, 1].
+         * @param window The number of values preceding the time index.
+         * @param stock The stock.
+         * @param time The time index.
+         * @return The quantile value, or NaN at the first time index.
+         */
+        double IndQuantileWindow(IndicatorId indicator, double percentile, int window, const std::string& stock,
+                                 int time) const;
+
+        /**
+         * Get the mean of an indicator for a stock over the values preceding a time index, for any window. It is
+         * answered in O(1) by the prefix sums of the stock, so RollingMean("ClosePrice", windowSize, ...) is the SMA.
+         * @param indicatorName The name of the indicator.
+         * @param window The number of values preceding the time index.
+         * @param stock The stock.
+         * @param time The time index.
+         * @return The mean. If there are less than window values before the time index, the available ones are
+         *         used. At the first time index there are none and it is NaN. It is also NaN if the window extends
+         *         past the stored values.
+         */
+        double RollingMean(const std::string& indicatorName, int window, const std::string& stock, int time) const;
+
+        /**
+         * Get the sample standard deviation of an indicator for a stock over the values preceding a time index, for
+         * any window. It is answered in O(1) by the prefix sums of the stock.
+         * @param indicatorName The name of the indicator.
+         * @param window The number of values preceding the time index.
+         * @param stock The stock.
+         * @param time The time index.
+         * @return The standard deviation. If there are less than window values before the time index, the available
+         *         ones are used. It is NaN with less than two values, or if the window extends past the stored values.
+         */
+        double RollingStd(const std::string& indicatorName, int window, const std::string& stock, int time) const;
+
+        /**
+         * Get the volume weighted average close price of a stock over the values preceding a time index, for any
+         * window. It is answered in O(1) by the prefix sums of the stock.
+         * @param window The number of values preceding the time index.
+         * @param stock The stock.
+         * @param time The time index.
+         * @return The VWAP. If there are less than window values before the time index, the available ones are
+         *         used. At the first time index there are none and it is NaN. It is also NaN if the window extends
+         *         past the stored values.
+         */
+        double RollingVWAP(int window, const std::string& stock, int time) const;
+
+        /**
+         * Get the rolling correlation of the close returns of two stocks. ComputeCorrelations must be called first.
+         * @param stockA The first stock.
+         * @param stockB The second stock.
+         * @param time The time index in the dates of the first stock.
+         * @return The correlation, or NaN if the time index is negative or the window has less than two aligned
+         * returns.
+         */
+        double RollingCorrelation(const std::string& stockA, const std::string& stockB, int time) const;
+
+        /**
+         * Get the rolling beta of the close returns of a stock with respect to a benchmark stock.
+         * ComputeCorrelations must be called first.
+         * @param stock The stock.
+         * @param benchmark The benchmark stock.
+         * @param time The time index in the dates of the stock.
+         * @return The beta, or NaN if the time index is negative or the window has less than two aligned returns.
+         */
+        double RollingBeta(const std::string& stock, const std::string& benchmark, int time) const;
+
+        /**
+         * Get the rolling percentile rank of an indicator for a stock at a time index, that is, the mid-rank of its
+         * current value among the last windowSize values of the indicator: the number of values below it plus half
+         * the number of values equal to it, current value included, divided by the number of values.
+         * @param indicatorName The name of the indicator.
+         * @param stock The stock.
+         * @param time The time index.
+         * @return The percentile rank in (0, 1), or NaN if the ranks were not computed or the time index is out of
+         * range.
+         */
+        double IndPercentileRank(const std::string& indicatorName, const std::string& stock, int time) const;
+
+        /**
+         * Get the rolling percentile rank of an indicator for a stock at a time index, as a mid-rank.
+         * @param indicator The identifier of the indicator.
+         * @param stock The stock.
+         * @param time The time index.
+         * @return The percentile rank in (0, 1), or NaN if the ranks were not computed or the time index is out of
+         * range.
+         */
+        double IndPercentileRank(IndicatorId indicator, const std::string& stock, int time) const;
+
+        /**
+         * Get the time series of an indicator or a derived indicator for a stock.
          * @param indicatorName The name of the indicator.
          * @param stock The stock.
          * @return A time series of the indicator as a list.
          */
-        static std::vector<double>& IndicatorTimeSeries(const std::string& indicatorName, const std::string& stock);
+        std::vector<double> IndicatorTimeSeries(const std::string& indicatorName, const std::string& stock) const;
 
         /**
          * Get the time series of a indicator quantile for a stock.
@@ -120,8 +443,25 @@ namespace backtester
          * @param stock The stock.
          * @return A time series of the indicator quantile as a list.
          */
-        static std::vector<double>& IndQuantileTimeSeries(const std::string& indicatorName, const std::string& percentile,
-                                                          const std::string& stock);
+        std::vector<double> IndQuantileTimeSeries(const std::string& indicatorName, const std::string& percentile,
+                                                  const std::string& stock) const;
+
+        /**
+         * Get the time series of the rolling percentile rank of an indicator for a stock.
+         * @param indicatorName The name of the indicator.
+         * @param stock The stock.
+         * @return A time series of the percentile rank as a list.
+         */
+        std::vector<double> IndPercentileRankTimeSeries(const std::string& indicatorName,
+                                                        const std::string& stock) const;
+
+        /**
+         * Get a view over the time series of an indicator for a stock, without copying it.
+         * @param indicator The identifier of the indicator.
+         * @param stock The stock.
+         * @return A view over the stored series.
+         */
+        SeriesView Series(IndicatorId indicator, const std::string& stock) const;
 
     };
 }
\ No newline at end of file
@@ -0,0 +1,82 @@
+#pragma once
+#include <vector>
+#include <cstddef>
+
+namespace backtester
+{
+    /**
+     * Fenwick tree (binary indexed tree) over the positions [0, size). Supports point updates and prefix sums in
+     * O(log size).
+     * @tparam T Numeric type of the accumulated values.
+     */
+    template<typename T = int>
+    class FenwickTree
+    {
+    private:
+        std::vector<T> tree;
+
+    public:
+
+        /**
+         * Create a tree with all the positions set to zero.
+         * @param size Number of positions.
+         */
+        explicit FenwickTree(size_t size) : tree(size + 1, T(0)) {}
+
+        /** Returns the number of positions. */
+        [[nodiscard]] size_t Size() const
+        {
+            return tree.size() - 1;
+        }
+
+        /**
+         * Add a value to a position.
+         * @param index The position.
+         * @param delta The value to add.
+         */
+        void Add(size_t index, T delta)
+        {
+            for (size_t i = index + 1; i < tree.size(); i += i & (~i + 1))
+                tree[i] += delta;
+        }
+
+        /**
+         * Sum of the positions [0, index).
+         * @param index One past the last position of the sum.
+         * @return The prefix sum.
+         */
+        [[nodiscard]] T PrefixSum(size_t index) const
+        {
+            T sum = T(0);
+            for (size_t i = index; i > 0; i -= i & (~i + 1))
+                sum += tree[i];
+
+            return sum;
+        }
+
+        /**
+         * Find the first position whose prefix sum exceeds a value, in O(log size). All the positions must hold
+         * non-negative values.
+         * @param value The value.
+         * @return The smallest index such that PrefixSum(index + 1) > value, or Size() if there is none.
+         */
+        [[nodiscard]] size_t UpperBound(T value) const
+        {
+            size_t step = 1;
+            while (step * 2 < tree.size())
+                step *= 2;
+
+            size_t position = 0;
+            for (; step > 0; step /= 2)
+            {
+                if (position + step < tree.size() && !(value < tree[position + step]))
+                {
+                    position += step;
+                    value -= tree[position];
+                }
+            }
+
+            return position;
+        }
+    };
+}
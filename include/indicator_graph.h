@@ -0,0 +1,77 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <functional>
+#include <unordered_map>
+#include "dataset.h"
+
+namespace backtester
+{
+    //*****************************
+    //*   Indicator dependencies  *
+    //****************************/
+
+    /**
+     * Node of the indicator dependency graph. A node declares the names of the series it consumes and the function
+     * that computes its own series from them. Source nodes declare no inputs and read the raw OCHLVData directly.
+     */
+    struct IndicatorNode
+    {
+        /** Input series handed to the compute function, in the same order as IndicatorNode::inputs. */
+        using Inputs = std::vector<const std::vector<double>*>;
+
+        /** Signature of the function that computes the series of the node. */
+        using Function = std::function<std::vector<double>(const std::vector<OCHLVData>&, const Inputs&)>;
+
+        std::string name;
+        std::vector<std::string> inputs;
+        Function compute;
+    };
+
+    /**
+     * Directed acyclic graph of indicators. Every node is evaluated at most once per call to Evaluate, in topological
+     * order, and its series is shared by all the nodes that depend on it.
+     */
+    class IndicatorGraph
+    {
+    private:
+        std::vector<IndicatorNode> nodes;
+        std::unordered_map<std::string, size_t> nodeIndex;
+
+    public:
+
+        /**
+         * Add a node to the graph. Its inputs may be added later, but they must exist before evaluation.
+         * @param node The node to be added.
+         * @throws std::invalid_argument If a node with the same name already exists.
+         */
+        void AddNode(IndicatorNode node);
+
+        /**
+         * Check if a node is present in the graph.
+         * @param name The name of the node.
+         * @return The result.
+         */
+        [[nodiscard]] bool HasNode(const std::string& name) const;
+
+        /** Returns the names of all the nodes in insertion order. */
+        [[nodiscard]] std::vector<std::string> NodeNames() const;
+
+        /**
+         * Sort the nodes needed to compute the targets so that every node appears after its inputs.
+         * @param targets Names of the requested nodes. If empty, all the nodes of the graph are sorted.
+         * @return The names of the nodes in evaluation order.
+         * @throws std::runtime_error If an input is missing or the graph contains a cycle.
+         */
+        [[nodiscard]] std::vector<std::string> TopologicalOrder(const std::vector<std::string>& targets = {}) const;
+
+        /**
+         * Evaluate the targets and all of their dependencies over the raw data.
+         * @param rawData List of OCHLVData.
+         * @param targets Names of the requested nodes. If empty, all the nodes of the graph are evaluated.
+         * @return The series of every evaluated node, including the shared intermediates.
+         */
+        [[nodiscard]] Indicators Evaluate(const std::vector<OCHLVData>& rawData,
+                                          const std::vector<std::string>& targets = {}) const;
+    };
+}
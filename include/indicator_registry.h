@@ -0,0 +1,161 @@
+#pragma once
+#include <array>
+#include <string>
+#include <string_view>
+#include <stdexcept>
+
+namespace backtester
+{
+    //*****************************
+    //*    Indicator registry     *
+    //****************************/
+
+    /** Dense identifiers of the technical indicators stored in StockData. */
+    enum class IndicatorId : unsigned
+    {
+        OpenPrice,
+        ClosePrice,
+        HighPrice,
+        LowPrice,
+        TradingVolume,
+        WeightedClose,
+        TypicalPrice,
+        MedianPrice,
+        PricePercentageChangeOpenToClose,
+        ClosingBias,
+        ExtensionRatio,
+        SMA,
+        EMA,
+        RSI,
+        VWAP,
+        OBV,
+        ROC,
+        MFI
+    };
+
+    /** Dense identifiers of the percentiles of the precomputed quantile indicators. */
+    enum class PercentileId : unsigned
+    {
+        P05,
+        P15,
+        P25,
+        P75,
+        P85,
+        P95
+    };
+
+    /**
+     * Compile-time table of the indicators and percentiles stored in StockData. Names are only used at the edges of
+     * the API; internally indicators are addressed by their dense index.
+     */
+    class IndicatorRegistry
+    {
+    public:
+        static constexpr unsigned indicatorCount = 18;
+        static constexpr unsigned percentileCount = 6;
+
+        static constexpr std::array<std::string_view, indicatorCount> indicatorNames {
+                "OpenPrice", "ClosePrice", "HighPrice", "LowPrice", "TradingVolume", "WeightedClose",
+                "TypicalPrice", "MedianPrice", "PricePercentageChangeOpenToClose", "ClosingBias", "ExtensionRatio",
+                "SMA", "EMA", "RSI", "VWAP", "OBV", "ROC", "MFI"
+        };
+
+        static constexpr std::array<std::string_view, percentileCount> percentileNames {
+                "0.05", "0.15", "0.25", "0.75", "0.85", "0.95"
+        };
+
+        static constexpr std::array<double, percentileCount> percentileValues {
+                0.05, 0.15, 0.25, 0.75, 0.85, 0.95
+        };
+
+        /** Returns the dense index of an indicator. */
+        static constexpr unsigned Index(IndicatorId id)
+        {
+            return static_cast<unsigned>(id);
+        }
+
+        /** Returns the dense index of a percentile. */
+        static constexpr unsigned Index(PercentileId id)
+        {
+            return static_cast<unsigned>(id);
+        }
+
+        /** Returns the name of an indicator. */
+        static constexpr std::string_view Name(IndicatorId id)
+        {
+            return indicatorNames[Index(id)];
+        }
+
+        /** Returns the name of a percentile. */
+        static constexpr std::string_view Name(PercentileId id)
+        {
+            return percentileNames[Index(id)];
+        }
+
+        /**
+         * Look up an indicator by name.
+         * @param name The name of the indicator.
+         * @param id Output identifier.
+         * @return Is the name registered?
+         */
+        static constexpr bool TryFromName(std::string_view name, IndicatorId& id)
+        {
+            for (unsigned i = 0; i < indicatorCount; i++)
+            {
+                if (indicatorNames[i] == name)
+                {
+                    id = static_cast<IndicatorId>(i);
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        /**
+         * Look up a percentile by name.
+         * @param name The percentile as formatted in QuantileIndicators, e.g. "0.75".
+         * @param id Output identifier.
+         * @return Is the percentile registered?
+         */
+        static constexpr bool TryFromName(std::string_view name, PercentileId& id)
+        {
+            for (unsigned i = 0; i < percentileCount; i++)
+            {
+                if (percentileNames[i] == name)
+                {
+                    id = static_cast<PercentileId>(i);
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        /**
+         * Look up an indicator by name.
+         * @param name The name of the indicator.
+         * @return The identifier.
+         * @throws std::invalid_argument If the indicator is not registered.
+         */
+        static IndicatorId IndicatorFromName(std::string_view name)
+        {
+            IndicatorId id{};
+            if (!TryFromName(name, id))
+                throw std::invalid_argument("Unknown indicator " + std::string(name) + ".");
+            return id;
+        }
+
+        /**
+         * Look up a percentile by name.
+         * @param name The percentile as formatted in QuantileIndicators, e.g. "0.75".
+         * @return The identifier.
+         * @throws std::invalid_argument If the percentile is not registered.
+         */
+        static PercentileId PercentileFromName(std::string_view name)
+        {
+            PercentileId id{};
+            if (!TryFromName(name, id))
+                throw std::invalid_argument("Unknown percentile " + std::string(name) + ".");
+            return id;
+        }
+    };
+}
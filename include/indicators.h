@@ -5,6 +5,7 @@
 #include <limits>
 #include <cassert>
 #include "dataset.h"
+#include "indicator_graph.h"
 
 namespace backtester
 {
@@ -12,6 +13,16 @@ namespace backtester
     //#define windowSize 40
     const int windowSize = 40;
 
+    /** Number of bins of the sketch used by approximate rolling quantiles. */
+    const unsigned quantileSketchBins = 1024;
+
+    /** Computation mode of rolling quantiles. */
+    enum class QuantileMode
+    {
+        Exact,      ///< Sort every window. O(n w log w) time.
+        Approximate ///< Sliding histogram sketch. O(n log bins) time and O(bins) memory, see RollingQuantileSketch.
+    };
+
     class Indicator
     {
     public:
@@ -40,12 +51,74 @@ namespace backtester
         static double ROC(const std::vector<OCHLVData>& data);
         static double MFI(const std::vector<OCHLVData>& data);
 
+        /**
+         * The same technical indicators over the instant series they depend on: the EMA from the close and the
+         * previous EMA, and the windowed ones from pointers to the first value of the window in each series and the
+         * size of the window. The overloads over OCHLVData delegate to them, and the indicator graph evaluates them
+         * over its shared series.
+         */
+        static double EMA(double close, double previous);
+        static double SMA(const double* close, size_t size);
+        static double RSI(const double* close, size_t size);
+        static double VWAP(const double* close, const double* volume, size_t size);
+        static double OBV(const double* close, const double* volume, size_t size);
+        static double ROC(const double* close, size_t size);
+        static double MFI(const double* typicalPrice, const double* volume, size_t size);
+
         /** Calculate all the available technical indicators from OCHLVData. */
         static Indicators CalculateIndicators(const std::vector<OCHLVData>& rawData);
 
         /** Calculate all the quantiles of technical indicators from OCHLVData. */
         static QuantileIndicators CalculateQuantileIndicators(const std::vector<OCHLVData>& rawData);
 
+        //*****************************
+        //*  Indicator dependencies   *
+        //****************************/
+
+        /**
+         * Returns the dependency graph of all the available technical indicators and their quantiles. Each node
+         * holds the full, unaligned series; ExportIndicators and ExportQuantileIndicators align them to the dates.
+         */
+        static const IndicatorGraph& Graph();
+
+        /**
+         * Name of the graph node that holds the quantile of an indicator.
+         * @param indicatorName The name of the indicator.
+         * @param percentile The percentile as formatted in QuantileIndicators.
+         * @return The node name.
+         */
+        static std::string QuantileNodeName(const std::string& indicatorName, const std::string& percentile);
+
+        /**
+         * Name of the graph node that holds the rolling percentile rank of an indicator.
+         * @param indicatorName The name of the indicator.
+         * @return The node name.
+         */
+        static std::string PercentileRankNodeName(const std::string& indicatorName);
+
+        /**
+         * Select the technical indicators from the series evaluated by the graph, aligned to the dataset dates.
+         * @param series Output of IndicatorGraph::Evaluate.
+         * @return The technical indicators.
+         */
+        static Indicators ExportIndicators(const Indicators& series);
+
+        /**
+         * Select the quantiles of technical indicators from the series evaluated by the graph, aligned to the
+         * dataset dates.
+         * @param series Output of IndicatorGraph::Evaluate.
+         * @return The quantiles of technical indicators.
+         */
+        static QuantileIndicators ExportQuantileIndicators(const Indicators& series);
+
+        /**
+         * Select the rolling percentile ranks of technical indicators from the series evaluated by the graph, aligned
+         * to the dataset dates.
+         * @param series Output of IndicatorGraph::Evaluate.
+         * @return The percentile ranks keyed by indicator name.
+         */
+        static Indicators ExportPercentileRanks(const Indicators& series);
+
         //****************************
         //*   Quantile calculation    *
         //****************************/
@@ -90,6 +163,37 @@ namespace backtester
             return quantile;
         }
 
+        /**
+         * Calculates the rolling percentile rank of every value of a series within the last values of the series.
+         * The rank of x is (number of values below x + half the number of values equal to x) / number of values,
+         * so it lies in (0, 1). It is computed in O(n log n) with a Fenwick tree over the sorted distinct values.
+         * NaN values are skipped and have a NaN rank.
+         * @param series The time series.
+         * @param window Number of values, including the current one, that form the ranking window. The first
+         *               window - 1 values are ranked against the values available so far.
+         * @return The time series of percentile ranks.
+         */
+        static std::vector<double> RollingPercentileRank(const std::vector<double>& series,
+                                                         unsigned window = windowSize);
+
+        /**
+         * Calculates an approximate rolling quantile with a sliding histogram sketch. The range of the series is
+         * split into equal bins whose counts are kept in a Fenwick tree; values entering and leaving the window update
+         * one bin, and the quantile is the center of the bin that holds it. Memory is O(bins) whatever the window, and
+         * time is O(n log bins). The absolute error with respect to CalculateQuantile over the same window is at most
+         * half a bin width, (max - min) / (2 bins), where max and min are the extreme finite values of the whole
+         * series. NaN and infinite values are not counted, so the bound holds against the quantile of the finite values
+         * of the window.
+         * @param series The time series.
+         * @param percentile The percentile used to calculate the quantile.
+         * @param window Size of the partition window.
+         * @param bins Number of bins of the sketch.
+         * @return A list containing the time-series of the quantile, with the same alignment as RollingQuantile.
+         */
+        static std::vector<double> RollingQuantileSketch(const std::vector<double>& series, double percentile,
+                                                         unsigned window = windowSize,
+                                                         unsigned bins = quantileSketchBins);
+
         //**********************************
         //*   Time-series of observables    *
         //**********************************/
@@ -153,52 +257,68 @@ namespace backtester
             return output;
         }
 
-        /// Return a time series of the indicator quantile.
+        /// Return a rolling time series of the quantile of an already evaluated time series.
         /// \tparam T Indicator return type.
-        /// \param TechIndFunction Function pointer to the technical indicator.
-        /// \param timeSeries List of OCHLVData.
+        /// \param series The time series.
         /// \param percentile The percentile used to calculate the quantile.
         /// \param window Size of the partition window.
-        /// \return A list containing the time-series of the quantile indicator.
+        /// \param mode Exact or approximate computation.
+        /// \return A list containing the time-series of the quantile.
         template<typename T>
-        static std::vector<T> QuantileTimeSeries(T(*TechIndFunction)(const std::vector<OCHLVData>&),
-                                                 std::vector<OCHLVData> timeSeries, double percentile,
-                                                 const unsigned window = windowSize)
+        static std::vector<T> RollingQuantile(const std::vector<T>& series, double percentile,
+                                              const unsigned window = windowSize,
+                                              QuantileMode mode = QuantileMode::Exact)
         {
-            std::vector<T> indicatorTimeSeries = IndicatorTimeSeries(TechIndFunction, timeSeries, window);
+            if (mode == QuantileMode::Approximate)
+            {
+                const std::vector<double> sketch = RollingQuantileSketch(std::vector<double>(series.begin(), series.end()),
+                                                                         percentile, window);
+                return std::vector<T>(sketch.begin(), sketch.end());
+            }
 
             std::vector<T> quantileTimeSeries;
-            for (unsigned i = 0; i < indicatorTimeSeries.size() - window; i++)
+            std::vector<T> partition;
+            for (size_t i = 0; i + window < series.size(); i++)
             {
-                std::vector<T> partition(indicatorTimeSeries.begin() + i, indicatorTimeSeries.begin() + i + window);
-                quantileTimeSeries.push_back(CalculateQuantile(partition, percentile));
+                partition.assign(series.begin() + i, series.begin() + i + window);
+                quantileTimeSeries.push_back(CalculateQuantile(partition, static_cast<T>(percentile)));
             }
 
             return quantileTimeSeries;
         }
 
+        /// Return a time series of the indicator quantile.
+        /// \tparam T Indicator return type.
+        /// \param TechIndFunction Function pointer to the technical indicator.
+        /// \param timeSeries List of OCHLVData.
+        /// \param percentile The percentile used to calculate the quantile.
+        /// \param window Size of the partition window.
+        /// \param mode Exact or approximate computation.
+        /// \return A list containing the time-series of the quantile indicator.
+        template<typename T>
+        static std::vector<T> QuantileTimeSeries(T(*TechIndFunction)(const std::vector<OCHLVData>&),
+                                                 std::vector<OCHLVData> timeSeries, double percentile,
+                                                 const unsigned window = windowSize,
+                                                 QuantileMode mode = QuantileMode::Exact)
+        {
+            return RollingQuantile(IndicatorTimeSeries(TechIndFunction, timeSeries, window), percentile, window, mode);
+        }
+
         /// Return a time series of the indicator quantile.
         /// \tparam T Indicator return type.
         /// \param TechIndFunction Function pointer to the technical indicator.
         /// \param timeSeries List of OCHLVData.
         /// \param percentile The percentile used to calculate the quantile.
         /// \param window The size of the time-series window.
+        /// \param mode Exact or approximate computation.
         /// \return A list containing the time-series of the requested quantile indicator.
         template<typename T>
         static std::vector<T> QuantileTimeSeries(T (*TechIndFunction)(const OCHLVData&),
                                                  const std::vector<OCHLVData>& timeSeries, double percentile,
-                                                 const unsigned window = windowSize)
+                                                 const unsigned window = windowSize,
+                                                 QuantileMode mode = QuantileMode::Exact)
         {
-            std::vector<T> indicatorTimeSeries = IndicatorTimeSeries(TechIndFunction, timeSeries);
-
-            std::vector<T> quantileTimeSeries;
-            for (unsigned i = 0; i < indicatorTimeSeries.size() - window; i++)
-            {
-                std::vector<T> partition(indicatorTimeSeries.begin() + i, indicatorTimeSeries.begin() + i + window);
-                quantileTimeSeries.push_back(CalculateQuantile(partition, percentile));
-            }
-
-            return quantileTimeSeries;
+            return RollingQuantile(IndicatorTimeSeries(TechIndFunction, timeSeries), percentile, window, mode);
         }
 
         /// Return a time series of the indicator quantile.
@@ -207,22 +327,15 @@ namespace backtester
         /// \param timeSeries List of OCHLVData.
         /// \param percentile The percentile used to calculate the quantile.
         /// \param window The size of the time-series window.
+        /// \param mode Exact or approximate computation.
         /// \return A list containing the time-series of the quantile indicator.
         template<typename T>
         static std::vector<T> QuantileTimeSeries(T (*TechIndFunction)(const OCHLVData&, T),
                                                  const std::vector<OCHLVData>& timeSeries, double percentile,
-                                                 const unsigned window = windowSize)
+                                                 const unsigned window = windowSize,
+                                                 QuantileMode mode = QuantileMode::Exact)
         {
-            std::vector<T> indicatorTimeSeries = IndicatorTimeSeries(TechIndFunction, timeSeries);
-
-            std::vector<T> quantileTimeSeries;
-            for (unsigned i = 0; i < indicatorTimeSeries.size() - window; i++)
-            {
-                std::vector<T> partition(indicatorTimeSeries.begin() + i, indicatorTimeSeries.begin() + i + window);
-                quantileTimeSeries.push_back(CalculateQuantile(partition, percentile));
-            }
-
-            return quantileTimeSeries;
+            return RollingQuantile(IndicatorTimeSeries(TechIndFunction, timeSeries), percentile, window, mode);
         }
     };
 }
\ No newline at end of file
@@ -2,16 +2,23 @@
 #include <vector>
 #include <string>
 #include "dataset.h"
+#include "derived_indicators.h"
 
 namespace backtester
 {
     class Loader
     {
+    private:
+        inline static std::vector<DerivedIndicator> derivedIndicators;
+
     public:
 
         /** Defines the serialized data directory name. */
         inline static const std::string cacheDirectoryName = "Cache";
 
+        /** Version of the serialized StockData layout. Cached files of a different version are rebuilt. */
+        inline static const int cacheFormatVersion = 5;
+
         /**
          * Load OCHLVData from csv file. The expected format is a csv with the first row
          * with the following attributes: "date","open","high","low","close","volume".
@@ -42,6 +49,21 @@ namespace backtester
          */
         static Dataset LoadDataset(const std::string& path);
 
+        /**
+         * Register a derived indicator. Derived indicators are evaluated once when a stock is loaded and cached with
+         * it. Cached stocks whose derived indicators differ from the registered ones are re-evaluated on load.
+         * @param name The name of the derived indicator. It must not be the name of a registered indicator.
+         * @param expression The expression that defines it. See DerivedIndicator for the syntax.
+         * @throws std::invalid_argument If the name is taken or the expression is not valid.
+         */
+        static void RegisterDerivedIndicator(const std::string& name, const std::string& expression);
+
+        /** Remove all the registered derived indicators. */
+        static void ClearDerivedIndicators();
+
+        /** Returns the registered derived indicators in registration order. */
+        static const std::vector<DerivedIndicator>& DerivedIndicators();
+
         /**
          * Clear the temporary serialized data directory.
          * @param path The path to the dataset.
@@ -0,0 +1,49 @@
+#pragma once
+#include <vector>
+#include <string>
+#include "strategy_expression.h"
+
+namespace backtester
+{
+    //*****************************
+    //*  Compiled native strategy *
+    //****************************/
+
+    /**
+     * Strategy expression translated to C++, compiled by the local compiler into a shared object and loaded with
+     * dlopen. Shared objects are stored in a cache directory under the sha256 of their source, so each program is
+     * compiled once across runs, and loaded once per process. A program that fails to compile leaves a .failed
+     * marker next to its .log and is not compiled again. The compiler is taken from the CXX environment variable, or
+     * c++ if it is not set, and is run without a shell. Only available on Linux and macOS.
+     */
+    class NativeStrategy
+    {
+    public:
+        using Function = void (*)(const SeriesValue* const* data, const size_t* sizes, size_t timePoints,
+                                  unsigned char* signals);
+
+    private:
+        StrategyExpression expression;
+        Function function = nullptr;
+
+    public:
+
+        /**
+         * Get the compiled strategy of an expression, compiling it if it is not in the cache.
+         * @param expression The strategy expression.
+         * @param cacheDirectory Directory where the sources and shared objects are stored.
+         * @param strategy The compiled strategy. It is only written on success.
+         * @return True on success, false if the strategy could not be compiled or loaded.
+         */
+        static bool TryLoad(const StrategyExpression& expression, const std::string& cacheDirectory,
+                            NativeStrategy& strategy);
+
+        /**
+         * Evaluate the strategy over a stock.
+         * @param stockData The stock.
+         * @param signals The signal of every bar of the stock. It is only written on success.
+         * @return True on success, false if the expression refers to an indicator that the stock does not have.
+         */
+        bool TryEvaluate(const StockData& stockData, Signal& signals) const;
+    };
+}
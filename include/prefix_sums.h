@@ -0,0 +1,125 @@
+#pragma once
+#include <cmath>
+#include <limits>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+namespace backtester
+{
+    //*****************************
+    //*    Rolling sum index      *
+    //****************************/
+
+    /**
+     * Prefix sums and prefix sums of squares of a series, which give the sum, mean and standard deviation of any
+     * range of positions in O(1). Values are shifted by the first finite value of the series to reduce cancellation.
+     * Ranges that contain a NaN or an infinite value evaluate to NaN; these values are counted apart and do not enter
+     * the sums, so they do not affect the other ranges. Series are limited to 2^32 - 1 positions by the 32-bit counts.
+     */
+    class PrefixSums
+    {
+    private:
+        double shift = 0.0;
+        std::vector<double> sums {0.0};
+        std::vector<double> squares {0.0};
+        std::vector<std::uint32_t> missing {0};
+
+    public:
+
+        /** Default constructor. Creates an empty index. */
+        PrefixSums() = default;
+
+        /**
+         * Build the index of a series.
+         * @param series The series.
+         */
+        explicit PrefixSums(const std::vector<double>& series) : PrefixSums(series.data(), series.data() + series.size())
+        {
+        }
+
+        /**
+         * Build the index of a series given by a range of values.
+         * @param begin Pointer to the first value of the series.
+         * @param end Pointer past the last value of the series.
+         */
+        template <typename T> PrefixSums(const T* begin, const T* end)
+        {
+            for (const T* value = begin; value != end; value++)
+            {
+                if (std::isfinite(*value))
+                {
+                    shift = double(*value);
+                    break;
+                }
+            }
+
+            const size_t size = size_t(end - begin);
+            sums.reserve(size + 1);
+            squares.reserve(size + 1);
+            missing.reserve(size + 1);
+            for (const T* value = begin; value != end; value++)
+            {
+                const bool isMissing = !std::isfinite(*value);
+                const double x = isMissing ? 0.0 : double(*value) - shift;
+                sums.push_back(sums.back() + x);
+                squares.push_back(squares.back() + x * x);
+                missing.push_back(missing.back() + isMissing);
+            }
+        }
+
+        /** Is [begin, end) a range of indexed positions without non-finite values? */
+        [[nodiscard]] bool Complete(size_t begin, size_t end) const
+        {
+            return begin <= end && end < missing.size() && missing[end] == missing[begin];
+        }
+
+        /** Returns the number of indexed positions. */
+        [[nodiscard]] size_t Size() const
+        {
+            return sums.size() - 1;
+        }
+
+        /**
+         * Sum of the positions [begin, end).
+         * @return The sum, 0 if the range is empty or NaN if it contains a non-finite value or ends past the indexed
+         * positions.
+         */
+        [[nodiscard]] double Sum(size_t begin, size_t end) const
+        {
+            if (!Complete(begin, end))
+                return std::numeric_limits<double>::quiet_NaN();
+
+            return sums[end] - sums[begin] + double(end - begin) * shift;
+        }
+
+        /**
+         * Mean of the positions [begin, end).
+         * @return The mean, or NaN if the range is empty, contains a non-finite value or ends past the indexed
+         * positions.
+         */
+        [[nodiscard]] double Mean(size_t begin, size_t end) const
+        {
+            if (begin >= end || !Complete(begin, end))
+                return std::numeric_limits<double>::quiet_NaN();
+
+            return (sums[end] - sums[begin]) / double(end - begin) + shift;
+        }
+
+        /**
+         * Sample standard deviation of the positions [begin, end).
+         * @return The standard deviation, or NaN if the range has less than two values, contains a non-finite value or
+         * ends past the indexed positions.
+         */
+        [[nodiscard]] double Std(size_t begin, size_t end) const
+        {
+            if (begin + 1 >= end || !Complete(begin, end))
+                return std::numeric_limits<double>::quiet_NaN();
+
+            const double n = double(end - begin);
+            const double sum = sums[end] - sums[begin];
+            const double variance = (squares[end] - squares[begin] - sum * sum / n) / (n - 1.0);
+            return std::sqrt(variance > 0.0 ? variance : 0.0);
+        }
+    };
+}
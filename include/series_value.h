@@ -0,0 +1,16 @@
+#pragma once
+
+namespace backtester
+{
+    //*****************************
+    //*   Series storage type     *
+    //****************************/
+
+#if defined(BACKTESTER_FLOAT_STORAGE)
+    /** Storage type of indicator series. Indicators are computed in double precision and stored as float. */
+    using SeriesValue = float;
+#else
+    /** Storage type of indicator series. */
+    using SeriesValue = double;
+#endif
+}
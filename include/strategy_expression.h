@@ -0,0 +1,156 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <memory>
+#include <unordered_map>
+#include "dataset.h"
+#include "strategy_signal.h"
+
+namespace backtester
+{
+    //*****************************
+    //*   Native strategy rules   *
+    //****************************/
+
+    /**
+     * Strategy program compiled to a native expression tree that is evaluated column-at-a-time over whole series,
+     * instead of bar by bar in the scripting engine. Only the following subset of the strategy language is accepted:
+     *  - Indicator("Name", stock, time) and IndQuantile("Name", "Percentile", stock, time) with literal names, a
+     *    precomputed percentile and an optional lag written as time - k.
+     *  - Numbers, unary -, +, -, *, / and parentheses.
+     *  - The comparisons <, <=, >, >=, == and != between numeric expressions.
+     *  - The boolean operators &&, ||, ! (or and, or, not) and parentheses.
+     * The results are the same as the ones of the scripting engine, including its ordering of NaN values, which
+     * compare as greater than any value, and bars that raise a script exception (reads before the first bar, division
+     * by zero), which evaluate to false.
+     */
+    class StrategyExpression
+    {
+        friend class StrategyExpressionBatch;
+
+    public:
+        struct Node;
+
+    private:
+        std::string program;
+        std::shared_ptr<const Node> root;
+
+    public:
+
+        /**
+         * Compile a strategy program if it belongs to the native subset.
+         * @param program The strategy program.
+         * @param expression The compiled expression. It is only written on success.
+         * @return True if the program was compiled, false if it has to be run by the scripting engine.
+         */
+        static bool TryCompile(const std::string& program, StrategyExpression& expression);
+
+        /**
+         * Compile a score program, a numeric expression of the same subset, if it belongs to the native subset.
+         * @param program The score program.
+         * @param expression The compiled expression. It is only written on success.
+         * @return True if the program was compiled, false if it has to be run by the scripting engine.
+         */
+        static bool TryCompileScore(const std::string& program, StrategyExpression& expression);
+
+        /** Returns the strategy program. */
+        [[nodiscard]] const std::string& Program() const { return program; }
+
+        /**
+         * Evaluate the strategy over a stock.
+         * @param stockData The stock.
+         * @param signals The signal of every bar of the stock. It is only written on success.
+         * @return True on success, false if the expression refers to an indicator that the stock does not have.
+         */
+        bool TryEvaluate(const StockData& stockData, Signal& signals) const;
+
+        /**
+         * Evaluate a score expression over a stock.
+         * @param stockData The stock.
+         * @param scores The score of every bar of the stock, NaN where the scripting engine raises an exception. It is
+         * only written on success.
+         * @return True on success, false if the expression is not a score or refers to an indicator that the stock does
+         * not have.
+         */
+        bool TryEvaluateScore(const StockData& stockData, std::vector<double>& scores) const;
+
+        /**
+         * Get the series read by the expression, in the order expected by the translation to C++.
+         * @param stockData The stock.
+         * @param series The series. It is only written on success.
+         * @return True on success, false if the expression refers to an indicator that the stock does not have.
+         */
+        bool TryResolveSeries(const StockData& stockData, std::vector<SeriesView>& series) const;
+
+        /**
+         * Translate the expression to a C++ translation unit that defines
+         *     extern "C" void backtester_strategy(const SeriesValue* const* data, const size_t* sizes,
+         *                                         size_t timePoints, unsigned char* signals)
+         * where data and sizes describe the series given by TryResolveSeries. It gives the same signals as TryEvaluate.
+         * @return The source code.
+         */
+        [[nodiscard]] std::string ToCpp() const;
+    };
+
+    //*****************************
+    //*  Shared predicate batch   *
+    //****************************/
+
+    /**
+     * Batch of strategy expressions that share their predicates. Expressions are normalized (>, >= and != become the
+     * negation of <=, < and ==, double negations cancel and the operands of == are ordered) and their boolean nodes
+     * are hash-consed, so a comparison or a combination of comparisons that appears in many expressions is stored
+     * once. Each unique comparison is evaluated once per stock into packed columns of truth values and of bars that
+     * raise a script exception, which the boolean nodes combine 64 bars at a time with the short-circuit semantics of
+     * the scripting engine. The cost of a batch scales with its distinct predicates rather than with its expressions.
+     */
+    class StrategyExpressionBatch
+    {
+    private:
+        /** Comparison, or negation, conjunction or disjunction of the nodes before it. */
+        struct BatchNode
+        {
+            enum class Type { Predicate, Not, And, Or };
+
+            Type type = Type::Predicate;
+            std::shared_ptr<const StrategyExpression::Node> predicate;
+            size_t left = 0;
+            size_t right = 0;
+        };
+
+        std::vector<BatchNode> nodes;
+        std::unordered_map<std::string, size_t> nodeIndexes;
+        std::vector<size_t> roots;
+        size_t predicateCount = 0;
+
+        size_t intern(const std::shared_ptr<const StrategyExpression::Node>& node);
+        size_t intern(const BatchNode& node, const std::string& key);
+
+    public:
+
+        /**
+         * Add a strategy expression to the batch.
+         * @param expression The expression. It must be a strategy, not a score.
+         * @return The position of the expression in the batch.
+         */
+        size_t Add(const StrategyExpression& expression);
+
+        /** Returns the number of expressions of the batch. */
+        [[nodiscard]] size_t Size() const noexcept { return roots.size(); }
+
+        /** Returns the number of distinct comparisons of the batch, each one evaluated once per stock. */
+        [[nodiscard]] size_t PredicateCount() const noexcept { return predicateCount; }
+
+        /** Returns the number of distinct boolean nodes of the batch, comparisons included. */
+        [[nodiscard]] size_t NodeCount() const noexcept { return nodes.size(); }
+
+        /**
+         * Evaluate every expression of the batch over a stock.
+         * @param stockData The stock.
+         * @param signals The signal of every bar of the stock, for each expression.
+         * @param evaluated For each expression, false if it refers to an indicator that the stock does not have. Its
+         * signals are then left empty.
+         */
+        void Evaluate(const StockData& stockData, std::vector<Signal>& signals, std::vector<bool>& evaluated) const;
+    };
+}
@@ -0,0 +1,70 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdio>
+
+namespace backtester
+{
+    //*****************************
+    //*     Strategy profile      *
+    //****************************/
+
+    /** Hits and time spent in a line of a strategy program. */
+    struct LineProfile
+    {
+        int line = 0;
+        std::string source;
+        size_t hits = 0;
+        double seconds = 0.0;
+    };
+
+    /** Calls and time spent in a function of the scripting interface. */
+    struct AccessorProfile
+    {
+        std::string name;
+        size_t calls = 0;
+        double seconds = 0.0;
+    };
+
+    /**
+     * Profile of a strategy program run by the scripting engine over every bar of a stock. The time of a line
+     * includes the time of the accessors called from it.
+     */
+    struct StrategyProfile
+    {
+        std::string stock;
+        size_t bars = 0;
+        double seconds = 0.0;
+        std::vector<LineProfile> lines;
+        std::vector<AccessorProfile> accessors;
+
+        /** Returns the profile as a table of the lines, followed by a table of the accessors. */
+        [[nodiscard]]
+        std::string ToString() const
+        {
+            char row[128];
+            std::snprintf(row, sizeof(row), ": %zu bars in %.6f s\n", bars, seconds);
+            std::string table = "Profile of " + stock + row;
+
+            std::snprintf(row, sizeof(row), "%6s %12s %12s  %s\n", "Line", "Hits", "Time (s)", "Source");
+            table += row;
+            for (const LineProfile& line : lines)
+            {
+                std::snprintf(row, sizeof(row), "%6d %12zu %12.6f  ", line.line, line.hits, line.seconds);
+                table += row + line.source + "\n";
+            }
+
+            std::snprintf(row, sizeof(row), "%-24s %12s %12s\n", "Accessor", "Calls", "Time (s)");
+            table += row;
+            for (const AccessorProfile& accessor : accessors)
+            {
+                std::snprintf(row, sizeof(row), "%-24s %12zu %12.6f\n", accessor.name.c_str(), accessor.calls,
+                              accessor.seconds);
+                table += row;
+            }
+
+            return table;
+        }
+    };
+}
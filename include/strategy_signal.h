@@ -0,0 +1,178 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <stdexcept>
+
+namespace backtester
+{
+    //*****************************
+    //*      Strategy signal      *
+    //****************************/
+
+    /**
+     * Signals of a strategy, one per bar, packed 64 bars per word. Bar t is bit t % 64 of word t / 64, so on a little
+     * endian machine the words read as bytes are a little endian bit order packing of the bars. The bits after the
+     * last bar are always zero.
+     */
+    class Signal
+    {
+    public:
+        using Word = std::uint64_t;
+        static constexpr size_t wordBits = 64;
+
+    private:
+        std::vector<Word> words;
+        size_t length = 0;
+
+    public:
+
+        /** Default constructor. Creates an empty signal. */
+        Signal() = default;
+
+        /**
+         * Create a signal with the same value in every bar.
+         * @param size The number of bars.
+         * @param value The value of the bars.
+         */
+        explicit Signal(size_t size, bool value = false) : words((size + wordBits - 1) / wordBits, value ? ~Word(0) : 0),
+                                                           length(size)
+        {
+            clearTail();
+        }
+
+        /**
+         * Pack a list of signals. It is implicit so that lists of booleans can be given wherever a signal is expected.
+         * @param values The signal of every bar.
+         */
+        Signal(const std::vector<bool>& values) : Signal(values.size())
+        {
+            for (size_t t = 0; t < values.size(); t++)
+            {
+                if (values[t])
+                    words[t / wordBits] |= Word(1) << (t % wordBits);
+            }
+        }
+
+        /** Returns the number of bars. */
+        [[nodiscard]] size_t size() const noexcept { return length; }
+
+        /** Returns true if there are no bars. */
+        [[nodiscard]] bool empty() const noexcept { return length == 0; }
+
+        /** Returns the signal of a bar, without bounds checking. */
+        bool operator[](size_t t) const noexcept { return (words[t / wordBits] >> (t % wordBits)) & 1U; }
+
+        /**
+         * Returns the signal of a bar.
+         * @throw std::out_of_range If the bar is not in the signal.
+         */
+        [[nodiscard]] bool at(size_t t) const
+        {
+            if (t >= length)
+                throw std::out_of_range("Bar " + std::to_string(t) + " is not in the signal.");
+            return (*this)[t];
+        }
+
+        /** Set the signal of a bar, without bounds checking. */
+        void Set(size_t t, bool value) noexcept
+        {
+            const Word mask = Word(1) << (t % wordBits);
+            words[t / wordBits] = value ? words[t / wordBits] | mask : words[t / wordBits] & ~mask;
+        }
+
+        /** Returns the number of bars where the signal is true. */
+        [[nodiscard]] size_t Count() const noexcept
+        {
+            size_t count = 0;
+            for (Word word : words)
+                count += popcount(word);
+            return count;
+        }
+
+        /**
+         * Find the first bar, starting from a given one, where the signal is true. Whole words of false bars are
+         * skipped at once.
+         * @param from The first bar of the search.
+         * @return The bar, or size() if there is none.
+         */
+        [[nodiscard]] size_t FindNext(size_t from) const noexcept
+        {
+            if (from >= length)
+                return length;
+
+            size_t w = from / wordBits;
+            Word word = words[w] & (~Word(0) << (from % wordBits));
+            while (word == 0)
+            {
+                if (++w == words.size())
+                    return length;
+                word = words[w];
+            }
+            // The bits below the lowest set bit count its position.
+            return w * wordBits + popcount((word & (~word + 1)) - 1);
+        }
+
+        /** Returns the packed words. */
+        [[nodiscard]] const std::vector<Word>& Words() const noexcept { return words; }
+
+        /** Returns the packed words, to be written. Bits after the last bar must be left to zero. */
+        [[nodiscard]] Word* Data() noexcept { return words.data(); }
+
+        /** Returns the signal of every bar as a list. */
+        [[nodiscard]] std::vector<bool> ToVector() const
+        {
+            std::vector<bool> values(length);
+            for (size_t t = 0; t < length; t++)
+                values[t] = (*this)[t];
+            return values;
+        }
+
+        /** Keep the bars where both signals are true. The signals must have the same size. */
+        Signal& operator&=(const Signal& other) noexcept
+        {
+            for (size_t w = 0; w < words.size(); w++)
+                words[w] &= other.words[w];
+            return *this;
+        }
+
+        /** Keep the bars where either signal is true. The signals must have the same size. */
+        Signal& operator|=(const Signal& other) noexcept
+        {
+            for (size_t w = 0; w < words.size(); w++)
+                words[w] |= other.words[w];
+            return *this;
+        }
+
+        /** Negate the signal of every bar. */
+        void Flip() noexcept
+        {
+            for (Word& word : words)
+                word = ~word;
+            clearTail();
+        }
+
+        bool operator==(const Signal& other) const noexcept
+        {
+            return length == other.length && words == other.words;
+        }
+
+        bool operator!=(const Signal& other) const noexcept { return !(*this == other); }
+
+    private:
+        static size_t popcount(Word x) noexcept
+        {
+            x = x - ((x >> 1) & 0x5555555555555555ULL);
+            x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+            x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+            return size_t((x * 0x0101010101010101ULL) >> 56);
+        }
+
+        void clearTail() noexcept
+        {
+            if (length % wordBits != 0)
+                words.back() &= (Word(1) << (length % wordBits)) - 1;
+        }
+    };
+}
@@ -0,0 +1,75 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include "series_value.h"
+
+namespace backtester
+{
+    //*****************************
+    //*   Range quantile index    *
+    //****************************/
+
+    /**
+     * Wavelet tree over a series, stored level by level (wavelet matrix layout). It answers "k-th smallest value in
+     * the positions [begin, end)" in O(log σ), where σ is the number of distinct values of the series, using
+     * n log σ bits plus rank directories. NaN values are ordered after every other value.
+     */
+    class WaveletTree
+    {
+    private:
+        struct Level
+        {
+            std::vector<uint64_t> bits;
+            std::vector<uint32_t> ranks;
+            size_t zeros = 0;
+
+            [[nodiscard]] size_t Rank0(size_t position) const;
+        };
+
+        std::vector<SeriesValue> alphabet;
+        std::vector<Level> levels;
+        size_t size = 0;
+
+    public:
+
+        /** Default constructor. Creates an empty index. */
+        WaveletTree() = default;
+
+        /**
+         * Build the index of a series.
+         * @param series The series.
+         */
+        explicit WaveletTree(const std::vector<double>& series);
+
+        /**
+         * Build the index of a stored series. The distinct values are kept in the storage type of the series.
+         * @param begin Pointer to the first value of the series.
+         * @param end Pointer past the last value of the series.
+         */
+        WaveletTree(const SeriesValue* begin, const SeriesValue* end);
+
+        /** Returns the number of indexed positions. */
+        [[nodiscard]] size_t Size() const { return size; }
+
+        /**
+         * Get the k-th smallest value in a range of positions.
+         * @param begin First position of the range.
+         * @param end One past the last position of the range.
+         * @param k Zero-based order of the value.
+         * @return The value.
+         * @throws std::out_of_range If the range is not valid or k is not smaller than the range length.
+         */
+        [[nodiscard]] double KthSmallest(size_t begin, size_t end, size_t k) const;
+
+        /**
+         * Get the quantile of a range of positions. It follows the convention of Indicator::CalculateQuantile, so
+         * both give the same value over the same values.
+         * @param begin First position of the range.
+         * @param end One past the last position of the range.
+         * @param percentile The percentile in [0, 1].
+         * @return The quantile, or NaN if the range is empty.
+         */
+        [[nodiscard]] double Quantile(size_t begin, size_t end, double percentile) const;
+    };
+}
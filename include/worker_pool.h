@@ -0,0 +1,38 @@
+#pragma once
+#include <cstddef>
+#include <functional>
+
+namespace backtester
+{
+    //*****************************
+    //*        Worker pool        *
+    //****************************/
+
+    /**
+     * Process-wide pool of worker threads shared by the loading of datasets, the evaluation of strategies and the
+     * backtests. The threads are created on first use and live until the end of the process, so the per-thread state
+     * of the workers (scripting engines, compiled strategies, bound series) is reused across calls. Parallel loops
+     * started from a worker run sequentially in that worker, so nested loops never wait for the pool they run on.
+     */
+    class WorkerPool
+    {
+    public:
+
+        /**
+         * Set the number of worker threads. Waits for the running tasks to finish before resizing the pool.
+         * @param threadCount The number of threads. If 0, the number of hardware threads is used.
+         */
+        static void SetThreadCount(unsigned threadCount);
+
+        /** Returns the number of worker threads. */
+        static unsigned ThreadCount();
+
+        /**
+         * Run task(0), ..., task(count - 1) on the worker threads and wait for all of them to finish.
+         * @param count The number of tasks.
+         * @param task The task, called with the index of the task.
+         * @throw The first exception thrown by a task, after all the tasks have finished.
+         */
+        static void ParallelFor(size_t count, const std::function<void(size_t)>& task);
+    };
+}
@@ -42,6 +42,46 @@
 :ReturnType:     Manual
 :End:
 
+:Begin:
+:Function:       register_derived_indicator
+:Pattern:        BTRegisterDerivedIndicator[name_String, expression_String]
+:Arguments:      { name, expression }
+:ArgumentTypes:  { String, String }
+:ReturnType:     Manual
+:End:
+
+:Begin:
+:Function:       clear_derived_indicators
+:Pattern:        BTClearDerivedIndicators[]
+:Arguments:      Manual
+:ArgumentTypes:  Manual
+:ReturnType:     Manual
+:End:
+
+:Begin:
+:Function:       compute_correlations
+:Pattern:        BTComputeCorrelations[window_Integer]
+:Arguments:      { window }
+:ArgumentTypes:  { Integer }
+:ReturnType:     Manual
+:End:
+
+:Begin:
+:Function:       set_worker_thread_count
+:Pattern:        BTSetWorkerThreadCount[threadCount_Integer]
+:Arguments:      { threadCount }
+:ArgumentTypes:  { Integer }
+:ReturnType:     Manual
+:End:
+
+:Begin:
+:Function:       get_worker_thread_count
+:Pattern:        BTGetWorkerThreadCount[]
+:Arguments:      Manual
+:ArgumentTypes:  Manual
+:ReturnType:     Integer
+:End:
+
 /****************************
 *     Dataset accessors     *
 ****************************/
@@ -86,6 +126,54 @@
 :ReturnType:     Manual
 :End:
 
+:Begin:
+:Function:       get_quantile_window
+:Pattern:        BTGetQuantileWindow[indicator_String, percentile_Real, window_Integer, stock_String, time_Integer]
+:Arguments:      { indicator, percentile, window, stock, time }
+:ArgumentTypes:  { String, Real, Integer, String, Integer }
+:ReturnType:     Manual
+:End:
+
+:Begin:
+:Function:       get_rolling_mean
+:Pattern:        BTGetRollingMean[indicator_String, window_Integer, stock_String, time_Integer]
+:Arguments:      { indicator, window, stock, time }
+:ArgumentTypes:  { String, Integer, String, Integer }
+:ReturnType:     Manual
+:End:
+
+:Begin:
+:Function:       get_rolling_std
+:Pattern:        BTGetRollingStd[indicator_String, window_Integer, stock_String, time_Integer]
+:Arguments:      { indicator, window, stock, time }
+:ArgumentTypes:  { String, Integer, String, Integer }
+:ReturnType:     Manual
+:End:
+
+:Begin:
+:Function:       get_rolling_vwap
+:Pattern:        BTGetRollingVWAP[window_Integer, stock_String, time_Integer]
+:Arguments:      { window, stock, time }
+:ArgumentTypes:  { Integer, String, Integer }
+:ReturnType:     Manual
+:End:
+
+:Begin:
+:Function:       get_rolling_correlation
+:Pattern:        BTGetRollingCorrelation[stockA_String, stockB_String, time_Integer]
+:Arguments:      { stockA, stockB, time }
+:ArgumentTypes:  { String, String, Integer }
+:ReturnType:     Manual
+:End:
+
+:Begin:
+:Function:       get_rolling_beta
+:Pattern:        BTGetRollingBeta[stock_String, benchmark_String, time_Integer]
+:Arguments:      { stock, benchmark, time }
+:ArgumentTypes:  { String, String, Integer }
+:ReturnType:     Manual
+:End:
+
 :Begin:
 :Function:       get_quantile_indicator_timeseries
 :Pattern:        BTGetQuantileIndicatorTimeSeries[indicator_String, percentile_String, stock_String]
@@ -94,6 +182,22 @@
 :ReturnType:     Manual
 :End:
 
+:Begin:
+:Function:       get_percentile_rank
+:Pattern:        BTGetPercentileRank[indicator_String, stock_String, time_Integer]
+:Arguments:      { indicator, stock, time }
+:ArgumentTypes:  { String, String, Integer }
+:ReturnType:     Manual
+:End:
+
+:Begin:
+:Function:       get_percentile_rank_timeseries
+:Pattern:        BTGetPercentileRankTimeSeries[indicator_String, stock_String]
+:Arguments:      { indicator, stock }
+:ArgumentTypes:  { String, String }
+:ReturnType:     Manual
+:End:
+
 /****************************
 *      Backtesting API      *
 ****************************/
@@ -106,6 +210,24 @@
 :ReturnType:     Manual
 :End:
 
+:Begin:
+:Function:       get_strategy_values_packed
+:Pattern:        BTGetStrategyValuesPacked[strategy_String, stock_String]
+:Arguments:      { strategy, stock }
+:ArgumentTypes:  { String, String }
+:ReturnType:     Manual
+:End:
+
+:Evaluate:       BTUnpackStrategyValues[{length_Integer, words_List}] := Take[Flatten[Reverse /@ IntegerDigits[Mod[words, 2^64], 2, 64]], length] /. {1 -> True, 0 -> False}
+
+:Begin:
+:Function:       profile_strategy
+:Pattern:        BTProfileStrategy[strategy_String, stock_String]
+:Arguments:      { strategy, stock }
+:ArgumentTypes:  { String, String }
+:ReturnType:     Manual
+:End:
+
 /*************************************
 *    get_strategy_execution_data     *
 *************************************/
@@ -5,12 +5,14 @@
  *  @date   2021-05-04
  ***************************************************************/
 
+#include <memory>
 #include <vector>
 #include <string>
 #include <unordered_map>
 #include "loader.h"
 #include "backtester.h"
 #include "filesystem.h"
+#include "worker_pool.h"
 #include "mathlink.h"
 
 #if defined(WINDOWS_MATHLINK)
@@ -23,7 +25,9 @@ using namespace backtester;
 *    Global definitions     *
 ****************************/
 
-unordered_map<string, Dataset> dataset;
+/// Evaluator of every loaded dataset, by identifier, and the evaluator of the current dataset.
+unordered_map<string, shared_ptr<Evaluator>> evaluators;
+shared_ptr<Evaluator> evaluator;
 
 /****************************
 *         Utilities         *
@@ -44,12 +48,7 @@ void MLPutNull(MLINK mlp)
 
 bool is_stock_in_dataset(const string& stockName)
 {
-    Dataset currentDataset = Evaluator::GetStrategyEvaluatorDataset();
-
-    if (currentDataset.empty())
-        return false;
-
-    return !(currentDataset.find(stockName) == currentDataset.end());
+    return evaluator != nullptr && evaluator->HasStock(stockName);
 }
 
 auto get_return_function(const char* returnFunctionName)
@@ -97,8 +96,8 @@ void load_dataset_from_directory(char const* path, char const* identifier)
             if (identifierString.empty())
                 identifierString = "Main";
 
-            dataset[identifierString] = Loader::LoadDataset(stringPath);
-            Evaluator::SetStrategyEvaluatorDataset(dataset[identifierString]);
+            evaluator = make_shared<Evaluator>(Loader::LoadDataset(stringPath));
+            evaluators[identifierString] = evaluator;
 
             MLPutSymbol(stdlink, "True");
             MLEndPacket(stdlink);
@@ -119,9 +118,9 @@ void load_dataset_from_directory(char const* path, char const* identifier)
 void switch_to_dataset(char const* identifier)
 {
     string identifierString(identifier);
-    if (dataset.find(identifierString) != dataset.end())
+    if (evaluators.find(identifierString) != evaluators.end())
     {
-        Evaluator::SetStrategyEvaluatorDataset(dataset[identifierString]);
+        evaluator = evaluators[identifierString];
 
         MLPutSymbol(stdlink, "True");
         MLEndPacket(stdlink);
@@ -137,9 +136,9 @@ void unload_dataset(char const* identifier)
 {
     string identifierString(identifier);
 
-    if (dataset.find(identifierString) != dataset.end())
+    if (evaluators.find(identifierString) != evaluators.end())
     {
-        dataset.erase(identifierString);
+        evaluators.erase(identifierString);
         MLPutSymbol(stdlink, "True");
         MLEndPacket(stdlink);
     }
@@ -150,15 +149,70 @@ void unload_dataset(char const* identifier)
     }
 }
 
+void register_derived_indicator(char const* name, char const* expression)
+{
+    try
+    {
+        Loader::RegisterDerivedIndicator(name, expression);
+        MLPutSymbol(stdlink, "True");
+        MLEndPacket(stdlink);
+    }
+    catch (const invalid_argument&)
+    {
+        MLPutSymbol(stdlink, "False");
+        MLEndPacket(stdlink);
+    }
+}
+
+void clear_derived_indicators()
+{
+    Loader::ClearDerivedIndicators();
+    MLPutNull(stdlink);
+}
+
+void compute_correlations(int window)
+{
+    if (evaluator != nullptr && window > 1)
+    {
+        evaluator->ComputeCorrelations((unsigned) window);
+        MLPutSymbol(stdlink, "True");
+        MLEndPacket(stdlink);
+    }
+    else
+    {
+        MLPutSymbol(stdlink, "False");
+        MLEndPacket(stdlink);
+    }
+}
+
+void set_worker_thread_count(int threadCount)
+{
+    if (threadCount >= 0)
+    {
+        WorkerPool::SetThreadCount((unsigned) threadCount);
+        MLPutSymbol(stdlink, "True");
+        MLEndPacket(stdlink);
+    }
+    else
+    {
+        MLPutSymbol(stdlink, "False");
+        MLEndPacket(stdlink);
+    }
+}
+
+int get_worker_thread_count()
+{
+    return (int)WorkerPool::ThreadCount();
+}
+
 int get_number_of_loaded_stocks()
 {
-    vector<string> stocks = Evaluator::GetStocksInDataset();
-    return (int)stocks.size();
+    return evaluator != nullptr ? (int)evaluator->GetStocksInDataset().size() : 0;
 }
 
 void get_stock_names_of_dataset()
 {
-    vector<string> stocks = Evaluator::GetStocksInDataset();
+    vector<string> stocks = evaluator != nullptr ? evaluator->GetStocksInDataset() : vector<string>();
     if (!stocks.empty())
     {
         MLPutStringList(stdlink, stocks);
@@ -179,7 +233,7 @@ void get_date(char const* stock, int time)
 {
     if (is_stock_in_dataset(stock))
     {
-        string date = Evaluator::Date(stock, time);
+        string date = evaluator->Date(stock, time);
         MLPutString(stdlink, date.c_str());
         MLEndPacket(stdlink);
     }
@@ -194,7 +248,7 @@ void get_dates_list(char const* stock)
 {
     if (is_stock_in_dataset(stock))
     {
-        vector<string> dates = Evaluator::Dates(stock);
+        vector<string> dates = evaluator->Dates(stock);
         MLPutStringList(stdlink, dates);
         MLEndPacket(stdlink);
     }
@@ -209,7 +263,7 @@ void get_indicator(char const* indicatorName, char const* stock, int time)
 {
     if (is_stock_in_dataset(stock))
     {
-        double indValue = Evaluator::Indicator(indicatorName, stock, time);
+        double indValue = evaluator->Indicator(indicatorName, stock, time);
         MLPutReal(stdlink, indValue);
         MLEndPacket(stdlink);
     }
@@ -224,7 +278,7 @@ void get_indicator_timeseries(char const* indicatorName, char const* stock)
 {
     if (is_stock_in_dataset(stock))
     {
-        vector<double> indTS = Evaluator::IndicatorTimeSeries(indicatorName, stock);
+        vector<double> indTS = evaluator->IndicatorTimeSeries(indicatorName, stock);
         MLPutRealList(stdlink, indTS.data(), (int)indTS.size());
         MLEndPacket(stdlink);
     }
@@ -239,7 +293,7 @@ void get_quantile_indicator(char const* indicatorName, char const* percentile, c
 {
     if (is_stock_in_dataset(stock))
     {
-        double indValue = Evaluator::IndQuantile(indicatorName, percentile, stock, time);
+        double indValue = evaluator->IndQuantile(indicatorName, percentile, stock, time);
         MLPutReal(stdlink, indValue);
         MLEndPacket(stdlink);
     }
@@ -250,11 +304,101 @@ void get_quantile_indicator(char const* indicatorName, char const* percentile, c
     }
 }
 
+void get_quantile_window(char const* indicatorName, double percentile, int window, char const* stock, int time)
+{
+    if (is_stock_in_dataset(stock))
+    {
+        double indValue = evaluator->IndQuantileWindow(indicatorName, percentile, window, stock, time);
+        MLPutReal(stdlink, indValue);
+        MLEndPacket(stdlink);
+    }
+    else
+    {
+        MLPutSymbol(stdlink, "Null");
+        MLEndPacket(stdlink);
+    }
+}
+
+void get_rolling_mean(char const* indicatorName, int window, char const* stock, int time)
+{
+    if (is_stock_in_dataset(stock))
+    {
+        double value = evaluator->RollingMean(indicatorName, window, stock, time);
+        MLPutReal(stdlink, value);
+        MLEndPacket(stdlink);
+    }
+    else
+    {
+        MLPutSymbol(stdlink, "Null");
+        MLEndPacket(stdlink);
+    }
+}
+
+void get_rolling_std(char const* indicatorName, int window, char const* stock, int time)
+{
+    if (is_stock_in_dataset(stock))
+    {
+        double value = evaluator->RollingStd(indicatorName, window, stock, time);
+        MLPutReal(stdlink, value);
+        MLEndPacket(stdlink);
+    }
+    else
+    {
+        MLPutSymbol(stdlink, "Null");
+        MLEndPacket(stdlink);
+    }
+}
+
+void get_rolling_vwap(int window, char const* stock, int time)
+{
+    if (is_stock_in_dataset(stock))
+    {
+        double value = evaluator->RollingVWAP(window, stock, time);
+        MLPutReal(stdlink, value);
+        MLEndPacket(stdlink);
+    }
+    else
+    {
+        MLPutSymbol(stdlink, "Null");
+        MLEndPacket(stdlink);
+    }
+}
+
+void get_rolling_correlation(char const* stockA, char const* stockB, int time)
+{
+    if (is_stock_in_dataset(stockA) && is_stock_in_dataset(stockB))
+    {
+        double value = evaluator->RollingCorrelation(stockA, stockB, time);
+        MLPutReal(stdlink, value);
+        MLEndPacket(stdlink);
+    }
+    else
+    {
+        MLPutSymbol(stdlink, "Null");
+        MLEndPacket(stdlink);
+    }
+}
+
+void get_rolling_beta(char const* stock, char const* benchmark, int time)
+{
+    if (is_stock_in_dataset(stock) && is_stock_in_dataset(benchmark))
+    {
+        double value = evaluator->RollingBeta(stock, benchmark, time);
+        MLPutReal(stdlink, value);
+        MLEndPacket(stdlink);
+    }
+    else
+    {
+        MLPutSymbol(stdlink, "Null");
+        MLEndPacket(stdlink);
+    }
+}
+
 void get_quantile_indicator_timeseries(char const* indicatorName, char const* percentile, char const* stock)
 {
     if (is_stock_in_dataset(stock))
     {
-        vector<double> indTS = Evaluator::IndQuantileTimeSeries(indicatorName, percentile, stock);
+        vector<double> indTS = evaluator->IndQuantileTimeSeries(indicatorName, percentile, stock);
         MLPutRealList(stdlink, indTS.data(), (int)indTS.size());
         MLEndPacket(stdlink);
     }
@@ -265,6 +409,36 @@ void get_quantile_indicator_timeseries(char const* indicatorName, char const* pe
     }
 }
 
+void get_percentile_rank(char const* indicatorName, char const* stock, int time)
+{
+    if (is_stock_in_dataset(stock))
+    {
+        double rank = evaluator->IndPercentileRank(indicatorName, stock, time);
+        MLPutReal(stdlink, rank);
+        MLEndPacket(stdlink);
+    }
+    else
+    {
+        MLPutSymbol(stdlink, "Null");
+        MLEndPacket(stdlink);
+    }
+}
+
+void get_percentile_rank_timeseries(char const* indicatorName, char const* stock)
+{
+    if (is_stock_in_dataset(stock))
+    {
+        vector<double> rankTS = evaluator->IndPercentileRankTimeSeries(indicatorName, stock);
+        MLPutRealList(stdlink, rankTS.data(), (int)rankTS.size());
+        MLEndPacket(stdlink);
+    }
+    else
+    {
+        MLPutSymbol(stdlink, "Null");
+        MLEndPacket(stdlink);
+    }
+}
+
 /****************************
 *      Backtesting API      *
 ****************************/
@@ -274,15 +448,91 @@ void get_strategy_values(char const* strategyFunc, char const* stock)
     string strategyFunctionString = strategyFunc;
     if (is_stock_in_dataset(stock) && (int)strategyFunctionString.length() > 0)
     {
-        vector<bool> signals = Evaluator::RunStrategy(strategyFunc, stock);
+        Signal signals = evaluator->RunStrategy(strategyFunc, stock);
 
         MLPutFunction(stdlink, "List", (int)signals.size());
-        for (bool s : signals)
+        for (size_t t = 0; t < signals.size(); t++)
+            MLPutSymbol(stdlink, signals[t] ? "True" : "False");
+        MLEndPacket(stdlink);
+    }
+    else
+    {
+        MLPutSymbol(stdlink, "Null");
+        MLEndPacket(stdlink);
+    }
+}
+
+/**
+ * Send the strategy values packed as {length, words}, 64 bars per 64-bit word, with bar t in bit t mod 64 of word
+ * t / 64. BTUnpackStrategyValues unpacks them into a list of booleans.
+ */
+void get_strategy_values_packed(char const* strategyFunc, char const* stock)
+{
+    string strategyFunctionString = strategyFunc;
+    if (is_stock_in_dataset(stock) && (int)strategyFunctionString.length() > 0)
+    {
+        Signal signals = evaluator->RunStrategy(strategyFunc, stock);
+        const vector<Signal::Word>& words = signals.Words();
+
+        MLPutFunction(stdlink, "List", 2);
+        MLPutInteger(stdlink, (int)signals.size());
+        MLPutInteger64List(stdlink, reinterpret_cast<const mlint64*>(words.data()), (int)words.size());
+        MLEndPacket(stdlink);
+    }
+    else
+    {
+        MLPutSymbol(stdlink, "Null");
+        MLEndPacket(stdlink);
+    }
+}
+
+/**
+ * Send the profile of a strategy as an association with the keys "Seconds", "Lines", a list of {line, source, hits,
+ * seconds}, and "Accessors", a list of {name, calls, seconds}.
+ */
+void profile_strategy(char const* strategyFunc, char const* stock)
+{
+    string strategyFunctionString = strategyFunc;
+    if (is_stock_in_dataset(stock) && (int)strategyFunctionString.length() > 0)
+    {
+        try
         {
-            const string value = s ? "True" : "False";
-            MLPutSymbol(stdlink, value.c_str());
+            const StrategyProfile profile = evaluator->ProfileStrategy(strategyFunc, stock);
+
+            MLPutFunction(stdlink, "Association", 3);
+            MLPutFunction(stdlink, "Rule", 2);
+            MLPutString(stdlink, "Seconds");
+            MLPutReal(stdlink, profile.seconds);
+
+            MLPutFunction(stdlink, "Rule", 2);
+            MLPutString(stdlink, "Lines");
+            MLPutFunction(stdlink, "List", (int)profile.lines.size());
+            for (const LineProfile& line : profile.lines)
+            {
+                MLPutFunction(stdlink, "List", 4);
+                MLPutInteger(stdlink, line.line);
+                MLPutString(stdlink, line.source.c_str());
+                MLPutInteger64(stdlink, (mlint64)line.hits);
+                MLPutReal(stdlink, line.seconds);
+            }
+
+            MLPutFunction(stdlink, "Rule", 2);
+            MLPutString(stdlink, "Accessors");
+            MLPutFunction(stdlink, "List", (int)profile.accessors.size());
+            for (const AccessorProfile& accessor : profile.accessors)
+            {
+                MLPutFunction(stdlink, "List", 3);
+                MLPutString(stdlink, accessor.name.c_str());
+                MLPutInteger64(stdlink, (mlint64)accessor.calls);
+                MLPutReal(stdlink, accessor.seconds);
+            }
+            MLEndPacket(stdlink);
+        }
+        catch (const invalid_argument&)
+        {
+            MLPutSymbol(stdlink, "Null");
+            MLEndPacket(stdlink);
         }
-        MLEndPacket(stdlink);
     }
     else
     {
@@ -303,8 +553,8 @@ void get_strategy_execution_data_stoploss_profittake(char const* strategyFunc, c
     string strategyFunctionString = strategyFunc;
     if (is_stock_in_dataset(stock) && (int)strategyFunctionString.length() > 0)
     {
-        vector<bool> signals = Evaluator::RunStrategy(strategyFunc, stock);
-        vector<ExecutionData> sed = Backtester::BacktestStoplossProfittake(signals, stock, profitTake, stopLoss, transactionCost);
+        Signal signals = evaluator->RunStrategy(strategyFunc, stock);
+        vector<ExecutionData> sed = Backtester::BacktestStoplossProfittake(*evaluator, signals, stock, profitTake, stopLoss, transactionCost);
 
         MLPutFunction(stdlink, "List", (int)sed.size());
         for (const ExecutionData& d : sed)
@@ -342,8 +592,8 @@ void get_strategy_execution_data_timestop_hit(char const* strategyFunc, char con
     string strategyFunctionString = strategyFunc;
     if (is_stock_in_dataset(stock) && (int)strategyFunctionString.length() > 0)
     {
-        vector<bool> signals = Evaluator::RunStrategy(strategyFunc, stock);
-        vector<ExecutionData> sed = Backtester::BacktestTimestopHit(signals, stock, timePeriod);
+        Signal signals = evaluator->RunStrategy(strategyFunc, stock);
+        vector<ExecutionData> sed = Backtester::BacktestTimestopHit(*evaluator, signals, stock, timePeriod);
 
         MLPutFunction(stdlink, "List", (int)sed.size());
         for (const ExecutionData& d : sed)
@@ -381,8 +631,8 @@ void get_strategy_execution_data_markettiming(char const* strategyFunc, char con
     string strategyFunctionString = strategyFunc;
     if (is_stock_in_dataset(stock) && (int)strategyFunctionString.length() > 0)
     {
-        vector<bool> signals = Evaluator::RunStrategy(strategyFunc, stock);
-        vector<ExecutionData> sed = Backtester::BacktestMarketTiming(signals, stock);
+        Signal signals = evaluator->RunStrategy(strategyFunc, stock);
+        vector<ExecutionData> sed = Backtester::BacktestMarketTiming(*evaluator, signals, stock);
 
         MLPutFunction(stdlink, "List", (int)sed.size());
         for (const ExecutionData& d : sed)
@@ -432,8 +682,8 @@ void get_returns_stoploss_profittake(char const* returnFunctionName, char const*
     string strategyFunctionString = strategyFunc;
     if (is_stock_in_dataset(stock) && (int)strategyFunctionString.length() > 0)
     {
-        vector<bool> signals = Evaluator::RunStrategy(strategyFunc, stock);
-        vector<ExecutionData> sed = Backtester::BacktestStoplossProfittake(signals, stock, profitTake, stopLoss, transactionCost, minibatchSize);
+        Signal signals = evaluator->RunStrategy(strategyFunc, stock);
+        vector<ExecutionData> sed = Backtester::BacktestStoplossProfittake(*evaluator, signals, stock, profitTake, stopLoss, transactionCost, minibatchSize);
         vector<double> returns = returnFunction(sed, transactionCost);
         MLPutRealList(stdlink, returns.data(), (int)returns.size());
         MLEndPacket(stdlink);
@@ -456,8 +706,8 @@ void get_returns_timestop_hit(char const* returnFunctionName, char const* strate
     string strategyFunctionString = strategyFunc;
     if (is_stock_in_dataset(stock) && (int)strategyFunctionString.length() > 0)
     {
-        vector<bool> signals = Evaluator::RunStrategy(strategyFunc, stock);
-        vector<ExecutionData> sed = Backtester::BacktestTimestopHit(signals, stock, timePeriod, minibatchSize);
+        Signal signals = evaluator->RunStrategy(strategyFunc, stock);
+        vector<ExecutionData> sed = Backtester::BacktestTimestopHit(*evaluator, signals, stock, timePeriod, minibatchSize);
         vector<double> returns = returnFunction(sed, transactionCost);
         MLPutRealList(stdlink, returns.data(), (int)returns.size());
         MLEndPacket(stdlink);
@@ -480,8 +730,8 @@ void get_returns_markettiming(char const* returnFunctionName, char const* strate
     string strategyFunctionString = strategyFunc;
     if (is_stock_in_dataset(stock) && (int)strategyFunctionString.length() > 0)
     {
-        vector<bool> signals = Evaluator::RunStrategy(strategyFunc, stock);
-        vector<ExecutionData> sed = Backtester::BacktestMarketTiming(signals, stock, minibatchSize);
+        Signal signals = evaluator->RunStrategy(strategyFunc, stock);
+        vector<ExecutionData> sed = Backtester::BacktestMarketTiming(*evaluator, signals, stock, minibatchSize);
         vector<double> returns = returnFunction(sed, transactionCost);
         MLPutRealList(stdlink, returns.data(), (int)returns.size());
         MLEndPacket(stdlink);
@@ -508,17 +758,17 @@ void get_returns_for_all_stocks_stoploss_profittake(char const* returnFunctionNa
     }
 
     string strategyFunctionString = strategyFunc;
-    if ((int)strategyFunctionString.length() > 0)
+    if (evaluator != nullptr && (int)strategyFunctionString.length() > 0)
     {
-        vector<string> stocks = Evaluator::GetStocksInDataset();
-        auto allStockSignals = Evaluator::RunStrategyAllStocks(strategyFunc);
+        vector<string> stocks = evaluator->GetStocksInDataset();
+        auto allStockSignals = evaluator->RunStrategyAllStocks(strategyFunc);
 
-        vector<vector<ExecutionData>> allBacktests;
-        for (auto const& [key, val] : allStockSignals)
-        {
-            allBacktests.push_back(Backtester::BacktestStoplossProfittake(val, key, profitTake,
-                                                                          stopLoss, transactionCost, minibatchSize));
-        }
+        // Backtest the stocks in the worker pool.
+        vector<vector<ExecutionData>> allBacktests(stocks.size());
+        WorkerPool::ParallelFor(stocks.size(), [&](size_t i) {
+            allBacktests[i] = Backtester::BacktestStoplossProfittake(*evaluator, allStockSignals.at(stocks[i]), stocks[i],
+                                                                     profitTake, stopLoss, transactionCost, minibatchSize);
+        });
 
 
         MLPutFunction(stdlink, "Association", (int)stocks.size());
@@ -550,14 +800,17 @@ void get_returns_for_all_stocks_timestop_hit(char const* returnFunctionName, cha
     }
 
     string strategyFunctionString = strategyFunc;
-    if ((int)strategyFunctionString.length() > 0)
+    if (evaluator != nullptr && (int)strategyFunctionString.length() > 0)
     {
-        vector<string> stocks = Evaluator::GetStocksInDataset();
-        auto allStockSignals = Evaluator::RunStrategyAllStocks(strategyFunc);
+        vector<string> stocks = evaluator->GetStocksInDataset();
+        auto allStockSignals = evaluator->RunStrategyAllStocks(strategyFunc);
 
-        vector<vector<ExecutionData>> allBacktests;
-        for (auto const& [key, val] : allStockSignals)
-            allBacktests.push_back(Backtester::BacktestTimestopHit(val, key, timePeriod, minibatchSize));
+        // Backtest the stocks in the worker pool.
+        vector<vector<ExecutionData>> allBacktests(stocks.size());
+        WorkerPool::ParallelFor(stocks.size(), [&](size_t i) {
+            allBacktests[i] = Backtester::BacktestTimestopHit(*evaluator, allStockSignals.at(stocks[i]), stocks[i], timePeriod,
+                                                              minibatchSize);
+        });
 
         MLPutFunction(stdlink, "Association", (int)stocks.size());
         for (unsigned i = 0; i < stocks.size(); i++)
@@ -587,14 +840,16 @@ void get_returns_for_all_stocks_markettiming(char const* returnFunctionName, cha
     }
 
     string strategyFunctionString = strategyFunc;
-    if ((int)strategyFunctionString.length() > 0)
+    if (evaluator != nullptr && (int)strategyFunctionString.length() > 0)
     {
-        vector<string> stocks = Evaluator::GetStocksInDataset();
-        auto allStockSignals = Evaluator::RunStrategyAllStocks(strategyFunc);
+        vector<string> stocks = evaluator->GetStocksInDataset();
+        auto allStockSignals = evaluator->RunStrategyAllStocks(strategyFunc);
 
-        vector<vector<ExecutionData>> allBacktests;
-        for (auto const &[key, val]: allStockSignals)
-            allBacktests.push_back(Backtester::BacktestMarketTiming(val, key, minibatchSize));
+        // Backtest the stocks in the worker pool.
+        vector<vector<ExecutionData>> allBacktests(stocks.size());
+        WorkerPool::ParallelFor(stocks.size(), [&](size_t i) {
+            allBacktests[i] = Backtester::BacktestMarketTiming(*evaluator, allStockSignals.at(stocks[i]), stocks[i], minibatchSize);
+        });
 
 
         MLPutFunction(stdlink, "Association", (int)stocks.size());
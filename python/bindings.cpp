@@ -5,6 +5,7 @@
 #include <pybind11/operators.h>
 #include "../include/loader.h"
 #include "../include/backtester.h"
+#include "../include/worker_pool.h"
 namespace py = pybind11;
 using namespace std;
 using namespace backtester;
@@ -43,15 +44,27 @@ PYBIND11_MODULE(TradingStrategyBacktester, m) {
     py::class_<StockData>(m, "StockData")
             .def(py::init<>())
 
-            .def(py::init<const std::vector<std::string>&, const Indicators&, const QuantileIndicators&>(),
-                 py::arg("dates"), py::arg("indicators"), py::arg("quantileIndicators"))
+            .def(py::init<const std::vector<std::string>&, const Indicators&, const QuantileIndicators&, const Indicators&>(),
+                 py::arg("dates"), py::arg("indicators"), py::arg("quantileIndicators"),
+                 py::arg("percentileRanks") = Indicators())
 
             .def(py::self == py::self)
             .def(py::self != py::self)
 
             .def_readwrite("dates", &StockData::dates)
-            .def_readwrite("indicators", &StockData::indicators)
-            .def_readwrite("quantileIndicators", &StockData::quantileIndicators)
+            .def_property("indicators", &StockData::IndicatorMap, &StockData::SetIndicators,
+                          "Indicator series keyed by name. Reading returns a new dict copied from the stored series, "
+                          "so editing it in place, as in stock.indicators[name][i] = value, does not change the "
+                          "stock. Assign the whole dict to store edited series.")
+            .def_property("quantileIndicators", &StockData::QuantileIndicatorMap, &StockData::SetQuantileIndicators,
+                          "Quantile series keyed by percentile and name. Like indicators, reading returns a copy, "
+                          "and edits are stored by assigning the whole dict.")
+            .def_property("percentileRanks", &StockData::PercentileRankMap, &StockData::SetPercentileRanks,
+                          "Percentile rank series keyed by indicator name. Like indicators, reading returns a copy, "
+                          "and edits are stored by assigning the whole dict.")
+            .def_property_readonly("derivedIndicators", &StockData::DerivedIndicatorMap,
+                                   "Derived indicator series keyed by name, as a copy.")
+            .def("TimePoints", &StockData::TimePoints, "Returns the number of time points of the indicator series.")
             ;
 
     py::class_<Loader>(m, "Loader")
@@ -77,73 +90,278 @@ PYBIND11_MODULE(TradingStrategyBacktester, m) {
             .def_static("LoadDataset",
                         &Loader::LoadDataset,
                         "Load a dataset of csv files located in the path.",
-                        py::arg("path"))
+                        py::arg("path"), py::call_guard<py::gil_scoped_release>())
 
             .def_static("ClearCache",
                         &Loader::ClearCache,
                         "Clear the temporary serialized data directory.",
                         py::arg("path"))
+
+            .def_static("RegisterDerivedIndicator",
+                        &Loader::RegisterDerivedIndicator,
+                        "Register a derived indicator evaluated when a stock is loaded.",
+                        py::arg("name"), py::arg("expression"))
+
+            .def_static("ClearDerivedIndicators",
+                        &Loader::ClearDerivedIndicators,
+                        "Remove all the registered derived indicators.")
+            ;
+
+    py::class_<WorkerPool>(m, "WorkerPool")
+            .def_static("SetThreadCount",
+                        &WorkerPool::SetThreadCount,
+                        "Set the number of worker threads. If 0, the number of hardware threads is used.",
+                        py::arg("threadCount"), py::call_guard<py::gil_scoped_release>())
+
+            .def_static("ThreadCount",
+                        &WorkerPool::ThreadCount,
+                        "Returns the number of worker threads.")
+            ;
+
+    py::class_<CorrelationMatrix>(m, "CorrelationMatrix")
+            .def(py::init<>())
+            .def(py::init<const Dataset&, unsigned, size_t>(), py::arg("dataset"), py::arg("window"),
+                 py::arg("cachedPairs") = CorrelationMatrix::defaultCachedPairs)
+            .def("Window", &CorrelationMatrix::Window, "Returns the number of calendar dates of the rolling window.")
+            .def("Stocks", &CorrelationMatrix::Stocks, "Returns the stocks of the matrix.")
+            .def("Calendar", &CorrelationMatrix::Calendar, "Returns the common calendar of the stocks.")
+            .def("Correlation", &CorrelationMatrix::Correlation, "Rolling correlation of the returns of two stocks.",
+                 py::arg("stockA"), py::arg("stockB"), py::arg("time"))
+            .def("Beta", &CorrelationMatrix::Beta, "Rolling beta of the returns of a stock on a benchmark.",
+                 py::arg("stock"), py::arg("benchmark"), py::arg("time"))
+            .def("CorrelationTimeSeries", &CorrelationMatrix::CorrelationTimeSeries,
+                 "Time series of the rolling correlation of two stocks.", py::arg("stockA"), py::arg("stockB"))
+            .def("BetaTimeSeries", &CorrelationMatrix::BetaTimeSeries,
+                 "Time series of the rolling beta of a stock on a benchmark.", py::arg("stock"), py::arg("benchmark"))
             ;
 
-    py::class_<Evaluator>(m, "Evaluator")
+    py::class_<Signal>(m, "Signal", py::buffer_protocol())
+            .def(py::init<>())
+            .def(py::init<const std::vector<bool>&>(), "Pack a list of signals.", py::arg("values"))
+
+            // The packed words exposed as read-only bytes without a copy. On little endian machines
+            // numpy.unpackbits(numpy.asarray(signal), bitorder="little", count=len(signal)) unpacks them.
+            .def_buffer([](const Signal& signal) {
+                return py::buffer_info(const_cast<Signal::Word*>(signal.Words().data()), sizeof(uint8_t),
+                                       py::format_descriptor<uint8_t>::format(), 1,
+                                       { signal.Words().size() * sizeof(Signal::Word) }, { sizeof(uint8_t) }, true);
+            })
+
+            .def("__len__", &Signal::size)
+            .def("__getitem__", &Signal::at)
+            .def(py::self == py::self)
+            .def(py::self != py::self)
 
-            .def_static("SetStrategyEvaluatorDataset",
-                        &Evaluator::SetStrategyEvaluatorDataset,
-                        "Configure the dataset to be used by the strategy runner.",
-                        py::arg("dataset"))
+            .def("Count", &Signal::Count, "Returns the number of bars where the signal is true.")
+            .def("FindNext", &Signal::FindNext,
+                 "Find the first bar, starting from a given one, where the signal is true.",
+                 py::arg("start"))
+            .def("Words", &Signal::Words, "Returns the packed words, 64 bars per word.")
+            .def("ToList", &Signal::ToVector, "Returns the signal of every bar as a list.")
+            ;
 
-            .def_static("GetStrategyEvaluatorDataset",
-                        &Evaluator::GetStrategyEvaluatorDataset,
-                        "Returns the pointer to the dataset used in the strategy runner.")
+    py::implicitly_convertible<std::vector<bool>, Signal>();
 
-            .def_static("GetStocksInDataset",
-                        &Evaluator::GetStocksInDataset,
-                        "Returns the list of stocks present in the strategy evaluator dataset.")
+    py::class_<LineProfile>(m, "LineProfile")
+            .def_readonly("line", &LineProfile::line)
+            .def_readonly("source", &LineProfile::source)
+            .def_readonly("hits", &LineProfile::hits)
+            .def_readonly("seconds", &LineProfile::seconds)
+            ;
+
+    py::class_<AccessorProfile>(m, "AccessorProfile")
+            .def_readonly("name", &AccessorProfile::name)
+            .def_readonly("calls", &AccessorProfile::calls)
+            .def_readonly("seconds", &AccessorProfile::seconds)
+            ;
+
+    py::class_<StrategyProfile>(m, "StrategyProfile")
+            .def_readonly("stock", &StrategyProfile::stock)
+            .def_readonly("bars", &StrategyProfile::bars)
+            .def_readonly("seconds", &StrategyProfile::seconds)
+            .def_readonly("lines", &StrategyProfile::lines)
+            .def_readonly("accessors", &StrategyProfile::accessors)
+            .def("__repr__", &StrategyProfile::ToString)
+            ;
+
+    py::class_<Evaluator, std::shared_ptr<Evaluator>>(m, "Evaluator")
+
+            .def(py::init<Dataset>(),
+                 "Create an evaluator over a copy of a dataset.",
+                 py::arg("dataset"))
+
+            .def("ComputeCorrelations",
+                 &Evaluator::ComputeCorrelations,
+                 "Prepare the rolling correlations and betas between the stocks. Pairs are computed when queried.",
+                 py::arg("window"))
+
+            .def("GetDataset",
+                 &Evaluator::GetDataset,
+                 "Returns the dataset of the evaluator.")
+
+            .def("HasStock",
+                 &Evaluator::HasStock,
+                 "Returns true if the stock is in the dataset.",
+                 py::arg("stock"))
+
+            .def("GetStocksInDataset",
+                 &Evaluator::GetStocksInDataset,
+                 "Returns the list of stocks present in the dataset.")
 
             .def_static("ValidateStrategyProgram",
                         &Evaluator::ValidateStrategyProgram,
                         "Try to compile the strategy program and report compilation errors if any.",
-                        py::arg("strategyProgram"))
-
-            .def_static("RunStrategy",
-                        &Evaluator::RunStrategy,
-                        "Runs the strategy program in each date available of the stock.",
-                        py::arg("strategyProgram"), py::arg("stock"))
+                        py::arg("strategyProgram"), py::arg("cacheDirectory") = "")
 
-            .def_static("RunStrategyAllStocks",
-                        &Evaluator::RunStrategyAllStocks,
-                        "Runs the strategy program for all loaded stocks.",
+            .def_static("IsNativeStrategy",
+                        &Evaluator::IsNativeStrategy,
+                        "Check if a strategy program is evaluated natively instead of by the scripting engine.",
                         py::arg("strategyProgram"))
 
-            .def_static("Date",
-                        &Evaluator::Date,
-                        "Date accessor.",
-                        py::arg("stock"), py::arg("time"))
-
-            .def_static("Dates",
-                        &Evaluator::Dates,
-                        "Dates accessor.",
-                        py::arg("stock"))
-
-            .def_static("Indicator",
-                        &Evaluator::Indicator,
-                        "Indicator accessor.",
-                        py::arg("indicatorName"), py::arg("stock"), py::arg("time"))
-
-            .def_static("IndQuantile",
-                        &Evaluator::IndQuantile,
-                        "IndQuantile accessor.",
-                        py::arg("indicatorName"), py::arg("percentile"), py::arg("stock"), py::arg("time"))
-
-            .def_static("IndicatorTimeSeries",
-                        &Evaluator::IndicatorTimeSeries,
-                        "IndicatorTimeSeries accessor.",
-                        py::arg("indicatorName"), py::arg("stock"))
-
-            .def_static("IndQuantileTimeSeries",
-                        &Evaluator::IndQuantileTimeSeries,
-                        "IndQuantileTimeSeries accessor.",
-                        py::arg("indicatorName"), py::arg("percentile"), py::arg("stock"))
+            .def("EnableNativeCompilation",
+                 &Evaluator::EnableNativeCompilation,
+                 "Compile the native strategies to shared objects cached in a directory.",
+                 py::arg("cacheDirectory"))
+
+            .def("DisableNativeCompilation",
+                 &Evaluator::DisableNativeCompilation,
+                 "Stop compiling strategies to shared objects.")
+
+            .def("EnableBytecodeCache",
+                 &Evaluator::EnableBytecodeCache,
+                 "Cache the bytecode of the strategies compiled by the scripting engine in a directory.",
+                 py::arg("cacheDirectory"))
+
+            .def("DisableBytecodeCache",
+                 &Evaluator::DisableBytecodeCache,
+                 "Stop caching the bytecode of strategies.")
+
+            .def("EnableSignalCache",
+                 &Evaluator::EnableSignalCache,
+                 "Cache the signals of the scripted strategies and only evaluate the bars appended since.",
+                 py::arg("cacheDirectory"))
+
+            .def("DisableSignalCache",
+                 &Evaluator::DisableSignalCache,
+                 "Stop caching the signals of strategies.")
+
+            .def("RunStrategy",
+                 &Evaluator::RunStrategy,
+                 py::call_guard<py::gil_scoped_release>(),
+                 "Runs the strategy program in each date available of the stock.",
+                 py::arg("strategyProgram"), py::arg("stock"))
+
+            .def("RunStrategyAllStocks",
+                 &Evaluator::RunStrategyAllStocks,
+                 py::call_guard<py::gil_scoped_release>(),
+                 "Runs the strategy program for all loaded stocks.",
+                 py::arg("strategyProgram"))
+
+            .def("RunStrategiesAllStocks",
+                 &Evaluator::RunStrategiesAllStocks,
+                 py::call_guard<py::gil_scoped_release>(),
+                 "Runs a batch of strategy programs for all loaded stocks.",
+                 py::arg("strategyPrograms"))
+
+            .def("ProfileStrategy",
+                 &Evaluator::ProfileStrategy,
+                 py::call_guard<py::gil_scoped_release>(),
+                 "Runs the strategy program in the scripting engine and measures the time of its lines and accessors.",
+                 py::arg("strategyProgram"), py::arg("stock"))
+
+            .def("RunScore",
+                 &Evaluator::RunScore,
+                 py::call_guard<py::gil_scoped_release>(),
+                 "Runs a score program, an expression of type double, in each date available of the stock.",
+                 py::arg("scoreProgram"), py::arg("stock"))
+
+            .def("RunScoreAllStocks",
+                 &Evaluator::RunScoreAllStocks,
+                 py::call_guard<py::gil_scoped_release>(),
+                 "Runs a score program for all loaded stocks.",
+                 py::arg("scoreProgram"))
+
+            .def("SelectTopK",
+                 &Evaluator::SelectTopK,
+                 py::call_guard<py::gil_scoped_release>(),
+                 "Select on each date the k stocks with the highest score.",
+                 py::arg("scores"), py::arg("k"))
+
+            .def("SelectBottomK",
+                 &Evaluator::SelectBottomK,
+                 py::call_guard<py::gil_scoped_release>(),
+                 "Select on each date the k stocks with the lowest score.",
+                 py::arg("scores"), py::arg("k"))
+
+            .def("Date",
+                 &Evaluator::Date,
+                 "Date accessor.",
+                 py::arg("stock"), py::arg("time"))
+
+            .def("Dates",
+                 &Evaluator::Dates,
+                 "Dates accessor.",
+                 py::arg("stock"))
+
+            .def("Indicator",
+                 py::overload_cast<const std::string&, const std::string&, int>(&Evaluator::Indicator, py::const_),
+                 "Indicator accessor.",
+                 py::arg("indicatorName"), py::arg("stock"), py::arg("time"))
+
+            .def("IndQuantile",
+                 py::overload_cast<const std::string&, const std::string&, const std::string&, int>(&Evaluator::IndQuantile, py::const_),
+                 "IndQuantile accessor.",
+                 py::arg("indicatorName"), py::arg("percentile"), py::arg("stock"), py::arg("time"))
+
+            .def("IndQuantileWindow",
+                 py::overload_cast<const std::string&, double, int, const std::string&, int>(&Evaluator::IndQuantileWindow, py::const_),
+                 "Quantile of an indicator over any window preceding the time index.",
+                 py::arg("indicatorName"), py::arg("percentile"), py::arg("window"), py::arg("stock"), py::arg("time"))
+
+            .def("RollingMean",
+                 &Evaluator::RollingMean,
+                 "Mean of an indicator over any window preceding the time index.",
+                 py::arg("indicatorName"), py::arg("window"), py::arg("stock"), py::arg("time"))
+
+            .def("RollingStd",
+                 &Evaluator::RollingStd,
+                 "Standard deviation of an indicator over any window preceding the time index.",
+                 py::arg("indicatorName"), py::arg("window"), py::arg("stock"), py::arg("time"))
+
+            .def("RollingVWAP",
+                 &Evaluator::RollingVWAP,
+                 "VWAP over any window preceding the time index.",
+                 py::arg("window"), py::arg("stock"), py::arg("time"))
+
+            .def("RollingCorrelation",
+                 &Evaluator::RollingCorrelation,
+                 "Rolling correlation of the returns of two stocks.",
+                 py::arg("stockA"), py::arg("stockB"), py::arg("time"))
+
+            .def("RollingBeta",
+                 &Evaluator::RollingBeta,
+                 "Rolling beta of the returns of a stock with respect to a benchmark stock.",
+                 py::arg("stock"), py::arg("benchmark"), py::arg("time"))
+
+            .def("IndPercentileRank",
+                 py::overload_cast<const std::string&, const std::string&, int>(&Evaluator::IndPercentileRank, py::const_),
+                 "IndPercentileRank accessor.",
+                 py::arg("indicatorName"), py::arg("stock"), py::arg("time"))
+
+            .def("IndicatorTimeSeries",
+                 &Evaluator::IndicatorTimeSeries,
+                 "IndicatorTimeSeries accessor.",
+                 py::arg("indicatorName"), py::arg("stock"))
+
+            .def("IndQuantileTimeSeries",
+                 &Evaluator::IndQuantileTimeSeries,
+                 "IndQuantileTimeSeries accessor.",
+                 py::arg("indicatorName"), py::arg("percentile"), py::arg("stock"))
+
+            .def("IndPercentileRankTimeSeries",
+                 &Evaluator::IndPercentileRankTimeSeries,
+                 "IndPercentileRankTimeSeries accessor.",
+                 py::arg("indicatorName"), py::arg("stock"))
             ;
 
     py::enum_<StrategySignal>(m, "StrategySignal")
@@ -189,19 +407,20 @@ PYBIND11_MODULE(TradingStrategyBacktester, m) {
             .def_static("BacktestStoplossProfittake",
                         &Backtester::BacktestStoplossProfittake,
                         "Backtester where the exit strategy is set in terms of profit taking and stop loss parameters.",
-                        py::arg("strategySignals"), py::arg("stock"), py::arg("profitTake"),
+                        py::arg("evaluator"), py::arg("strategySignals"), py::arg("stock"), py::arg("profitTake"),
                         py::arg("stopLoss"), py::arg("transactionCost"), py::arg("minibatchSize") = -1)
 
             .def_static("BacktestTimestopHit",
                         &Backtester::BacktestTimestopHit,
                         "Backtester where the exit strategy is set in terms of a time period to hold onto the asset.",
-                        py::arg("strategySignals"), py::arg("stock"), py::arg("timePeriod"),
+                        py::arg("evaluator"), py::arg("strategySignals"), py::arg("stock"), py::arg("timePeriod"),
                         py::arg("minibatchSize") = -1)
 
             .def_static("BacktestMarketTiming",
                         &Backtester::BacktestMarketTiming,
                         "Backtester where the exit strategy is given by the strategy signals.",
-                        py::arg("strategySignals"), py::arg("stock"), py::arg("minibatchSize") = -1)
+                        py::arg("evaluator"), py::arg("strategySignals"), py::arg("stock"),
+                        py::arg("minibatchSize") = -1)
             ;
 }
 #pragma clang diagnostic pop
\ No newline at end of file
@@ -8,10 +8,10 @@ class TestBacktester(unittest.TestCase):
     def test_strategy_results(self):
         path = os.path.join(os.getcwd(), "..", "..", "dataset")
         dataset: dict[str, StockData] = Loader.LoadDataset(path)
-        Evaluator.SetStrategyEvaluatorDataset(dataset)
+        evaluator = Evaluator(dataset)
 
         strategy_program: str = 'Indicator("EMA", stock, time) < Indicator("ClosePrice", stock, time)'
-        strategy_results: list[bool] = Evaluator.RunStrategy(strategy_program, "AAPL")
+        strategy_results: Signal = evaluator.RunStrategy(strategy_program, "AAPL")
 
         self.assertEqual(strategy_results[13], False)
         self.assertEqual(strategy_results[14], True)
@@ -19,14 +19,14 @@ class TestBacktester(unittest.TestCase):
     def test_backtester(self):
         path = os.path.join(os.getcwd(), "..", "..", "dataset")
         dataset: dict[str, StockData] = Loader.LoadDataset(path)
-        Evaluator.SetStrategyEvaluatorDataset(dataset)
+        evaluator = Evaluator(dataset)
 
         strategy_program: str = 'Indicator("EMA", stock, time) < Indicator("ClosePrice", stock, time)'
         self.assertTrue(Evaluator.ValidateStrategyProgram(strategy_program))
 
-        strategy_results: list[bool] = Evaluator.RunStrategy(strategy_program, "AAPL")
+        strategy_results: Signal = evaluator.RunStrategy(strategy_program, "AAPL")
 
-        execution_data: list[ExecutionData] = Backtester.BacktestStoplossProfittake(strategy_results, "AAPL",
+        execution_data: list[ExecutionData] = Backtester.BacktestStoplossProfittake(evaluator, strategy_results, "AAPL",
                                                                                     0.05, 0.05, 0.05, -1)
         returns: list[float] = Returns.SimpleReturns(execution_data, 0.05)
 
@@ -35,14 +35,14 @@ class TestBacktester(unittest.TestCase):
     def test_backtester_ind_quantile(self):
         path = os.path.join(os.getcwd(), "..", "..", "dataset")
         dataset: dict[str, StockData] = Loader.LoadDataset(path)
-        Evaluator.SetStrategyEvaluatorDataset(dataset)
+        evaluator = Evaluator(dataset)
 
         strategy_program: str = 'Indicator("EMA", stock, time) < IndQuantile("ClosePrice", "0.75",  stock, time)'
         self.assertTrue(Evaluator.ValidateStrategyProgram(strategy_program))
 
-        strategy_results: list[bool] = Evaluator.RunStrategy(strategy_program, "AAPL")
+        strategy_results: Signal = evaluator.RunStrategy(strategy_program, "AAPL")
 
-        execution_data: list[ExecutionData] = Backtester.BacktestStoplossProfittake(strategy_results, "AAPL",
+        execution_data: list[ExecutionData] = Backtester.BacktestStoplossProfittake(evaluator, strategy_results, "AAPL",
                                                                                     0.05, 0.05, 0.05, -1)
         returns: list[float] = Returns.SimpleReturns(execution_data, 0.05)
 
@@ -51,14 +51,15 @@ class TestBacktester(unittest.TestCase):
     def test_parallel_backtester(self):
         path = os.path.join(os.getcwd(), "..", "..", "dataset")
         dataset: dict[str, StockData] = Loader.LoadDataset(path)
-        Evaluator.SetStrategyEvaluatorDataset(dataset)
+        evaluator = Evaluator(dataset)
 
         strategy_program: str = 'Indicator("EMA", stock, time) < Indicator("ClosePrice", stock, time)'
-        strategy_results: dict[str, list[bool]] = Evaluator.RunStrategyAllStocks(strategy_program)
+        strategy_results: dict[str, Signal] = evaluator.RunStrategyAllStocks(strategy_program)
 
         returns = []
         for stock in strategy_results:
-            execution_data: list[ExecutionData] = Backtester.BacktestStoplossProfittake(strategy_results.get(stock),
+            execution_data: list[ExecutionData] = Backtester.BacktestStoplossProfittake(evaluator,
+                                                                                        strategy_results.get(stock),
                                                                                         stock, 0.05, 0.05, 0.05, -1)
             ret = sum(Returns.SimpleReturns(execution_data, 0.05))
             print("Stock: " + stock + ", Return: " + str(ret))
@@ -66,6 +67,57 @@ class TestBacktester(unittest.TestCase):
 
         self.assertGreater(abs(sum(returns)), 0)
 
+    def test_packed_signal(self):
+        path = os.path.join(os.getcwd(), "..", "..", "dataset")
+        dataset: dict[str, StockData] = Loader.LoadDataset(path)
+        evaluator = Evaluator(dataset)
+
+        strategy_program: str = 'Indicator("EMA", stock, time) < Indicator("ClosePrice", stock, time)'
+        signal: Signal = evaluator.RunStrategy(strategy_program, "AAPL")
+        values: list[bool] = signal.ToList()
+        self.assertEqual(len(signal), len(values))
+        self.assertEqual(list(signal), values)
+        self.assertEqual(signal.Count(), sum(values))
+
+        # The buffer holds the bars packed in little endian bit order.
+        packed = memoryview(signal)
+        self.assertTrue(packed.readonly)
+        unpacked = [bool((packed[t // 8] >> (t % 8)) & 1) for t in range(len(signal))]
+        self.assertEqual(unpacked, values)
+
+        # Lists of booleans are accepted wherever a signal is expected.
+        from_signal = Backtester.BacktestTimestopHit(evaluator, signal, "AAPL", 5, -1)
+        from_list = Backtester.BacktestTimestopHit(evaluator, values, "AAPL", 5, -1)
+        self.assertEqual([e.timeIndex for e in from_signal], [e.timeIndex for e in from_list])
+        self.assertEqual(Signal(values), signal)
+
+    def test_score_selection(self):
+        path = os.path.join(os.getcwd(), "..", "..", "dataset")
+        dataset: dict[str, StockData] = Loader.LoadDataset(path)
+        evaluator = Evaluator(dataset)
+
+        score_program: str = 'Indicator("RSI", stock, time)'
+        scores: dict[str, list[float]] = evaluator.RunScoreAllStocks(score_program)
+        self.assertEqual(scores["AAPL"], evaluator.RunScore(score_program, "AAPL"))
+
+        top: dict[str, Signal] = evaluator.SelectTopK(scores, 1)
+        bottom: dict[str, Signal] = evaluator.SelectBottomK(scores, 1)
+        for t in range(len(scores["AAPL"])):
+            self.assertEqual(top["AAPL"][t], scores["AAPL"][t] >= scores["ZION"][t])
+            self.assertEqual(bottom["AAPL"][t], scores["AAPL"][t] <= scores["ZION"][t])
+
+    def test_strategy_profile(self):
+        path = os.path.join(os.getcwd(), "..", "..", "dataset")
+        dataset: dict[str, StockData] = Loader.LoadDataset(path)
+        evaluator = Evaluator(dataset)
+
+        profile: StrategyProfile = evaluator.ProfileStrategy('Indicator("Close" + "Price", stock, time) > 0', "AAPL")
+        self.assertEqual(profile.bars, len(evaluator.Dates("AAPL")))
+        self.assertEqual(profile.lines[0].hits, profile.bars)
+        self.assertEqual({a.name: a.calls for a in profile.accessors}["Indicator"], profile.bars)
+        self.assertIn("Indicator", repr(profile))
+
+
 
 
 if __name__ == '__main__':
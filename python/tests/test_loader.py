@@ -18,6 +18,19 @@ class TestLoader(unittest.TestCase):
         self.assertEqual(stock_data.indicators["TradingVolume"][0], 789905200.0)
         self.assertEqual(stock_data.dates[0], "\"2008-05-27\"")
 
+    def test_indicator_assignment(self):
+        path = os.path.join(os.getcwd(), "..", "..", "dataset", "AAPL.csv")
+        stock_data: StockData = Loader.LoadStockdata(path)
+
+        # The indicators are returned as a copy, so only assigning the whole dict stores the edits.
+        stock_data.indicators["TradingVolume"][0] = 1.0
+        self.assertEqual(stock_data.indicators["TradingVolume"][0], 789905200.0)
+
+        indicators = stock_data.indicators
+        indicators["TradingVolume"][0] = 1.0
+        stock_data.indicators = indicators
+        self.assertEqual(stock_data.indicators["TradingVolume"][0], 1.0)
+
     def test_dataset_loading(self):
         path = os.path.join(os.getcwd(), "..", "..", "dataset")
         dataset: dict[str, StockData] = Loader.LoadDataset(path)
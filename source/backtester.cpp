@@ -7,27 +7,23 @@ using namespace backtester;
 //*     backtest_stop-loss_profit-take     *
 //*****************************************/
 
-size_t Backtester::findEntryPoint(const vector<bool>& strategySignals, unsigned cursor)
+size_t Backtester::findEntryPoint(const Signal& strategySignals, unsigned cursor)
 {
-    // Lookup for the first true value.
-    for (size_t i = cursor; i < strategySignals.size(); i++)
-    {
-        if (strategySignals[i])
-            return i;
-    }
+    // Lookup for the first true value, skipping whole words of false values.
+    const size_t entry = strategySignals.FindNext(cursor);
 
     // If there aren't any matches, return the last position.
-    return strategySignals.size() - 1;
+    return entry < strategySignals.size() ? entry : strategySignals.size() - 1;
 }
 
-size_t Backtester::exitPosition(const string& stock, unsigned entryTime, double profitTake, double stopLoss,
-                                double transactionCost)
+size_t Backtester::exitPosition(const Evaluator& evaluator, const string& stock, unsigned entryTime,
+                                double profitTake, double stopLoss, double transactionCost)
 {
-    vector<double>& closePrices = Evaluator::IndicatorTimeSeries("ClosePrice", stock);
+    const SeriesView closePrices = evaluator.Series(IndicatorId::ClosePrice, stock);
 
     // Lookup for the first time after the entry that satisfies the exit condition.
     const double buyPrice = (1.0 + transactionCost) * closePrices[entryTime];
-    for (unsigned i = entryTime + 1; i < closePrices.size(); i++)
+    for (unsigned i = entryTime + 1; i < closePrices.size; i++)
     {
         const double sellPrice = closePrices[i] * (1.0 - transactionCost);
         const double _return = (sellPrice / buyPrice) - 1.0;
@@ -36,10 +32,11 @@ size_t Backtester::exitPosition(const string& stock, unsigned entryTime, double
     }
 
     // If there aren't any matches, return the last position.
-    return closePrices.size() - 1;
+    return closePrices.size - 1;
 }
 
-vector<ExecutionData> Backtester::BacktestStoplossProfittake(const vector<bool>& strategySignals, const string& stock,
+vector<ExecutionData> Backtester::BacktestStoplossProfittake(const Evaluator& evaluator,
+                                                             const Signal& strategySignals, const string& stock,
                                                              double profitTake, double stopLoss, double transactionCost,
                                                              int minibatchSize)
 {
@@ -72,17 +69,17 @@ vector<ExecutionData> Backtester::BacktestStoplossProfittake(const vector<bool>&
         ExecutionData buy, sell;
 
         cursor = findEntryPoint(strategySignals, cursor);
-        exitIndex = exitPosition(stock, cursor, profitTake, stopLoss, transactionCost);
+        exitIndex = exitPosition(evaluator, stock, cursor, profitTake, stopLoss, transactionCost);
 
         buy.signalType = StrategySignal::Buy;
         buy.timeIndex = cursor;
-        buy.time = Evaluator::Date(stock, (int) cursor);
-        buy.price = Evaluator::Indicator("ClosePrice", stock, (int) cursor);
+        buy.time = evaluator.Date(stock, (int) cursor);
+        buy.price = evaluator.Indicator(IndicatorId::ClosePrice, stock, (int) cursor);
 
         sell.signalType = StrategySignal::Sell;
         sell.timeIndex = exitIndex;
-        sell.time = Evaluator::Date(stock, (int) exitIndex);
-        sell.price = Evaluator::Indicator("ClosePrice", stock, (int) exitIndex);
+        sell.time = evaluator.Date(stock, (int) exitIndex);
+        sell.price = evaluator.Indicator(IndicatorId::ClosePrice, stock, (int) exitIndex);
 
         output.push_back(buy);
         output.push_back(sell);
@@ -97,8 +94,8 @@ vector<ExecutionData> Backtester::BacktestStoplossProfittake(const vector<bool>&
 //*     BacktestTimestopHit     *
 //********************************/
 
-vector<ExecutionData> Backtester::BacktestTimestopHit(const vector<bool>& strategySignals, const string& stock,
-                                                      int timePeriod, int minibatchSize)
+vector<ExecutionData> Backtester::BacktestTimestopHit(const Evaluator& evaluator, const Signal& strategySignals,
+                                                      const string& stock, int timePeriod, int minibatchSize)
 {
     size_t start, end;
     size_t cursor, exitPosition;
@@ -139,13 +136,13 @@ vector<ExecutionData> Backtester::BacktestTimestopHit(const vector<bool>& strate
 
             buy.signalType = StrategySignal::Buy;
             buy.timeIndex = cursor;
-            buy.time = Evaluator::Date(stock, (int) cursor);
-            buy.price = Evaluator::Indicator("ClosePrice", stock, (int) cursor);
+            buy.time = evaluator.Date(stock, (int) cursor);
+            buy.price = evaluator.Indicator(IndicatorId::ClosePrice, stock, (int) cursor);
 
             sell.signalType = StrategySignal::Sell;
             sell.timeIndex = exitPosition;
-            sell.time = Evaluator::Date(stock, (int) exitPosition);
-            sell.price = Evaluator::Indicator("ClosePrice", stock, (int) exitPosition);
+            sell.time = evaluator.Date(stock, (int) exitPosition);
+            sell.price = evaluator.Indicator(IndicatorId::ClosePrice, stock, (int) exitPosition);
 
             output.push_back(buy);
             output.push_back(sell);
@@ -153,7 +150,7 @@ vector<ExecutionData> Backtester::BacktestTimestopHit(const vector<bool>& strate
             cursor += timePeriod;
         }
         else
-            cursor++;
+            cursor = strategySignals.FindNext(cursor + 1);
     }
 
     return output;
@@ -210,14 +207,14 @@ struct StateMachine
         return TimingStrategySignal();
     }
 
-    static vector<TimingStrategySignal> Execute(StateMachine& fsm, const vector<bool>& inputValues)
+    static vector<TimingStrategySignal> Execute(StateMachine& fsm, const Signal& inputValues)
     {
         TimingStrategySignal state = fsm.startState;
         vector<TimingStrategySignal> fsmStates;
 
-        for (bool value : inputValues)
+        for (size_t t = 0; t < inputValues.size(); t++)
         {
-            state = Iterate(fsm, state, value);
+            state = Iterate(fsm, state, inputValues[t]);
             fsmStates.push_back(state);
         }
 
@@ -226,18 +223,19 @@ struct StateMachine
 
 };
 
-vector<TimingStrategySignal> Backtester::getTimingStrategySignals(vector<bool> strategyValues)
+vector<TimingStrategySignal> Backtester::getTimingStrategySignals(Signal strategyValues)
 {
     // Set the last value as false to ensure it always exits its position.
-    strategyValues.pop_back();
-    strategyValues.push_back(false);
+    if (!strategyValues.empty())
+        strategyValues.Set(strategyValues.size() - 1, false);
 
     // Transform strategyValues into TimingStrategySignal using a finite state machine.
     StateMachine strategySignalsFSM = StateMachine::Initialize();
     return StateMachine::Execute(strategySignalsFSM, strategyValues);
 }
 
-vector<ExecutionData> Backtester::BacktestMarketTiming(const vector<bool>& strategySignals, const string& stock,
+vector<ExecutionData> Backtester::BacktestMarketTiming(const Evaluator& evaluator,
+                                                       const Signal& strategySignals, const string& stock,
                                                        int minibatchSize)
 {
     vector<TimingStrategySignal> signals = getTimingStrategySignals(strategySignals);
@@ -270,8 +268,8 @@ vector<ExecutionData> Backtester::BacktestMarketTiming(const vector<bool>& strat
             ExecutionData operation;
             operation.signalType = StrategySignal::Buy;
             operation.timeIndex = i;
-            operation.time = Evaluator::Date(stock, (int) i);
-            operation.price = Evaluator::Indicator("ClosePrice", stock, (int) i);
+            operation.time = evaluator.Date(stock, (int) i);
+            operation.price = evaluator.Indicator(IndicatorId::ClosePrice, stock, (int) i);
             strategyExecutionData.push_back(operation);
             expectingEnter = false;
         }
@@ -280,8 +278,8 @@ vector<ExecutionData> Backtester::BacktestMarketTiming(const vector<bool>& strat
             ExecutionData operation;
             operation.signalType = StrategySignal::Sell;
             operation.timeIndex = i;
-            operation.time = Evaluator::Date(stock, (int) i);
-            operation.price = Evaluator::Indicator("ClosePrice", stock, (int) i);
+            operation.time = evaluator.Date(stock, (int) i);
+            operation.price = evaluator.Indicator(IndicatorId::ClosePrice, stock, (int) i);
             strategyExecutionData.push_back(operation);
             expectingEnter = true;
         }
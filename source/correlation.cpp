@@ -0,0 +1,196 @@
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <stdexcept>
+#include "correlation.h"
+using namespace std;
+using namespace backtester;
+
+constexpr double nan_value = numeric_limits<double>::quiet_NaN();
+
+/****************************
+*       Construction        *
+****************************/
+
+/// Rolling covariance and variances of two return series over the last window positions. Positions where either
+/// return is NaN are skipped.
+void rolling_pair_moments(const vector<SeriesValue>& x, const vector<SeriesValue>& y, unsigned window,
+                          vector<SeriesValue>& output)
+{
+    const size_t length = x.size();
+    output.assign(3 * length, SeriesValue(nan_value));
+
+    double sx = 0.0, sy = 0.0, sxx = 0.0, syy = 0.0, sxy = 0.0;
+    size_t count = 0;
+    for (size_t c = 0; c < length; c++)
+    {
+        if (!std::isnan(x[c]) && !std::isnan(y[c]))
+        {
+            const double ex = x[c], ey = y[c];
+            sx += ex;
+            sy += ey;
+            sxx += ex * ex;
+            syy += ey * ey;
+            sxy += ex * ey;
+            count++;
+        }
+
+        if (c >= window && !std::isnan(x[c - window]) && !std::isnan(y[c - window]))
+        {
+            const double ex = x[c - window], ey = y[c - window];
+            sx -= ex;
+            sy -= ey;
+            sxx -= ex * ex;
+            syy -= ey * ey;
+            sxy -= ex * ey;
+            count--;
+        }
+
+        if (count < 2)
+            continue;
+
+        const double n = double(count);
+        output[3 * c] = SeriesValue((sxy - sx * sy / n) / (n - 1.0));
+        output[3 * c + 1] = SeriesValue(std::max(0.0, (sxx - sx * sx / n) / (n - 1.0)));
+        output[3 * c + 2] = SeriesValue(std::max(0.0, (syy - sy * sy / n) / (n - 1.0)));
+    }
+}
+
+CorrelationMatrix::CorrelationMatrix(const Dataset& dataset, unsigned window, size_t cachedPairs)
+    : window(window), cachedPairs(max(cachedPairs, size_t(1)))
+{
+    // Common calendar: the sorted union of the dates of all the stocks.
+    for (const auto& [stock, stockData] : dataset)
+        calendar.insert(calendar.end(), stockData.dates.begin(), stockData.dates.end());
+    sort(calendar.begin(), calendar.end());
+    calendar.erase(unique(calendar.begin(), calendar.end()), calendar.end());
+
+    // Close returns of every stock placed on the calendar.
+    for (const auto& [stock, stockData] : dataset)
+    {
+        stockIndexes[stock] = stocks.size();
+        stocks.push_back(stock);
+
+        vector<size_t> indexes(stockData.dates.size());
+        vector<SeriesValue> stockReturns(calendar.size(), SeriesValue(nan_value));
+        const SeriesView close = stockData.Series(IndicatorId::ClosePrice);
+        for (size_t t = 0; t < indexes.size(); t++)
+        {
+            indexes[t] = size_t(lower_bound(calendar.begin(), calendar.end(), stockData.dates[t]) - calendar.begin());
+            if (t > 0 && t < close.size)
+                stockReturns[indexes[t]] = SeriesValue(close[t] / close[t - 1] - 1.0);
+        }
+
+        calendarIndexes.push_back(std::move(indexes));
+        returns.push_back(std::move(stockReturns));
+    }
+}
+
+/****************************
+*          Queries          *
+****************************/
+
+size_t CorrelationMatrix::stockIndex(const string& stock) const
+{
+    const auto it = stockIndexes.find(stock);
+    if (it == stockIndexes.end())
+        throw out_of_range("Stock " + stock + " is not in the correlation matrix.");
+
+    return it->second;
+}
+
+size_t CorrelationMatrix::pairIndex(size_t i, size_t j) const
+{
+    // Row-major index of the pair in the strictly upper triangle.
+    return i * stocks.size() - i * (i + 1) / 2 + (j - i - 1);
+}
+
+shared_ptr<const CorrelationMatrix::PairMoments> CorrelationMatrix::pairMoments(size_t i, size_t j) const
+{
+    const size_t pair = pairIndex(i, j);
+    {
+        lock_guard<mutex> lock(cache->mutex);
+        const auto it = cache->positions.find(pair);
+        if (it != cache->positions.end())
+        {
+            cache->pairs.splice(cache->pairs.begin(), cache->pairs, it->second);
+            return it->second->second;
+        }
+    }
+
+    // Computed outside the lock. If another thread computed the pair meanwhile, its moments are kept.
+    auto moments = make_shared<PairMoments>();
+    rolling_pair_moments(returns[i], returns[j], window, *moments);
+
+    lock_guard<mutex> lock(cache->mutex);
+    const auto it = cache->positions.find(pair);
+    if (it != cache->positions.end())
+    {
+        cache->pairs.splice(cache->pairs.begin(), cache->pairs, it->second);
+        return it->second->second;
+    }
+
+    cache->pairs.emplace_front(pair, std::move(moments));
+    cache->positions[pair] = cache->pairs.begin();
+    if (cache->pairs.size() > cachedPairs)
+    {
+        cache->positions.erase(cache->pairs.back().first);
+        cache->pairs.pop_back();
+    }
+    return cache->pairs.front().second;
+}
+
+double CorrelationMatrix::covariance(size_t a, size_t b, int time, double& varianceA, double& varianceB) const
+{
+    if (time < 0)
+    {
+        varianceA = varianceB = nan_value;
+        return nan_value;
+    }
+
+    const size_t calendarIndex = calendarIndexes[a].at(size_t(time));
+    const shared_ptr<const PairMoments> pair = pairMoments(min(a, b), max(a, b));
+    varianceA = (*pair)[3 * calendarIndex + (a < b ? 1 : 2)];
+    varianceB = (*pair)[3 * calendarIndex + (a < b ? 2 : 1)];
+    return (*pair)[3 * calendarIndex];
+}
+
+double CorrelationMatrix::Correlation(const string& stockA, const string& stockB, int time) const
+{
+    const size_t a = stockIndex(stockA), b = stockIndex(stockB);
+    if (a == b)
+        return time < 0 ? nan_value : 1.0;
+
+    double varianceA, varianceB;
+    const double cov = covariance(a, b, time, varianceA, varianceB);
+    return cov / std::sqrt(varianceA * varianceB);
+}
+
+double CorrelationMatrix::Beta(const string& stock, const string& benchmark, int time) const
+{
+    const size_t a = stockIndex(stock), b = stockIndex(benchmark);
+    if (a == b)
+        return time < 0 ? nan_value : 1.0;
+
+    double varianceA, varianceB;
+    const double cov = covariance(a, b, time, varianceA, varianceB);
+    return cov / varianceB;
+}
+
+vector<double> CorrelationMatrix::CorrelationTimeSeries(const string& stockA, const string& stockB) const
+{
+    vector<double> output(calendarIndexes[stockIndex(stockA)].size());
+    for (size_t t = 0; t < output.size(); t++)
+        output[t] = Correlation(stockA, stockB, int(t));
+
+    return output;
+}
+
+vector<double> CorrelationMatrix::BetaTimeSeries(const string& stock, const string& benchmark) const
+{
+    vector<double> output(calendarIndexes[stockIndex(stock)].size());
+    for (size_t t = 0; t < output.size(); t++)
+        output[t] = Beta(stock, benchmark, int(t));
+
+    return output;
+}
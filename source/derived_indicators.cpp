@@ -0,0 +1,494 @@
+#include <cmath>
+#include <deque>
+#include <limits>
+#include <stdexcept>
+#include <functional>
+#include "derived_indicators.h"
+using namespace std;
+using namespace backtester;
+
+/****************************
+*      Expression tree      *
+****************************/
+
+struct DerivedIndicator::Node
+{
+    enum class Type
+    {
+        Constant, Indicator, Derived, Negate, Add, Subtract, Multiply, Divide,
+        Lag, RollingSum, RollingMean, RollingStd, RollingMin, RollingMax, Abs, Log, Min, Max
+    };
+
+    Type type = Type::Constant;
+    double constant = 0.0;
+    IndicatorId indicator {};
+    string derivedName;
+    unsigned parameter = 0;
+    vector<shared_ptr<const Node>> children;
+};
+
+using Node = DerivedIndicator::Node;
+using NodePtr = shared_ptr<const Node>;
+
+/****************************
+*    Expression parser      *
+****************************/
+
+/// Recursive descent parser of the derived indicator grammar:
+///     expression := term (('+' | '-') term)*
+///     term       := unary (('*' | '/') unary)*
+///     unary      := '-' unary | primary
+///     primary    := number | identifier | identifier '(' arguments ')' | '(' expression ')'
+class ExpressionParser
+{
+private:
+    const string& source;
+    const vector<DerivedIndicator>& previous;
+    size_t position = 0;
+
+    [[noreturn]] void fail(const string& message) const
+    {
+        throw invalid_argument("Derived indicator expression \"" + source + "\": " + message + " at position " +
+                               to_string(position) + ".");
+    }
+
+    void skipWhitespace()
+    {
+        while (position < source.size() && isspace((unsigned char) source[position]))
+            position++;
+    }
+
+    bool accept(char c)
+    {
+        skipWhitespace();
+        if (position < source.size() && source[position] == c)
+        {
+            position++;
+            return true;
+        }
+        return false;
+    }
+
+    void expect(char c)
+    {
+        if (!accept(c))
+            fail(string("expected '") + c + "'");
+    }
+
+    static NodePtr makeNode(Node::Type type, vector<NodePtr> children)
+    {
+        auto node = make_shared<Node>();
+        node->type = type;
+        node->children = std::move(children);
+        return node;
+    }
+
+    double parseNumber()
+    {
+        skipWhitespace();
+        const char* begin = source.c_str() + position;
+        char* end = nullptr;
+        const double value = strtod(begin, &end);
+        if (end == begin)
+            fail("expected a number");
+
+        position += (size_t) (end - begin);
+        return value;
+    }
+
+    unsigned parseWindow(bool allowZero)
+    {
+        const double value = parseNumber();
+        if (value != std::floor(value) || value < (allowZero ? 0.0 : 1.0) || value > 1e9)
+            fail("expected a " + string(allowZero ? "non-negative" : "positive") + " integer");
+
+        return (unsigned) value;
+    }
+
+    string parseIdentifier()
+    {
+        skipWhitespace();
+        const size_t begin = position;
+        while (position < source.size() && (isalnum((unsigned char) source[position]) || source[position] == '_'))
+            position++;
+
+        return source.substr(begin, position - begin);
+    }
+
+    NodePtr parseFunction(const string& function)
+    {
+        static const vector<pair<string, Node::Type>> windowFunctions {
+                { "Lag", Node::Type::Lag },
+                { "RollingSum", Node::Type::RollingSum },
+                { "RollingMean", Node::Type::RollingMean },
+                { "RollingStd", Node::Type::RollingStd },
+                { "RollingMin", Node::Type::RollingMin },
+                { "RollingMax", Node::Type::RollingMax }
+        };
+        static const vector<pair<string, Node::Type>> unaryFunctions {
+                { "Abs", Node::Type::Abs },
+                { "Log", Node::Type::Log }
+        };
+        static const vector<pair<string, Node::Type>> binaryFunctions {
+                { "Min", Node::Type::Min },
+                { "Max", Node::Type::Max }
+        };
+
+        for (const auto& [functionName, type] : windowFunctions)
+        {
+            if (function != functionName)
+                continue;
+
+            NodePtr argument = parseExpression();
+            expect(',');
+            auto node = make_shared<Node>();
+            node->type = type;
+            node->parameter = parseWindow(type == Node::Type::Lag);
+            node->children = { argument };
+            expect(')');
+            return node;
+        }
+
+        for (const auto& [functionName, type] : unaryFunctions)
+        {
+            if (function != functionName)
+                continue;
+
+            NodePtr argument = parseExpression();
+            expect(')');
+            return makeNode(type, { argument });
+        }
+
+        for (const auto& [functionName, type] : binaryFunctions)
+        {
+            if (function != functionName)
+                continue;
+
+            NodePtr first = parseExpression();
+            expect(',');
+            NodePtr second = parseExpression();
+            expect(')');
+            return makeNode(type, { first, second });
+        }
+
+        fail("unknown function " + function);
+    }
+
+    NodePtr parsePrimary()
+    {
+        skipWhitespace();
+        if (position >= source.size())
+            fail("unexpected end of expression");
+
+        if (accept('('))
+        {
+            NodePtr node = parseExpression();
+            expect(')');
+            return node;
+        }
+
+        const char c = source[position];
+        if (isdigit((unsigned char) c) || c == '.')
+        {
+            auto node = make_shared<Node>();
+            node->type = Node::Type::Constant;
+            node->constant = parseNumber();
+            return node;
+        }
+
+        const string identifier = parseIdentifier();
+        if (identifier.empty())
+            fail(string("unexpected character '") + c + "'");
+
+        if (accept('('))
+            return parseFunction(identifier);
+
+        auto node = make_shared<Node>();
+        if (IndicatorRegistry::TryFromName(identifier, node->indicator))
+        {
+            node->type = Node::Type::Indicator;
+            return node;
+        }
+
+        for (const DerivedIndicator& derived : previous)
+        {
+            if (derived.Name() == identifier)
+            {
+                node->type = Node::Type::Derived;
+                node->derivedName = identifier;
+                return node;
+            }
+        }
+
+        fail("unknown indicator " + identifier);
+    }
+
+    NodePtr parseUnary()
+    {
+        if (accept('-'))
+            return makeNode(Node::Type::Negate, { parseUnary() });
+
+        return parsePrimary();
+    }
+
+    NodePtr parseTerm()
+    {
+        NodePtr node = parseUnary();
+        while (true)
+        {
+            if (accept('*'))
+                node = makeNode(Node::Type::Multiply, { node, parseUnary() });
+            else if (accept('/'))
+                node = makeNode(Node::Type::Divide, { node, parseUnary() });
+            else
+                return node;
+        }
+    }
+
+    NodePtr parseExpression()
+    {
+        NodePtr node = parseTerm();
+        while (true)
+        {
+            if (accept('+'))
+                node = makeNode(Node::Type::Add, { node, parseTerm() });
+            else if (accept('-'))
+                node = makeNode(Node::Type::Subtract, { node, parseTerm() });
+            else
+                return node;
+        }
+    }
+
+public:
+    ExpressionParser(const string& source, const vector<DerivedIndicator>& previous)
+            : source(source), previous(previous) {}
+
+    NodePtr Parse()
+    {
+        NodePtr node = parseExpression();
+        skipWhitespace();
+        if (position != source.size())
+            fail("unexpected trailing characters");
+
+        return node;
+    }
+};
+
+/****************************
+*    Column evaluation      *
+****************************/
+
+constexpr double nan_value = numeric_limits<double>::quiet_NaN();
+
+vector<double> elementwise(const vector<double>& a, const vector<double>& b, const function<double(double, double)>& f)
+{
+    vector<double> output(a.size());
+    for (size_t i = 0; i < a.size(); i++)
+        output[i] = f(a[i], b[i]);
+
+    return output;
+}
+
+/// Sum and sum of squares over a sliding window. Values are shifted by the first finite value of the series to
+/// reduce cancellation in the variance. Windows containing a NaN or an infinite value evaluate to NaN; these values
+/// are counted apart and never enter the running sums, so the windows after them are not affected.
+vector<double> rolling_moments(const vector<double>& x, unsigned window, Node::Type type)
+{
+    vector<double> output(x.size(), nan_value);
+
+    double shift = 0.0;
+    for (double value : x)
+    {
+        if (std::isfinite(value))
+        {
+            shift = value;
+            break;
+        }
+    }
+
+    double sum = 0.0, sumSquares = 0.0;
+    unsigned missingCount = 0;
+    for (size_t i = 0; i < x.size(); i++)
+    {
+        if (!std::isfinite(x[i]))
+            missingCount++;
+        else
+        {
+            sum += x[i] - shift;
+            sumSquares += (x[i] - shift) * (x[i] - shift);
+        }
+
+        if (i >= window)
+        {
+            const double evicted = x[i - window];
+            if (!std::isfinite(evicted))
+                missingCount--;
+            else
+            {
+                sum -= evicted - shift;
+                sumSquares -= (evicted - shift) * (evicted - shift);
+            }
+        }
+
+        if (i + 1 < window || missingCount > 0)
+            continue;
+
+        const double n = window;
+        if (type == Node::Type::RollingSum)
+            output[i] = sum + n * shift;
+        else if (type == Node::Type::RollingMean)
+            output[i] = sum / n + shift;
+        else if (window > 1)
+            output[i] = std::sqrt(std::max(0.0, (sumSquares - sum * sum / n) / (n - 1.0)));
+    }
+
+    return output;
+}
+
+/// Minimum or maximum over a sliding window with a monotonic deque. Windows containing a NaN evaluate to NaN.
+vector<double> rolling_extreme(const vector<double>& x, unsigned window, bool minimum)
+{
+    vector<double> output(x.size(), nan_value);
+    deque<size_t> candidates;
+    size_t lastNan = numeric_limits<size_t>::max();
+
+    for (size_t i = 0; i < x.size(); i++)
+    {
+        if (std::isnan(x[i]))
+            lastNan = i;
+        else
+        {
+            while (!candidates.empty() && (minimum ? x[candidates.back()] >= x[i] : x[candidates.back()] <= x[i]))
+                candidates.pop_back();
+            candidates.push_back(i);
+        }
+
+        while (!candidates.empty() && candidates.front() + window <= i)
+            candidates.pop_front();
+
+        const bool nanInWindow = lastNan != numeric_limits<size_t>::max() && lastNan + window > i;
+        if (i + 1 >= window && !nanInWindow)
+            output[i] = x[candidates.front()];
+    }
+
+    return output;
+}
+
+vector<double> evaluate_node(const Node& node, const StockData& stockData)
+{
+    const size_t timePoints = stockData.TimePoints();
+
+    switch (node.type)
+    {
+        case Node::Type::Constant:
+            return vector<double>(timePoints, node.constant);
+
+        case Node::Type::Indicator:
+            return stockData.Series(node.indicator).ToVector();
+
+        case Node::Type::Derived:
+        {
+            size_t index = 0;
+            if (!stockData.TryDerivedIndex(node.derivedName, index))
+                throw runtime_error("Derived indicator " + node.derivedName + " has not been evaluated.");
+
+            return stockData.DerivedSeries(index).ToVector();
+        }
+
+        default:
+            break;
+    }
+
+    vector<vector<double>> arguments;
+    for (const NodePtr& child : node.children)
+        arguments.push_back(evaluate_node(*child, stockData));
+
+    vector<double>& x = arguments.front();
+    switch (node.type)
+    {
+        case Node::Type::Negate:
+            for (double& value : x)
+                value = -value;
+            return x;
+
+        case Node::Type::Abs:
+            for (double& value : x)
+                value = std::abs(value);
+            return x;
+
+        case Node::Type::Log:
+            for (double& value : x)
+                value = std::log(value);
+            return x;
+
+        case Node::Type::Add:
+            return elementwise(x, arguments[1], [](double a, double b) { return a + b; });
+        case Node::Type::Subtract:
+            return elementwise(x, arguments[1], [](double a, double b) { return a - b; });
+        case Node::Type::Multiply:
+            return elementwise(x, arguments[1], [](double a, double b) { return a * b; });
+        case Node::Type::Divide:
+            return elementwise(x, arguments[1], [](double a, double b) { return a / b; });
+        case Node::Type::Min:
+            return elementwise(x, arguments[1], [](double a, double b) { return std::fmin(a, b); });
+        case Node::Type::Max:
+            return elementwise(x, arguments[1], [](double a, double b) { return std::fmax(a, b); });
+
+        case Node::Type::Lag:
+        {
+            vector<double> output(x.size(), nan_value);
+            for (size_t i = node.parameter; i < x.size(); i++)
+                output[i] = x[i - node.parameter];
+            return output;
+        }
+
+        case Node::Type::RollingSum:
+        case Node::Type::RollingMean:
+        case Node::Type::RollingStd:
+            return rolling_moments(x, node.parameter, node.type);
+
+        case Node::Type::RollingMin:
+            return rolling_extreme(x, node.parameter, true);
+        case Node::Type::RollingMax:
+            return rolling_extreme(x, node.parameter, false);
+
+        default:
+            throw logic_error("Unhandled derived indicator node.");
+    }
+}
+
+/****************************
+*     Derived indicator     *
+****************************/
+
+DerivedIndicator DerivedIndicator::Compile(const string& name, const string& expression,
+                                           const vector<DerivedIndicator>& previous)
+{
+    IndicatorId id {};
+    if (name.empty() || IndicatorRegistry::TryFromName(name, id))
+        throw invalid_argument("Invalid derived indicator name: " + name + ".");
+
+    for (const DerivedIndicator& derived : previous)
+    {
+        if (derived.Name() == name)
+            throw invalid_argument("Derived indicator " + name + " is already defined.");
+    }
+
+    DerivedIndicator derived;
+    derived.name = name;
+    derived.expression = expression;
+    derived.root = ExpressionParser(expression, previous).Parse();
+    return derived;
+}
+
+vector<double> DerivedIndicator::Evaluate(const StockData& stockData) const
+{
+    return evaluate_node(*root, stockData);
+}
+
+void DerivedIndicator::EvaluateAll(const vector<DerivedIndicator>& derivedIndicators, StockData& stockData)
+{
+    stockData.ClearDerivedIndicators();
+    for (const DerivedIndicator& derived : derivedIndicators)
+        stockData.AddDerivedIndicator(derived.Name(), derived.Expression(), derived.Evaluate(stockData));
+}
@@ -1,7 +1,29 @@
 #include <cassert>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <tuple>
+#include <mutex>
+#include <thread>
+#include <fstream>
+#include <cstdio>
+#include <set>
 #include <utility>
+#include <string_view>
+#include <cstring>
+#include <chrono>
+#include <array>
+#include <functional>
+#include <digestpp.hpp>
+#include <cereal/archives/binary.hpp>
 #include "evaluator.h"
-#include "thread_pool.h"
+#include "worker_pool.h"
+#include "indicators.h"
+#include "strategy_expression.h"
+#include "native_strategy.h"
+#include "filesystem.h"
 using namespace std;
 using namespace backtester;
 
@@ -9,62 +31,207 @@ using namespace backtester;
 *     Dataset reference     *
 ****************************/
 
-Dataset Evaluator::evaluatorDataset;
 
-void Evaluator::SetStrategyEvaluatorDataset(Dataset dataset) noexcept
+/// Source of the identifiers of the evaluators, which tell apart the series handles that threads give to scripts.
+atomic<unsigned> evaluator_count { 0 };
+
+Evaluator::Evaluator(shared_ptr<const Dataset> dataset)
+    : dataset(dataset != nullptr ? std::move(dataset) : make_shared<const Dataset>()),
+      correlationMatrix(make_shared<const CorrelationMatrix>()),
+      id(++evaluator_count)
+{
+    stocks = Utilities::Keys(*this->dataset);
+}
+
+Evaluator::Evaluator(Dataset dataset) : Evaluator(make_shared<const Dataset>(std::move(dataset)))
+{
+}
+
+void Evaluator::ComputeCorrelations(unsigned window)
+{
+    correlationMatrix = make_shared<const CorrelationMatrix>(*dataset, window);
+}
+
+const Dataset& Evaluator::GetDataset() const noexcept
+{
+    return *dataset;
+}
+
+const vector<string>& Evaluator::GetStocksInDataset() const noexcept
 {
-    evaluatorDataset = std::move(dataset);
+    return stocks;
 }
 
-Dataset Evaluator::GetStrategyEvaluatorDataset() noexcept
+bool Evaluator::HasStock(const string& stock) const noexcept
 {
-    return evaluatorDataset;
+    return dataset->find(stock) != dataset->end();
 }
 
-vector<string> Evaluator::GetStocksInDataset() noexcept
+const StockData& Evaluator::stockData(const string& stock) const
 {
-    return Utilities::Keys(evaluatorDataset);
+    const auto it = dataset->find(stock);
+    if (it == dataset->end())
+        throw out_of_range("Stock " + stock + " is not in the dataset.");
+
+    return it->second;
 }
 
 /**************************************
 * Observable accessors implementation *
 **************************************/
 
-string Evaluator::Date(const string& stock, int time)
+string Evaluator::Date(const string& stock, int time) const
+{
+    return stockData(stock).dates[time];
+}
+
+const vector<string>& Evaluator::Dates(const string& stock) const
+{
+    return stockData(stock).dates;
+}
+
+double Evaluator::Indicator(const string& indicatorName, const string& stock, int time) const
+{
+    IndicatorId indicator {};
+    if (IndicatorRegistry::TryFromName(indicatorName, indicator))
+        return Indicator(indicator, stock, time);
+
+    return Derived(indicatorName, stock, time);
+}
+
+double Evaluator::Indicator(IndicatorId indicator, const string& stock, int time) const
+{
+    return stockData(stock).Value(indicator, time);
+}
+
+double Evaluator::Derived(const string& derivedName, const string& stock, int time) const
+{
+    const StockData& data = stockData(stock);
+    size_t index = 0;
+    if (!data.TryDerivedIndex(derivedName, index))
+        throw invalid_argument("Unknown indicator " + derivedName + ".");
+
+    return data.DerivedValue(index, time);
+}
+
+double Evaluator::IndQuantile(const string& indicatorName, const string& percentile, const string& stock,
+                              int time) const
+{
+    const IndicatorId indicator = IndicatorRegistry::IndicatorFromName(indicatorName);
+    PercentileId percentileId {};
+    if (IndicatorRegistry::TryFromName(percentile, percentileId))
+        return IndQuantile(indicator, percentileId, stock, time);
+
+    // Percentiles that are not precomputed are answered by the range quantile index.
+    char* end = nullptr;
+    const double percentileValue = strtod(percentile.c_str(), &end);
+    if (end == percentile.c_str() || *end != '\0' || !(percentileValue >= 0.0 && percentileValue <= 1.0))
+        throw invalid_argument("Unknown percentile " + percentile + ".");
+
+    return IndQuantileWindow(indicator, percentileValue, windowSize, stock, time);
+}
+
+double Evaluator::IndQuantile(IndicatorId indicator, PercentileId percentile, const string& stock, int time) const
+{
+    return stockData(stock).QuantileValue(indicator, percentile, time);
+}
+
+double Evaluator::IndQuantileWindow(const string& indicatorName, double percentile, int window, const string& stock,
+                                    int time) const
+{
+    return IndQuantileWindow(IndicatorRegistry::IndicatorFromName(indicatorName), percentile, window, stock, time);
+}
+
+/// Time indexes [begin, end) of the window values preceding a time index. Like the rolling percentile ranks, the
+/// first time indexes use the history available so far.
+pair<size_t, size_t> preceding_window(int window, int time)
+{
+    if (window <= 0 || time <= 0)
+        return { 0, 0 };
+
+    return { size_t(max(time - window, 0)), size_t(time) };
+}
+
+double Evaluator::IndQuantileWindow(IndicatorId indicator, double percentile, int window, const string& stock,
+                                    int time) const
+{
+    const auto [begin, end] = preceding_window(window, time);
+    return stockData(stock).RangeQuantile(indicator, percentile, begin, end);
+}
+
+double Evaluator::RollingMean(const string& indicatorName, int window, const string& stock, int time) const
+{
+    const auto [begin, end] = preceding_window(window, time);
+    return stockData(stock).RangeMean(IndicatorRegistry::IndicatorFromName(indicatorName), begin, end);
+}
+
+double Evaluator::RollingStd(const string& indicatorName, int window, const string& stock, int time) const
+{
+    const auto [begin, end] = preceding_window(window, time);
+    return stockData(stock).RangeStd(IndicatorRegistry::IndicatorFromName(indicatorName), begin, end);
+}
+
+double Evaluator::RollingVWAP(int window, const string& stock, int time) const
+{
+    const auto [begin, end] = preceding_window(window, time);
+    return stockData(stock).RangeVWAP(begin, end);
+}
+
+double Evaluator::RollingCorrelation(const string& stockA, const string& stockB, int time) const
+{
+    return correlationMatrix->Correlation(stockA, stockB, time);
+}
+
+double Evaluator::RollingBeta(const string& stock, const string& benchmark, int time) const
+{
+    return correlationMatrix->Beta(stock, benchmark, time);
+}
+
+double Evaluator::IndPercentileRank(const string& indicatorName, const string& stock, int time) const
 {
-    return evaluatorDataset[stock].dates[time];
+    return IndPercentileRank(IndicatorRegistry::IndicatorFromName(indicatorName), stock, time);
 }
 
-vector<string> Evaluator::Dates(const string& stock)
+double Evaluator::IndPercentileRank(IndicatorId indicator, const string& stock, int time) const
 {
-    return evaluatorDataset[stock].dates;
+    return stockData(stock).PercentileRank(indicator, time);
 }
 
-double Evaluator::Indicator(const string& indicatorName, const string& stock, int time)
+vector<double> Evaluator::IndicatorTimeSeries(const string& indicatorName, const string& stock) const
 {
-    return evaluatorDataset[stock].indicators[indicatorName][time];
+    IndicatorId indicator {};
+    if (IndicatorRegistry::TryFromName(indicatorName, indicator))
+        return Series(indicator, stock).ToVector();
+
+    const StockData& data = stockData(stock);
+    size_t index = 0;
+    if (!data.TryDerivedIndex(indicatorName, index))
+        throw invalid_argument("Unknown indicator " + indicatorName + ".");
+
+    return data.DerivedSeries(index).ToVector();
 }
 
-double Evaluator::IndQuantile(const string& indicatorName, const string& percentile, const string& stock, int time)
+vector<double> Evaluator::IndQuantileTimeSeries(const string& indicatorName, const string& percentile, const string& stock) const
 {
-    return evaluatorDataset[stock].quantileIndicators[percentile][indicatorName][time];
+    return stockData(stock).QuantileSeries(IndicatorRegistry::IndicatorFromName(indicatorName),
+                                                  IndicatorRegistry::PercentileFromName(percentile)).ToVector();
 }
 
-vector<double>& Evaluator::IndicatorTimeSeries(const string& indicatorName, const string& stock)
+vector<double> Evaluator::IndPercentileRankTimeSeries(const string& indicatorName, const string& stock) const
 {
-    return evaluatorDataset[stock].indicators[indicatorName];
+    return stockData(stock).PercentileRankSeries(IndicatorRegistry::IndicatorFromName(indicatorName)).ToVector();
 }
 
-vector<double>& Evaluator::IndQuantileTimeSeries(const string& indicatorName, const string& percentile, const string& stock)
+SeriesView Evaluator::Series(IndicatorId indicator, const string& stock) const
 {
-    return evaluatorDataset[stock].quantileIndicators[percentile][indicatorName];
+    return stockData(stock).Series(indicator);
 }
 
 /****************************
 *     Angescript engine     *
 ****************************/
 
-const string program_part_A = R""""(bool execute(string stock, int time)
+const string program_part_A = R""""(bool execute(const string &in stock, int time)
 {
     if ()"""";
 
@@ -76,11 +243,281 @@ const string program_part_B = R""""()
         return false;
 })"""";
 
+const string score_part_A = R""""(double execute(const string &in stock, int time)
+{
+    return ()"""";
+
+const string score_part_B = R""""();
+})"""";
+
+/// Declarations of the functions generated from a strategy program and from a score program.
+const char* const strategy_declaration = "bool execute(const string &in, int)";
+const char* const score_declaration = "double execute(const string &in, int)";
+
+/// Returns the function generated from a strategy or score program, or nullptr if the module has none.
+asIScriptFunction* execute_function(const asIScriptModule* mod)
+{
+    asIScriptFunction* func = mod->GetFunctionByDecl(strategy_declaration);
+    return func != nullptr ? func : mod->GetFunctionByDecl(score_declaration);
+}
+
+/// Prefix of the module globals that hold the pre-bound series of indicators named by string literals.
+const string bound_series_prefix = "boundSeries_";
+
 string Evaluator::strategyToFunction(const string& strategy)
 {
     return program_part_A + strategy + program_part_B;
 }
 
+bool is_identifier_char(char c)
+{
+    return isalnum((unsigned char) c) || c == '_';
+}
+
+/// Rewrite the calls Indicator("Name", stock, <time>) of registered indicators into reads boundSeries_Name[<time>]
+/// of pre-bound series handles. Calls that do not have exactly this form are kept.
+string bind_indicator_literals(const string& expression, set<string>& boundIndicators)
+{
+    static const string call = "Indicator(";
+    string output;
+    size_t position = 0;
+    while (true)
+    {
+        const size_t start = expression.find(call, position);
+        if (start == string::npos)
+            break;
+
+        output += expression.substr(position, start - position);
+        position = start + call.size();
+        if (start > 0 && is_identifier_char(expression[start - 1]))
+        {
+            output += call;
+            continue;
+        }
+
+        // Match the literal name and the stock argument.
+        size_t p = position;
+        auto skipWhitespace = [&]() { while (p < expression.size() && isspace((unsigned char) expression[p])) p++; };
+        skipWhitespace();
+        const size_t nameBegin = p + 1;
+        const size_t nameEnd = p < expression.size() && expression[p] == '"' ? expression.find('"', nameBegin) : string::npos;
+        IndicatorId id {};
+        bool matched = nameEnd != string::npos && IndicatorRegistry::TryFromName(expression.substr(nameBegin, nameEnd - nameBegin), id);
+        if (matched)
+        {
+            p = nameEnd + 1;
+            skipWhitespace();
+            matched = p < expression.size() && expression[p++] == ',';
+            skipWhitespace();
+            matched = matched && expression.compare(p, 5, "stock") == 0 && p + 5 < expression.size() &&
+                      !is_identifier_char(expression[p + 5]);
+            p += 5;
+            skipWhitespace();
+            matched = matched && p < expression.size() && expression[p++] == ',';
+        }
+
+        // Find the end of the time argument.
+        size_t argumentEnd = p;
+        int depth = 0;
+        bool inString = false;
+        for (; matched && argumentEnd < expression.size(); argumentEnd++)
+        {
+            const char c = expression[argumentEnd];
+            if (inString)
+            {
+                if (c == '\\')
+                    argumentEnd++;
+                else if (c == '"')
+                    inString = false;
+            }
+            else if (c == '"')
+                inString = true;
+            else if (c == '(')
+                depth++;
+            else if (c == ')' && depth-- == 0)
+                break;
+            else if (c == ',' && depth == 0)
+                matched = false;
+        }
+
+        if (!matched || argumentEnd >= expression.size())
+        {
+            output += call;
+            continue;
+        }
+
+        const string name(IndicatorRegistry::Name(id));
+        boundIndicators.insert(name);
+        output += bound_series_prefix + name + "[" +
+                  bind_indicator_literals(expression.substr(p, argumentEnd - p), boundIndicators) + "]";
+        position = argumentEnd + 1;
+    }
+
+    return output + expression.substr(position);
+}
+
+/// Bind the indicator literals of a program, wrap it into a function and declare the bound series as module globals.
+string bound_function(const string& program, const string& partA, const string& partB)
+{
+    set<string> boundIndicators;
+    const string function = partA + bind_indicator_literals(program, boundIndicators) + partB;
+
+    string globals;
+    for (const string& name : boundIndicators)
+        globals += "Series@ " + bound_series_prefix + name + ";\n";
+
+    return globals + function;
+}
+
+string Evaluator::strategyToBoundFunction(const string& strategy)
+{
+    return bound_function(strategy, program_part_A, program_part_B);
+}
+
+string Evaluator::scoreToBoundFunction(const string& score)
+{
+    return bound_function(score, score_part_A, score_part_B);
+}
+
+/// Evaluator whose strategies are being run by this thread. The functions registered in the scripting engine read
+/// the dataset of this evaluator.
+thread_local const Evaluator* active_evaluator = nullptr;
+
+/// Makes an evaluator the active one of the thread during a scope.
+struct ActiveEvaluatorScope
+{
+    const Evaluator* previous;
+
+    explicit ActiveEvaluatorScope(const Evaluator* evaluator) : previous(active_evaluator)
+    {
+        active_evaluator = evaluator;
+    }
+
+    ~ActiveEvaluatorScope()
+    {
+        active_evaluator = previous;
+    }
+};
+
+const Evaluator& script_evaluator()
+{
+    if (active_evaluator == nullptr)
+        throw logic_error("Strategy accessors can only be called while an evaluator runs a strategy.");
+
+    return *active_evaluator;
+}
+
+/// Series handles given to the scripts of a thread, for the last evaluator that used them. Map nodes keep their
+/// address, so handles stay valid.
+struct ThreadSeriesHandles
+{
+    unsigned evaluator = 0;
+    map<tuple<string, unsigned, size_t>, SeriesView> handles;
+};
+
+thread_local ThreadSeriesHandles thread_series_handles;
+
+SeriesView* Evaluator::scriptSeries(ScriptSeries kind, size_t index, const string& stock) const
+{
+    if (thread_series_handles.evaluator != id)
+    {
+        thread_series_handles.handles.clear();
+        thread_series_handles.evaluator = id;
+    }
+
+    const auto key = make_tuple(stock, static_cast<unsigned>(kind), index);
+    auto it = thread_series_handles.handles.find(key);
+    if (it != thread_series_handles.handles.end())
+        return &it->second;
+
+    // Views point into the immutable dataset, so handles never copy the series.
+    const StockData& data = stockData(stock);
+    const auto indicator = static_cast<IndicatorId>(index % IndicatorRegistry::indicatorCount);
+    SeriesView view;
+    switch (kind)
+    {
+        case ScriptSeries::Indicator:
+            view = data.Series(indicator);
+            break;
+        case ScriptSeries::Derived:
+            view = data.DerivedSeries(index);
+            break;
+        case ScriptSeries::Quantile:
+            view = data.QuantileSeries(indicator, static_cast<PercentileId>(index / IndicatorRegistry::indicatorCount));
+            break;
+        case ScriptSeries::PercentileRank:
+            view = data.PercentileRankSeries(indicator);
+            break;
+    }
+
+    return &thread_series_handles.handles.emplace(key, view).first->second;
+}
+
+SeriesView* Evaluator::scriptGetSeries(const string& indicatorName, const string& stock)
+{
+    const Evaluator& evaluator = script_evaluator();
+    IndicatorId indicator {};
+    if (IndicatorRegistry::TryFromName(indicatorName, indicator))
+        return evaluator.scriptSeries(ScriptSeries::Indicator, IndicatorRegistry::Index(indicator), stock);
+
+    size_t index = 0;
+    if (!evaluator.stockData(stock).TryDerivedIndex(indicatorName, index))
+        throw invalid_argument("Unknown indicator " + indicatorName + ".");
+
+    return evaluator.scriptSeries(ScriptSeries::Derived, index, stock);
+}
+
+SeriesView* Evaluator::scriptGetQuantileSeries(const string& indicatorName, const string& percentile,
+                                               const string& stock)
+{
+    const size_t row = IndicatorRegistry::Index(IndicatorRegistry::PercentileFromName(percentile)) *
+                       IndicatorRegistry::indicatorCount +
+                       IndicatorRegistry::Index(IndicatorRegistry::IndicatorFromName(indicatorName));
+    return script_evaluator().scriptSeries(ScriptSeries::Quantile, row, stock);
+}
+
+SeriesView* Evaluator::scriptGetPercentileRankSeries(const string& indicatorName, const string& stock)
+{
+    const IndicatorId indicator = IndicatorRegistry::IndicatorFromName(indicatorName);
+    return script_evaluator().scriptSeries(ScriptSeries::PercentileRank, IndicatorRegistry::Index(indicator), stock);
+}
+
+void Evaluator::bindSeriesHandles(asIScriptFunction* func, const string& stock) const
+{
+    if (func == nullptr)
+        return;
+
+    asIScriptModule* mod = func->GetModule();
+    for (asUINT i = 0; i < mod->GetGlobalVarCount(); i++)
+    {
+        const char* name = nullptr;
+        mod->GetGlobalVar(i, &name);
+        if (name == nullptr || string_view(name).substr(0, bound_series_prefix.size()) != bound_series_prefix)
+            continue;
+
+        const IndicatorId indicator = IndicatorRegistry::IndicatorFromName(string_view(name).substr(bound_series_prefix.size()));
+        *static_cast<SeriesView**>(mod->GetAddressOfGlobalVar(i)) =
+                scriptSeries(ScriptSeries::Indicator, IndicatorRegistry::Index(indicator), stock);
+    }
+}
+
+/// Bounds-checked read of a series from a script.
+double script_series_at(int time, const SeriesView* series)
+{
+    if (time < 0 || size_t(time) >= series->size)
+    {
+        asGetActiveContext()->SetException("Time index out of range.");
+        return 0.0;
+    }
+    return (*series)[size_t(time)];
+}
+
+/// Number of values of a series read from a script.
+int script_series_length(const SeriesView* series)
+{
+    return int(series->size);
+}
+
 void Evaluator::messageCallback(const asSMessageInfo* msg, [[maybe_unused]] void* param)
 {
     const char* type = "[Scripting engine ERR]: ";
@@ -117,20 +554,233 @@ string Evaluator::scriptingEngineProgram(const string& program)
     return string("\n[Strategy program]: ") + program + "\n";
 }
 
-void Evaluator::registerInterface(asIScriptEngine* engine)
+/// Accessors of the scripting interface, which forward to the active evaluator of the thread.
+double script_indicator(const string& indicatorName, const string& stock, int time)
+{
+    return script_evaluator().Indicator(indicatorName, stock, time);
+}
+
+double script_derived(const string& derivedName, const string& stock, int time)
+{
+    return script_evaluator().Derived(derivedName, stock, time);
+}
+
+double script_ind_quantile(const string& indicatorName, const string& percentile, const string& stock, int time)
+{
+    return script_evaluator().IndQuantile(indicatorName, percentile, stock, time);
+}
+
+double script_ind_quantile_window(const string& indicatorName, double percentile, int window, const string& stock,
+                                  int time)
+{
+    return script_evaluator().IndQuantileWindow(indicatorName, percentile, window, stock, time);
+}
+
+double script_rolling_mean(const string& indicatorName, int window, const string& stock, int time)
+{
+    return script_evaluator().RollingMean(indicatorName, window, stock, time);
+}
+
+double script_rolling_std(const string& indicatorName, int window, const string& stock, int time)
+{
+    return script_evaluator().RollingStd(indicatorName, window, stock, time);
+}
+
+double script_rolling_vwap(int window, const string& stock, int time)
+{
+    return script_evaluator().RollingVWAP(window, stock, time);
+}
+
+double script_rolling_correlation(const string& stockA, const string& stockB, int time)
+{
+    return script_evaluator().RollingCorrelation(stockA, stockB, time);
+}
+
+double script_rolling_beta(const string& stock, const string& benchmark, int time)
+{
+    return script_evaluator().RollingBeta(stock, benchmark, time);
+}
+
+double script_ind_percentile_rank(const string& indicatorName, const string& stock, int time)
+{
+    return script_evaluator().IndPercentileRank(indicatorName, stock, time);
+}
+
+/****************************
+*     Script profiling      *
+****************************/
+
+/// Functions of the scripting interface, in the order of their names in the profiles.
+enum class ScriptAccessor : unsigned
+{
+    SeriesIndex, SeriesLength, GetSeries, GetQuantileSeries, GetPercentileRankSeries, Indicator, Derived, IndQuantile,
+    IndQuantileWindow, RollingMean, RollingStd, RollingVWAP, RollingCorrelation, RollingBeta, IndPercentileRank, Count
+};
+
+constexpr array<const char*, size_t(ScriptAccessor::Count)> script_accessor_names {
+    "Series[]", "Series.length", "GetSeries", "GetQuantileSeries", "GetPercentileRankSeries", "Indicator", "Derived",
+    "IndQuantile", "IndQuantileWindow", "RollingMean", "RollingStd", "RollingVWAP", "RollingCorrelation",
+    "RollingBeta", "IndPercentileRank"
+};
+
+/// Hits and time of the script lines and the accessors while a strategy is profiled. A line is hit when execution
+/// enters it from another line, since the engine may place several line cues in one statement, and its time runs
+/// until execution leaves it or the bar ends.
+struct ScriptProfiler
+{
+    using Clock = chrono::steady_clock;
+
+    map<int, pair<size_t, double>> lines;
+    array<pair<size_t, double>, size_t(ScriptAccessor::Count)> accessors {};
+    int line = 0;
+    Clock::time_point lineStart;
+
+    void EnterLine(int next)
+    {
+        if (next == line)
+            return;
+
+        const Clock::time_point now = Clock::now();
+        closeLine(now);
+        line = next;
+        lines[line].first++;
+        lineStart = now;
+    }
+
+    void EndBar()
+    {
+        closeLine(Clock::now());
+        line = 0;
+    }
+
+private:
+    void closeLine(Clock::time_point now)
+    {
+        if (line != 0)
+            lines[line].second += chrono::duration<double>(now - lineStart).count();
+    }
+};
+
+/// Profiler of the strategy run by this thread, if it is being profiled.
+thread_local ScriptProfiler* active_profiler = nullptr;
+
+void profile_line_callback(asIScriptContext* ctx, void* profiler)
+{
+    static_cast<ScriptProfiler*>(profiler)->EnterLine(ctx->GetLineNumber());
+}
+
+/// Records a call to an accessor, from its construction to the end of its scope.
+template<ScriptAccessor accessor>
+struct AccessorTimer
+{
+    ScriptProfiler::Clock::time_point start = ScriptProfiler::Clock::now();
+
+    ~AccessorTimer()
+    {
+        if (active_profiler == nullptr)
+            return;
+
+        auto& [calls, seconds] = active_profiler->accessors[size_t(accessor)];
+        calls++;
+        seconds += chrono::duration<double>(ScriptProfiler::Clock::now() - start).count();
+    }
+};
+
+/// Accessor registered in the engines of the profiler, which times the calls to the accessor it wraps.
+template<ScriptAccessor accessor, auto function>
+struct ProfiledAccessor;
+
+template<ScriptAccessor accessor, class R, class... Args, R (*function)(Args...)>
+struct ProfiledAccessor<accessor, function>
+{
+    static R Call(Args... args)
+    {
+        const AccessorTimer<accessor> timer;
+        return function(args...);
+    }
+};
+
+/// Function registered for an accessor: the accessor itself, or a timed wrapper in the engines of the profiler, so
+/// that the engines that are not profiled do not pay for it.
+template<ScriptAccessor accessor, auto function>
+asSFuncPtr script_function(bool profiled)
+{
+    return profiled ? asFUNCTION((ProfiledAccessor<accessor, function>::Call)) : asFUNCTION(function);
+}
+
+void Evaluator::registerInterface(asIScriptEngine* engine, bool profiled)
 {
     int r;
-    r = engine->RegisterGlobalFunction("double Indicator(string, string, int)",
-                                       asFUNCTIONPR(Evaluator::Indicator, (const string&, const string&, int), double),
+    r = engine->RegisterObjectType("Series", 0, asOBJ_REF | asOBJ_NOCOUNT);
+    assert(r >= 0);
+    r = engine->RegisterObjectMethod("Series", "double opIndex(int) const",
+                                     script_function<ScriptAccessor::SeriesIndex, script_series_at>(profiled),
+                                     asCALL_CDECL_OBJLAST);
+    assert(r >= 0);
+    r = engine->RegisterObjectMethod("Series", "int length() const",
+                                     script_function<ScriptAccessor::SeriesLength, script_series_length>(profiled),
+                                     asCALL_CDECL_OBJLAST);
+    assert(r >= 0);
+    r = engine->RegisterGlobalFunction("Series@ GetSeries(const string &in, const string &in)",
+                                       script_function<ScriptAccessor::GetSeries, Evaluator::scriptGetSeries>(profiled),
+                                       asCALL_CDECL);
+    assert(r >= 0);
+    r = engine->RegisterGlobalFunction("Series@ GetQuantileSeries(const string &in, const string &in, const string &in)",
+                                       script_function<ScriptAccessor::GetQuantileSeries,
+                                                       Evaluator::scriptGetQuantileSeries>(profiled),
+                                       asCALL_CDECL);
+    assert(r >= 0);
+    r = engine->RegisterGlobalFunction("Series@ GetPercentileRankSeries(const string &in, const string &in)",
+                                       script_function<ScriptAccessor::GetPercentileRankSeries,
+                                                       Evaluator::scriptGetPercentileRankSeries>(profiled),
+                                       asCALL_CDECL);
+    assert(r >= 0);
+    r = engine->RegisterGlobalFunction("double Indicator(const string &in, const string &in, int)",
+                                       script_function<ScriptAccessor::Indicator, script_indicator>(profiled),
+                                       asCALL_CDECL);
+    assert(r >= 0);
+    r = engine->RegisterGlobalFunction("double Derived(const string &in, const string &in, int)",
+                                       script_function<ScriptAccessor::Derived, script_derived>(profiled),
+                                       asCALL_CDECL);
+    assert(r >= 0);
+    r = engine->RegisterGlobalFunction("double IndQuantile(const string &in, const string &in, const string &in, int)",
+                                       script_function<ScriptAccessor::IndQuantile, script_ind_quantile>(profiled),
+                                       asCALL_CDECL);
+    assert(r >= 0);
+    r = engine->RegisterGlobalFunction("double IndQuantileWindow(const string &in, double, int, const string &in, int)",
+                                       script_function<ScriptAccessor::IndQuantileWindow,
+                                                       script_ind_quantile_window>(profiled),
+                                       asCALL_CDECL);
+    assert(r >= 0);
+    r = engine->RegisterGlobalFunction("double RollingMean(const string &in, int, const string &in, int)",
+                                       script_function<ScriptAccessor::RollingMean, script_rolling_mean>(profiled),
+                                       asCALL_CDECL);
+    assert(r >= 0);
+    r = engine->RegisterGlobalFunction("double RollingStd(const string &in, int, const string &in, int)",
+                                       script_function<ScriptAccessor::RollingStd, script_rolling_std>(profiled),
+                                       asCALL_CDECL);
+    assert(r >= 0);
+    r = engine->RegisterGlobalFunction("double RollingVWAP(int, const string &in, int)",
+                                       script_function<ScriptAccessor::RollingVWAP, script_rolling_vwap>(profiled),
+                                       asCALL_CDECL);
+    assert(r >= 0);
+    r = engine->RegisterGlobalFunction("double RollingCorrelation(const string &in, const string &in, int)",
+                                       script_function<ScriptAccessor::RollingCorrelation,
+                                                       script_rolling_correlation>(profiled),
+                                       asCALL_CDECL);
+    assert(r >= 0);
+    r = engine->RegisterGlobalFunction("double RollingBeta(const string &in, const string &in, int)",
+                                       script_function<ScriptAccessor::RollingBeta, script_rolling_beta>(profiled),
                                        asCALL_CDECL);
     assert(r >= 0);
-    r = engine->RegisterGlobalFunction("double IndQuantile(string, string, string, int)",
-                                       asFUNCTIONPR(Evaluator::IndQuantile, (const string&, const string&, const string&, int), double),
+    r = engine->RegisterGlobalFunction("double IndPercentileRank(const string &in, const string &in, int)",
+                                       script_function<ScriptAccessor::IndPercentileRank,
+                                                       script_ind_percentile_rank>(profiled),
                                        asCALL_CDECL);
     assert(r >= 0);
 }
 
-asIScriptEngine* Evaluator::startAngelscriptEngine()
+asIScriptEngine* Evaluator::startAngelscriptEngine(bool profiled)
 {
     // Create the script engine
     asIScriptEngine* engine = asCreateScriptEngine();
@@ -149,14 +799,15 @@ asIScriptEngine* Evaluator::startAngelscriptEngine()
     }
 
     RegisterStdString(engine);
-    registerInterface(engine);
+    registerInterface(engine, profiled);
     engine->SetEngineProperty(asEP_AUTO_GARBAGE_COLLECT, false);
-    engine->SetEngineProperty(asEP_BUILD_WITHOUT_LINE_CUES, true);
+    engine->SetEngineProperty(asEP_BUILD_WITHOUT_LINE_CUES, !profiled);
 
     return engine;
 }
 
-asIScriptFunction* Evaluator::compileAngelscriptStrategy(asIScriptEngine* engine, const string& strategyProgram)
+asIScriptFunction* Evaluator::compileAngelscriptStrategy(asIScriptEngine* engine, const string& strategyProgram,
+                                                         const string& moduleName)
 {
     if (engine == nullptr)
         return nullptr;
@@ -165,7 +816,7 @@ asIScriptFunction* Evaluator::compileAngelscriptStrategy(asIScriptEngine* engine
     // performs a pre-processing pass if necessary, and then tells
     // the engine to build a script module.
     CScriptBuilder builder;
-    int r = builder.StartNewModule(engine, "StrategyModule");
+    int r = builder.StartNewModule(engine, moduleName.c_str());
     if (r < 0)
     {
         // If the code fails here it is usually because there
@@ -192,111 +843,1218 @@ asIScriptFunction* Evaluator::compileAngelscriptStrategy(asIScriptEngine* engine
     }
 
     // Find the function that is to be called.
-    const asIScriptModule* mod = engine->GetModule("StrategyModule");
+    const asIScriptModule* mod = engine->GetModule(moduleName.c_str());
     if (mod == nullptr)
     {
-        scriptingEngineLog("Error getting StrategyModule.");
+        scriptingEngineLog("Error getting " + moduleName + ".");
         return nullptr;
     }
-    asIScriptFunction* func = mod->GetFunctionByDecl("bool execute(string, int)");
+    asIScriptFunction* func = execute_function(mod);
     if (func == nullptr)
     {
         // The function couldn't be found. Instruct the script writer
         // to include the expected function in the script.
         scriptingEngineLog(
-                "The script must have the function 'bool execute(string, int)'. Please add it and try again.");
+                "The script must have the function '" + string(strategy_declaration) + "'. Please add it and try again.");
         return nullptr;
     }
 
     return func;
 }
 
-bool Evaluator::executeAngelscriptStrategy(asIScriptEngine* engine, asIScriptFunction* func, string stock, int dayIndex)
-{
-    // Create our context, prepare it, and then execute
-    asIScriptContext* ctx = engine->CreateContext();
-    ctx->Prepare(func);
+/// Number of time ranges per worker in which the bars evaluated by the scripting engine are split, and the minimum
+/// length of a range.
+constexpr size_t chunks_per_worker = 8;
+constexpr size_t min_chunk_time_points = 256;
 
-    ctx->SetArgObject(0, &stock);
-    ctx->SetArgDWord(1, dayIndex);
+/// Maximum number of compiled strategies kept by the engine of a thread.
+constexpr unsigned max_cached_strategies = 64;
+
+/// Number of strategies compiled by the strategy runners.
+atomic<size_t> compiled_strategy_count { 0 };
+
+/// Script engine owned by a thread. It persists across strategy runs, with its pool of execution contexts, and is
+/// released when the thread exits.
+struct ThreadScriptEngine
+{
+    asIScriptEngine* engine = nullptr;
+
+    ~ThreadScriptEngine()
+    {
+        if (engine != nullptr)
+            engine->ShutDownAndRelease();
+
+        asThreadCleanup();
+    }
+};
+
+thread_local ThreadScriptEngine thread_script_engine;
+
+/// Prepare the scripting library for engines running on several threads. It is done once and kept for the lifetime
+/// of the process, since the engines of the worker threads outlive every call.
+void prepare_script_multithread()
+{
+    static once_flag prepared;
+    call_once(prepared, []() { asPrepareMultithread(); });
+}
+
+asIScriptEngine* Evaluator::threadAngelscriptEngine()
+{
+    if (thread_script_engine.engine == nullptr)
+        thread_script_engine.engine = startAngelscriptEngine();
+
+    return thread_script_engine.engine;
+}
+
+/// Name of the module that holds a compiled strategy program.
+string strategy_module_name(const string& strategyProgram)
+{
+    return "Strategy_" + digestpp::sha256().absorb(strategyProgram).hexdigest();
+}
+
+/****************************
+*      Bytecode cache       *
+****************************/
+
+/// Binary stream of a file, used to save and load the bytecode of modules.
+class FileBinaryStream : public asIBinaryStream
+{
+private:
+    fstream& file;
 
-    int r = ctx->Execute();
-    if (r != asEXECUTION_FINISHED)
+public:
+    explicit FileBinaryStream(fstream& file) : file(file) {}
+
+    int Read(void* ptr, asUINT size) override
+    {
+        file.read(static_cast<char*>(ptr), size);
+        return file ? asSUCCESS : asERROR;
+    }
+
+    int Write(const void* ptr, asUINT size) override
     {
-        // Call to null value during execution
-        if (r == asEXECUTION_EXCEPTION)
+        file.write(static_cast<const char*>(ptr), size);
+        return file ? asSUCCESS : asERROR;
+    }
+};
+
+/// Hash of the interface registered in the engines: the library version and options, and every registered type,
+/// method, function and property. Bytecode saved against another interface is never loaded.
+const string& interface_version(const asIScriptEngine* engine)
+{
+    static const string version = [engine]() {
+        string declarations = string(ANGELSCRIPT_VERSION_STRING) + " " + asGetLibraryOptions() + " " +
+                              to_string(sizeof(void*)) + "\n";
+        for (asUINT i = 0; i < engine->GetObjectTypeCount(); i++)
         {
-            ctx->Release();
-            return false;
+            const asITypeInfo* type = engine->GetObjectTypeByIndex(i);
+            declarations += string(type->GetName()) + " " + to_string(type->GetFlags()) + "\n";
+            for (asUINT m = 0; m < type->GetMethodCount(); m++)
+                declarations += string(type->GetMethodByIndex(m)->GetDeclaration(true, true, true)) + "\n";
+            for (asUINT b = 0; b < type->GetBehaviourCount(); b++)
+                declarations += string(type->GetBehaviourByIndex(b, nullptr)->GetDeclaration(true, true, true)) + "\n";
         }
+        for (asUINT i = 0; i < engine->GetGlobalFunctionCount(); i++)
+            declarations += string(engine->GetGlobalFunctionByIndex(i)->GetDeclaration(true, true, true)) + "\n";
+        for (asUINT i = 0; i < engine->GetGlobalPropertyCount(); i++)
+        {
+            const char* name = nullptr;
+            int typeId = 0;
+            engine->GetGlobalPropertyByIndex(i, &name, nullptr, &typeId);
+            declarations += string(name) + " " + to_string(typeId) + "\n";
+        }
+        return digestpp::sha256().absorb(declarations).hexdigest();
+    }();
+
+    return version;
+}
+
+/// Path of the bytecode of a strategy function, or an empty string if the cache is disabled.
+string bytecode_path(const asIScriptEngine* engine, const string& directory, const string& strategyFunction)
+{
+    if (directory.empty())
+        return string();
+
+    const string hash = digestpp::sha256().absorb(interface_version(engine) + "\n" + strategyFunction).hexdigest();
+    return FileSystem::FilenameJoin({ directory, "strategy_" + hash + ".asbc" });
+}
+
+/// Load the module of a strategy function from its bytecode. Returns false, and discards the module, if the bytecode
+/// is not in the cache or cannot be loaded.
+bool load_bytecode(asIScriptEngine* engine, const string& path, const string& moduleName)
+{
+    if (path.empty() || !FileSystem::FileExist(path))
+        return false;
+
+    fstream file(path, ios::in | ios::binary);
+    FileBinaryStream stream(file);
+    asIScriptModule* mod = engine->GetModule(moduleName.c_str(), asGM_ALWAYS_CREATE);
+    if (mod == nullptr || !file.is_open() || mod->LoadByteCode(&stream) < 0)
+    {
+        engine->DiscardModule(moduleName.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+/// Write a cache file. It is written to a temporary file and renamed, so that other threads and processes never read
+/// a partial file.
+void replace_file(const string& path, const function<bool(fstream&)>& write)
+{
+    const string directory = FileSystem::FileDirectory(path);
+    if (!FileSystem::DirectoryExist(directory))
+        FileSystem::CreateDirectory(directory);
+
+    const string temporaryPath = path + "." + to_string(hash<thread::id>()(this_thread::get_id())) + ".tmp";
+    bool saved;
+    {
+        fstream file(temporaryPath, ios::out | ios::binary | ios::trunc);
+        saved = file.is_open() && write(file) && file.good();
+    }
+
+    if (!saved || rename(temporaryPath.c_str(), path.c_str()) != 0)
+        remove(temporaryPath.c_str());
+}
+
+/// Save the bytecode of a module.
+void save_bytecode(const asIScriptModule* mod, const string& path)
+{
+    if (path.empty())
+        return;
+
+    replace_file(path, [mod](fstream& file) {
+        FileBinaryStream stream(file);
+        return mod->SaveByteCode(&stream) >= 0;
+    });
+}
+
+void Evaluator::EnableBytecodeCache(const string& cacheDirectory)
+{
+    bytecodeCacheDirectory = cacheDirectory;
+}
+
+void Evaluator::DisableBytecodeCache() noexcept
+{
+    bytecodeCacheDirectory.clear();
+}
+
+asIScriptFunction* Evaluator::cachedAngelscriptStrategy(asIScriptEngine* engine, const string& strategyProgram,
+                                                        unsigned capacity) const
+{
+    if (engine == nullptr)
+        return nullptr;
+
+    // Compiled strategies are kept in modules named after the hash of their program.
+    const string moduleName = strategy_module_name(strategyProgram);
+    const asIScriptModule* mod = engine->GetModule(moduleName.c_str(), asGM_ONLY_IF_EXISTS);
+    if (mod != nullptr)
+        return execute_function(mod);
+
+    if (engine->GetModuleCount() >= capacity)
+    {
+        while (engine->GetModuleCount() > 0)
+            engine->DiscardModule(engine->GetModuleByIndex(0)->GetName());
+    }
+
+    // Load the bytecode of the strategy if another thread or run already compiled it.
+    const string path = bytecode_path(engine, bytecodeCacheDirectory, strategyProgram);
+    if (load_bytecode(engine, path, moduleName))
+    {
+        asIScriptFunction* func = execute_function(engine->GetModule(moduleName.c_str(), asGM_ONLY_IF_EXISTS));
+        if (func != nullptr)
+            return func;
+
+        engine->DiscardModule(moduleName.c_str());
     }
 
+    compiled_strategy_count++;
+    asIScriptFunction* func = compileAngelscriptStrategy(engine, strategyProgram, moduleName);
+    if (func == nullptr)
+        engine->DiscardModule(moduleName.c_str());
+    else
+        save_bytecode(func->GetModule(), path);
+
+    return func;
+}
+
+vector<asIScriptFunction*> Evaluator::cachedAngelscriptStrategies(asIScriptEngine* engine,
+                                                                  const vector<string>& programs) const
+{
+    if (engine == nullptr)
+        return vector<asIScriptFunction*>(programs.size(), nullptr);
+
+    // The cache grows to hold the whole batch. If the missing programs do not fit, it is emptied before compiling
+    // them, so that no function of the batch is discarded while the others are compiled.
+    const unsigned capacity = max(max_cached_strategies, (unsigned) programs.size());
+    set<string> missing;
+    for (const string& program : programs)
+    {
+        const string moduleName = strategy_module_name(program);
+        if (engine->GetModule(moduleName.c_str(), asGM_ONLY_IF_EXISTS) == nullptr)
+            missing.insert(moduleName);
+    }
+    if (engine->GetModuleCount() + missing.size() > capacity)
+    {
+        while (engine->GetModuleCount() > 0)
+            engine->DiscardModule(engine->GetModuleByIndex(0)->GetName());
+    }
+
+    vector<asIScriptFunction*> functions;
+    for (const string& program : programs)
+        functions.push_back(cachedAngelscriptStrategy(engine, program, capacity));
+
+    return functions;
+}
+
+size_t Evaluator::CompiledStrategyCount() noexcept
+{
+    return compiled_strategy_count;
+}
+
+bool Evaluator::executeAngelscriptStrategy(asIScriptContext* ctx, asIScriptFunction* func, const string& stock,
+                                           int dayIndex)
+{
+    // Preparing a context again with the same function takes the fast path of AngelScript, which keeps the stack
+    // and the function setup.
+    if (ctx == nullptr || ctx->Prepare(func) < 0)
+        return false;
+
+    ctx->SetArgAddress(0, const_cast<string*>(&stock));
+    ctx->SetArgDWord(1, dayIndex);
+
+    // Call to null value during execution
+    if (ctx->Execute() != asEXECUTION_FINISHED)
+        return false;
+
     // Retrieve the return value from the context
-    const bool returnValue = ctx->GetReturnByte();
-    ctx->Release();
+    return ctx->GetReturnByte();
+}
 
-    asThreadCleanup();
+double Evaluator::executeAngelscriptScore(asIScriptContext* ctx, asIScriptFunction* func, const string& stock,
+                                          int dayIndex)
+{
+    if (ctx == nullptr || ctx->Prepare(func) < 0)
+        return numeric_limits<double>::quiet_NaN();
 
-    return returnValue;
+    ctx->SetArgAddress(0, const_cast<string*>(&stock));
+    ctx->SetArgDWord(1, dayIndex);
+
+    // Bars that raise an exception have no score.
+    if (ctx->Execute() != asEXECUTION_FINISHED)
+        return numeric_limits<double>::quiet_NaN();
+
+    return ctx->GetReturnDouble();
 }
 
 /**********************************
 *  Strategy function evaluation   *
 **********************************/
 
-vector<bool> Evaluator::RunStrategy(const string& strategyProgram, const string& stock)
+void Evaluator::EnableNativeCompilation(const string& cacheDirectory)
 {
-    vector<bool> strategyResults;
-    const unsigned timePoints = (unsigned) Dates(stock).size();
+    nativeCompilationDirectory = cacheDirectory;
+}
 
-    // Create the script engine
-    string strategyFunction = strategyToFunction(strategyProgram);
-    asIScriptEngine* engine = startAngelscriptEngine();
-    asIScriptFunction* func = compileAngelscriptStrategy(engine, strategyFunction);
+void Evaluator::DisableNativeCompilation() noexcept
+{
+    nativeCompilationDirectory.clear();
+}
+
+bool Evaluator::IsNativeStrategy(const string& strategyProgram)
+{
+    StrategyExpression expression;
+    return StrategyExpression::TryCompile(strategyProgram, expression);
+}
+
+/// Strategy programs prepared for evaluation: the native ones are compiled, and the rest are translated to the
+/// functions compiled by the scripting engine of each thread.
+struct Evaluator::StrategyBatch
+{
+    vector<StrategyExpression> expressions;
+    vector<bool> isNative;
+    vector<NativeStrategy> compiled;
+    vector<bool> isCompiled;
+    vector<string> scriptFunctions;
+    StrategyExpressionBatch shared;
+    vector<size_t> sharedIndexes;
+};
+
+Evaluator::StrategyBatch Evaluator::prepareStrategyBatch(const vector<string>& strategyPrograms) const
+{
+    StrategyBatch batch;
+    const size_t count = strategyPrograms.size();
+    batch.expressions.resize(count);
+    batch.isNative.resize(count);
+    batch.compiled.resize(count);
+    batch.isCompiled.resize(count);
+    batch.scriptFunctions.resize(count);
+    batch.sharedIndexes.resize(count);
 
-    for (int i = 0; i < timePoints; i++)
+    for (size_t i = 0; i < count; i++)
     {
-        bool result = executeAngelscriptStrategy(engine, func, stock, i);
-        strategyResults.push_back(result);
+        batch.isNative[i] = StrategyExpression::TryCompile(strategyPrograms[i], batch.expressions[i]);
+        if (batch.isNative[i] && !nativeCompilationDirectory.empty())
+            batch.isCompiled[i] = NativeStrategy::TryLoad(batch.expressions[i], nativeCompilationDirectory,
+                                                          batch.compiled[i]);
+
+        // The rest of the native programs share the evaluation of their predicates.
+        if (batch.isNative[i] && !batch.isCompiled[i])
+            batch.sharedIndexes[i] = batch.shared.Add(batch.expressions[i]);
+
+        // Native programs may still need the scripting engine for stocks that lack one of their indicators.
+        batch.scriptFunctions[i] = strategyToBoundFunction(strategyPrograms[i]);
     }
 
-    engine->ShutDownAndRelease();
+    return batch;
+}
+
+vector<size_t> Evaluator::runNativeStrategies(const StrategyBatch& batch, const string& stock,
+                                              vector<Signal>& strategyResults) const
+{
+    // Native programs are evaluated over whole series. Returns the programs left to the scripting engine.
+    const StockData& data = stockData(stock);
+    vector<Signal> sharedResults;
+    vector<bool> sharedEvaluated;
+    if (batch.shared.Size() > 0)
+        batch.shared.Evaluate(data, sharedResults, sharedEvaluated);
+
+    vector<size_t> scripts;
+    strategyResults.resize(batch.expressions.size());
+    for (size_t i = 0; i < batch.expressions.size(); i++)
+    {
+        bool evaluated = false;
+        if (batch.isCompiled[i])
+        {
+            evaluated = batch.compiled[i].TryEvaluate(data, strategyResults[i]) ||
+                        batch.expressions[i].TryEvaluate(data, strategyResults[i]);
+        }
+        else if (batch.isNative[i] && sharedEvaluated[batch.sharedIndexes[i]])
+        {
+            strategyResults[i] = std::move(sharedResults[batch.sharedIndexes[i]]);
+            evaluated = true;
+        }
+
+        if (!evaluated)
+        {
+            strategyResults[i] = Signal(data.dates.size());
+            scripts.push_back(i);
+        }
+    }
+
+    return scripts;
+}
+
+void Evaluator::runScriptStrategies(const StrategyBatch& batch, const vector<size_t>& scripts, const string& stock,
+                                    int begin, int end, vector<Signal>& strategyResults) const
+{
+    // The programs are compiled once by the engine of this thread, bound to the stock and run bar by bar, each one
+    // with its own context so that every context keeps the fast path of preparing the same function.
+    vector<string> programs;
+    for (size_t i : scripts)
+        programs.push_back(batch.scriptFunctions[i]);
+
+    const ActiveEvaluatorScope scope(this);
+    asIScriptEngine* engine = threadAngelscriptEngine();
+    const vector<asIScriptFunction*> functions = cachedAngelscriptStrategies(engine, programs);
+    vector<asIScriptContext*> contexts;
+    for (asIScriptFunction* func : functions)
+    {
+        bindSeriesHandles(func, stock);
+        contexts.push_back(engine != nullptr ? engine->RequestContext() : nullptr);
+    }
+
+    for (int t = begin; t < end; t++)
+    {
+        for (size_t s = 0; s < scripts.size(); s++)
+        {
+            if (executeAngelscriptStrategy(contexts[s], functions[s], stock, t))
+                strategyResults[scripts[s]].Set(size_t(t), true);
+        }
+    }
+
+    for (asIScriptContext* ctx : contexts)
+    {
+        if (ctx != nullptr)
+            engine->ReturnContext(ctx);
+    }
+}
+
+/****************************
+*       Signal cache        *
+****************************/
+
+/// Number of bars before the cached length of a stock that are evaluated again. The last bars of a program that reads
+/// up to this many bars ahead raised an exception and were cached as false, but they can be true once bars are appended.
+/// Programs that may read further ahead are not cached.
+constexpr size_t signal_cache_margin = Signal::wordBits;
+
+/// Signals of a program over the first bars of a stock, saved in the signal cache. The history of the stock is recorded
+/// by the running hash of its dates and of each of its stored series, at the cached length and at a checkpoint
+/// signal_cache_margin bars before it. Both are checked against the current history before the signals are used.
+struct Evaluator::SignalRecord
+{
+    uint64_t timePoints = 0;
+    uint64_t layout = 0;
+    uint64_t checkpoint = 0;
+    vector<uint64_t> checkpointHashes;
+    vector<uint64_t> hashes;
+    vector<Signal::Word> words;
+
+    template<class Archive>
+    void serialize(Archive& archive)
+    {
+        archive(timePoints, layout, checkpoint, checkpointHashes, hashes, words);
+    }
+};
+
+uint64_t mix_fingerprint(uint64_t x)
+{
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+uint64_t string_fingerprint(uint64_t h, const string& text)
+{
+    for (char c : text)
+        h = (h ^ (unsigned char) c) * 0x100000001b3ULL;
+    return mix_fingerprint(h);
+}
+
+/// Stored series of a stock, each one a row of time points.
+array<const vector<SeriesValue>*, 4> stored_series(const StockData& data)
+{
+    return { &data.indicatorValues, &data.quantileValues, &data.percentileRankValues, &data.derivedValues };
+}
+
+/// Fingerprint of the shape of the stored series: their storage type, their number and the derived indicator names.
+uint64_t layout_fingerprint(const StockData& data)
+{
+    uint64_t h = mix_fingerprint(sizeof(SeriesValue));
+    for (const vector<SeriesValue>* values : stored_series(data))
+        h = mix_fingerprint(h ^ (data.dates.empty() ? 0 : values->size() / data.dates.size()));
+    for (const string& name : data.derivedNames)
+        h = string_fingerprint(h, name);
+
+    return h;
+}
+
+/// Running hashes of no bars: one for the dates and one for each stored series.
+vector<uint64_t> initial_row_hashes(const StockData& data)
+{
+    size_t rows = 1;
+    for (const vector<SeriesValue>* values : stored_series(data))
+        rows += data.dates.empty() ? 0 : values->size() / data.dates.size();
+
+    vector<uint64_t> hashes(rows);
+    for (size_t row = 0; row < rows; row++)
+        hashes[row] = mix_fingerprint(row);
+
+    return hashes;
+}
+
+/// Extend the running hashes of the dates and of each stored series with the bars [from, to).
+void extend_row_hashes(const StockData& data, size_t from, size_t to, vector<uint64_t>& hashes)
+{
+    for (size_t t = from; t < to; t++)
+        hashes[0] = string_fingerprint(hashes[0], data.dates[t]);
+
+    const size_t timePoints = data.dates.size();
+    size_t row = 1;
+    for (const vector<SeriesValue>* values : stored_series(data))
+    {
+        for (size_t offset = 0; timePoints > 0 && offset < values->size(); offset += timePoints, row++)
+        {
+            for (size_t t = from; t < to; t++)
+            {
+                uint64_t bits = 0;
+                memcpy(&bits, &(*values)[offset + t], sizeof(SeriesValue));
+                hashes[row] = mix_fingerprint(hashes[row] ^ bits);
+            }
+        }
+    }
+}
+
+/// Bars of the checkpoint of a history.
+size_t signal_checkpoint(size_t timePoints)
+{
+    return timePoints > signal_cache_margin ? timePoints - signal_cache_margin : 0;
+}
+
+/// Top-level arguments of the call whose opening parenthesis is at a position, without surrounding whitespace.
+vector<string> call_arguments(const string& text, size_t open)
+{
+    vector<string> arguments;
+    auto addArgument = [&](size_t begin, size_t end) {
+        while (begin < end && isspace((unsigned char) text[begin]))
+            begin++;
+        while (end > begin && isspace((unsigned char) text[end - 1]))
+            end--;
+        arguments.push_back(text.substr(begin, end - begin));
+    };
+
+    int depth = 0;
+    bool inString = false;
+    size_t argumentBegin = open + 1;
+    for (size_t p = open + 1; p < text.size(); p++)
+    {
+        const char c = text[p];
+        if (inString)
+        {
+            if (c == '\\')
+                p++;
+            else if (c == '"')
+                inString = false;
+        }
+        else if (c == '"')
+            inString = true;
+        else if (c == '(')
+            depth++;
+        else if (c == ')' && depth-- == 0)
+        {
+            addArgument(argumentBegin, p);
+            break;
+        }
+        else if (c == ',' && depth == 0)
+        {
+            addArgument(argumentBegin, p);
+            argumentBegin = p + 1;
+        }
+    }
+
+    return arguments;
+}
+
+/// Programs that read another stock than the evaluated one depend on data that the hashes of the stock do not cover.
+/// They are those that pass any stock argument other than the stock identifier, and those that read the correlation
+/// matrix.
+bool reads_other_stocks(const string& strategyFunction)
+{
+    // Position of the stock argument of each function of the scripting interface that reads a stock.
+    static const map<string, size_t> stock_arguments {
+        { "Indicator", 1 }, { "Derived", 1 }, { "IndQuantile", 2 }, { "IndQuantileWindow", 3 }, { "RollingMean", 2 },
+        { "RollingStd", 2 }, { "RollingVWAP", 1 }, { "IndPercentileRank", 1 }, { "GetSeries", 1 },
+        { "GetQuantileSeries", 2 }, { "GetPercentileRankSeries", 1 }
+    };
+
+    if (strategyFunction.find("RollingCorrelation") != string::npos ||
+        strategyFunction.find("RollingBeta") != string::npos)
+        return true;
+
+    for (size_t p = 0; p < strategyFunction.size(); p++)
+    {
+        if (!is_identifier_char(strategyFunction[p]) || (p > 0 && is_identifier_char(strategyFunction[p - 1])))
+            continue;
+
+        size_t end = p;
+        while (end < strategyFunction.size() && is_identifier_char(strategyFunction[end]))
+            end++;
+        const auto it = stock_arguments.find(strategyFunction.substr(p, end - p));
+
+        size_t open = end;
+        while (open < strategyFunction.size() && isspace((unsigned char) strategyFunction[open]))
+            open++;
+        if (it != stock_arguments.end() && open < strategyFunction.size() && strategyFunction[open] == '(')
+        {
+            const vector<string> arguments = call_arguments(strategyFunction, open);
+            if (arguments.size() <= it->second || arguments[it->second] != "stock")
+                return true;
+        }
+        p = end - 1;
+    }
+
+    return false;
+}
+
+/// Token of a program that starts at a position, after skipping whitespace: an identifier, a number or a single
+/// character. The position is moved past it.
+string next_token(const string& text, size_t& position)
+{
+    while (position < text.size() && isspace((unsigned char) text[position]))
+        position++;
+    if (position >= text.size())
+        return "";
+
+    const size_t begin = position;
+    if (is_identifier_char(text[position]))
+    {
+        while (position < text.size() && (is_identifier_char(text[position]) || text[position] == '.'))
+            position++;
+    }
+    else
+        position++;
+
+    return text.substr(begin, position - begin);
+}
+
+/// Programs that may read more than signal_cache_margin bars ahead have bars that can only be evaluated once more bars
+/// are appended, later than the margin evaluates them again. A time index is accepted when it is not an operand of
+/// another arithmetic operation than time - n, time + n with n up to the margin, division or remainder.
+bool reads_ahead(const string& strategyFunction)
+{
+    auto isInteger = [](const string& token) {
+        return !token.empty() && all_of(token.begin(), token.end(), [](char c) { return isdigit((unsigned char) c); });
+    };
+
+    string previous;
+    size_t position = 0;
+    while (true)
+    {
+        const string token = next_token(strategyFunction, position);
+        if (token.empty())
+            break;
+
+        if (token == "\"")
+        {
+            // Skip string literals.
+            while (position < strategyFunction.size() && strategyFunction[position] != '"')
+                position += strategyFunction[position] == '\\' ? 2 : 1;
+            position++;
+            previous = "\"";
+            continue;
+        }
+
+        if (token != "time")
+        {
+            previous = token;
+            continue;
+        }
+
+        if (previous == "+" || previous == "-" || previous == "*" || previous == "/")
+            return true;
+
+        size_t lookahead = position;
+        const string operation = next_token(strategyFunction, lookahead);
+        if (operation == "*")
+            return true;
+        if (operation == "+" || operation == "-")
+        {
+            const string offset = next_token(strategyFunction, lookahead);
+            const string following = next_token(strategyFunction, lookahead);
+            if (!isInteger(offset) || following == "+" || following == "-" ||
+                (operation == "+" && (stoull(offset.substr(0, 18)) > signal_cache_margin || following == "*" ||
+                                      following == "/" || following == "%" || following == "(")))
+                return true;
+        }
+        previous = token;
+    }
+
+    return false;
+}
+
+/// Programs whose cached signals stay valid when bars are appended to the stock.
+bool cacheable_program(const string& strategyFunction)
+{
+    return !reads_other_stocks(strategyFunction) && !reads_ahead(strategyFunction);
+}
+
+/// Path of the cached signals of a program over a stock.
+string signal_path(const string& directory, const string& strategyFunction, const string& stock)
+{
+    const string hash = digestpp::sha256().absorb(strategyFunction + "\n" + stock).hexdigest();
+    return FileSystem::FilenameJoin({ directory, "signals_" + hash + ".bin" });
+}
+
+void Evaluator::EnableSignalCache(const string& cacheDirectory)
+{
+    signalCacheDirectory = cacheDirectory;
+}
+
+void Evaluator::DisableSignalCache() noexcept
+{
+    signalCacheDirectory.clear();
+}
+
+int Evaluator::loadCachedSignals(const StrategyBatch& batch, const vector<size_t>& scripts, const string& stock,
+                                 vector<Signal>& strategyResults, SignalRecord& history) const
+{
+    const StockData& data = stockData(stock);
+    const size_t timePoints = data.dates.size();
+    if (signalCacheDirectory.empty() || scripts.empty())
+        return 0;
+
+    history = SignalRecord();
+    history.timePoints = timePoints;
+    history.layout = layout_fingerprint(data);
+    history.checkpoint = signal_checkpoint(timePoints);
+
+    // The running hashes of the whole history are computed in a single pass, and kept at the lengths of interest.
+    map<size_t, vector<uint64_t>> hashesAt { { history.checkpoint, {} }, { timePoints, {} } };
+    auto hashHistory = [&]() {
+        vector<uint64_t> hashes = initial_row_hashes(data);
+        size_t length = 0;
+        for (auto& [stop, stopHashes] : hashesAt)
+        {
+            extend_row_hashes(data, length, stop, hashes);
+            stopHashes = hashes;
+            length = stop;
+        }
+        history.checkpointHashes = hashesAt.at(history.checkpoint);
+        history.hashes = hashesAt.at(timePoints);
+    };
+
+    // Without cached signals for every program, the whole history is evaluated.
+    auto evaluateAll = [&]() {
+        hashHistory();
+        return 0;
+    };
+
+    vector<SignalRecord> records(scripts.size());
+    const size_t rows = initial_row_hashes(data).size();
+    for (size_t s = 0; s < scripts.size(); s++)
+    {
+        const string& strategyFunction = batch.scriptFunctions[scripts[s]];
+        const string path = signal_path(signalCacheDirectory, strategyFunction, stock);
+        if (!cacheable_program(strategyFunction) || !FileSystem::FileExist(path))
+            return evaluateAll();
+
+        SignalRecord& record = records[s];
+        try
+        {
+            ifstream file(path, ios::binary);
+            cereal::BinaryInputArchive archive(file);
+            archive(record);
+        }
+        catch (const exception&)
+        {
+            return evaluateAll();
+        }
+
+        const size_t words = (record.timePoints + Signal::wordBits - 1) / Signal::wordBits;
+        if (record.timePoints == 0 || record.timePoints > timePoints || record.words.size() != words ||
+            record.layout != history.layout || record.checkpoint != signal_checkpoint(record.timePoints) ||
+            record.hashes.size() != rows || record.checkpointHashes.size() != rows)
+            return evaluateAll();
+
+        hashesAt[record.checkpoint];
+        hashesAt[record.timePoints];
+    }
+
+    // Every cached bar, including revised ones far in the past, must be the same in the current history.
+    hashHistory();
+    for (const SignalRecord& record : records)
+    {
+        if (hashesAt.at(record.checkpoint) != record.checkpointHashes || hashesAt.at(record.timePoints) != record.hashes)
+            return 0;
+    }
+
+    // Bars from a margin before the shortest cached length are evaluated again, from the start of a word.
+    size_t begin = timePoints;
+    for (const SignalRecord& record : records)
+        begin = min<size_t>(begin, record.timePoints);
+    begin = begin > signal_cache_margin ? (begin - signal_cache_margin) / Signal::wordBits * Signal::wordBits : 0;
+
+    for (size_t s = 0; s < scripts.size(); s++)
+    {
+        const auto& words = records[s].words;
+        copy(words.begin(), words.begin() + (long) (begin / Signal::wordBits), strategyResults[scripts[s]].Data());
+    }
+
+    return (int) begin;
+}
+
+void Evaluator::saveCachedSignals(const StrategyBatch& batch, const vector<size_t>& scripts, const string& stock,
+                                  const vector<Signal>& strategyResults, const SignalRecord& history) const
+{
+    for (size_t s = 0; s < scripts.size(); s++)
+    {
+        const string& strategyFunction = batch.scriptFunctions[scripts[s]];
+        if (!cacheable_program(strategyFunction))
+            continue;
+
+        SignalRecord record = history;
+        record.words = strategyResults[scripts[s]].Words();
+        replace_file(signal_path(signalCacheDirectory, strategyFunction, stock), [&record](fstream& file) {
+            cereal::BinaryOutputArchive archive(file);
+            archive(record);
+            return true;
+        });
+    }
+}
+
+vector<Signal> Evaluator::runStrategyBatch(const StrategyBatch& batch, const string& stock) const
+{
+    vector<Signal> strategyResults;
+    const vector<size_t> scripts = runNativeStrategies(batch, stock, strategyResults);
+    if (scripts.empty())
+        return strategyResults;
+
+    SignalRecord history;
+    const int begin = loadCachedSignals(batch, scripts, stock, strategyResults, history);
+    const int end = (int) stockData(stock).dates.size();
+    runScriptStrategies(batch, scripts, stock, begin, end, strategyResults);
+    if (!signalCacheDirectory.empty() && begin < end)
+        saveCachedSignals(batch, scripts, stock, strategyResults, history);
 
     return strategyResults;
 }
 
-std::map<std::string, std::vector<bool>> Evaluator::RunStrategyAllStocks(const string &strategyProgram)
+Signal Evaluator::RunStrategy(const string& strategyProgram, const string& stock) const
+{
+    return runStrategyBatch(prepareStrategyBatch({ strategyProgram }), stock).front();
+}
+
+map<string, Signal> Evaluator::RunStrategyAllStocks(const string &strategyProgram) const
+{
+    return RunStrategiesAllStocks({ strategyProgram }).front();
+}
+
+/// Time range of the bars of a stock evaluated by one task.
+struct StrategyChunk
 {
-    // Create thread pool.
-    vector<string> stocks = GetStocksInDataset();
-    BS::thread_pool pool;
-    vector<future<vector<bool>>> results;
+    size_t stock;
+    int begin;
+    int end;
+};
 
-    asPrepareMultithread();
+/// Split the bars [begins[i], ends[i]) of the stocks into time ranges of about the same length, so that there are a few
+/// ranges per worker and the long histories do not keep a single worker busy while the others are idle.
+vector<StrategyChunk> split_strategy_chunks(const vector<int>& begins, const vector<int>& ends, size_t workers)
+{
+    size_t totalTimePoints = 0;
+    for (size_t i = 0; i < ends.size(); i++)
+        totalTimePoints += size_t(ends[i] - begins[i]);
 
-    // Push tasks to thread pool and wait for them to finish.
-    for (const auto& stock : stocks)
-        results.push_back(pool.submit(Evaluator::RunStrategy, strategyProgram, stock));
+    // Ranges are whole words of the packed signals, so that concurrent ranges of a stock write distinct words.
+    const size_t targetChunks = max<size_t>(1, workers) * chunks_per_worker;
+    size_t chunkSize = max(min_chunk_time_points, (totalTimePoints + targetChunks - 1) / targetChunks);
+    chunkSize = (chunkSize + Signal::wordBits - 1) / Signal::wordBits * Signal::wordBits;
 
-    pool.wait_for_tasks();
+    // Range bounds other than the first one of a stock are multiples of the chunk size.
+    vector<StrategyChunk> chunks;
+    for (size_t i = 0; i < ends.size(); i++)
+    {
+        for (int begin = begins[i]; begin < ends[i]; begin = (begin / (int) chunkSize + 1) * (int) chunkSize)
+            chunks.push_back({ i, begin, min(ends[i], (begin / (int) chunkSize + 1) * (int) chunkSize) });
+    }
 
-    // Return the results of the completed tasks.
-    map<string, vector<bool>> output;
+    return chunks;
+}
+
+vector<map<string, Signal>> Evaluator::RunStrategiesAllStocks(const vector<string>& strategyPrograms) const
+{
+    const StrategyBatch batch = prepareStrategyBatch(strategyPrograms);
+    prepare_script_multithread();
+
+    // Evaluate the native programs, one task per stock.
+    vector<vector<Signal>> results(stocks.size());
+    vector<vector<size_t>> scripts(stocks.size());
+    WorkerPool::ParallelFor(stocks.size(), [this, &batch, &results, &scripts](size_t i) {
+        scripts[i] = runNativeStrategies(batch, stocks[i], results[i]);
+    });
+
+    // Evaluate the programs of the scripting engine in time ranges, which write directly in the signals of the stock.
+    // With the signal cache, only the bars appended since the cached signals were saved are evaluated.
+    vector<int> begins(stocks.size(), 0);
+    vector<int> timePoints(stocks.size(), 0);
+    vector<SignalRecord> histories(stocks.size());
+    WorkerPool::ParallelFor(stocks.size(), [&](size_t i) {
+        if (!scripts[i].empty())
+        {
+            timePoints[i] = (int) stockData(stocks[i]).dates.size();
+            begins[i] = loadCachedSignals(batch, scripts[i], stocks[i], results[i], histories[i]);
+        }
+    });
+
+    const vector<StrategyChunk> chunks = split_strategy_chunks(begins, timePoints, WorkerPool::ThreadCount());
+    WorkerPool::ParallelFor(chunks.size(), [this, &batch, &scripts, &chunks, &results](size_t c) {
+        const StrategyChunk& chunk = chunks[c];
+        runScriptStrategies(batch, scripts[chunk.stock], stocks[chunk.stock], chunk.begin, chunk.end,
+                            results[chunk.stock]);
+    });
+
+    if (!signalCacheDirectory.empty())
+    {
+        WorkerPool::ParallelFor(stocks.size(), [&](size_t i) {
+            if (begins[i] < timePoints[i])
+                saveCachedSignals(batch, scripts[i], stocks[i], results[i], histories[i]);
+        });
+    }
+
+    vector<map<string, Signal>> output(strategyPrograms.size());
     for (size_t i = 0; i < stocks.size(); i++)
-        output[stocks[i]] = results[i].get();
+    {
+        for (size_t p = 0; p < strategyPrograms.size(); p++)
+            output[p][stocks[i]] = std::move(results[i][p]);
+    }
+
+    return output;
+}
+
+StrategyProfile Evaluator::ProfileStrategy(const string& strategyProgram, const string& stock) const
+{
+    const StockData& data = stockData(stock);
+    const string strategyFunction = strategyToBoundFunction(strategyProgram);
+
+    // Programs run in an engine of their own, built with line cues and timed accessors.
+    asIScriptEngine* engine = startAngelscriptEngine(true);
+    if (engine == nullptr)
+        throw runtime_error("Couldn't start scripting engine.");
+
+    asIScriptFunction* func = compileAngelscriptStrategy(engine, strategyFunction, "ProfiledStrategy");
+    if (func == nullptr)
+    {
+        engine->ShutDownAndRelease();
+        throw invalid_argument("The strategy program could not be compiled.");
+    }
+
+    ScriptProfiler profiler;
+    asIScriptContext* ctx = engine->CreateContext();
+    ctx->SetLineCallback(asFUNCTION(profile_line_callback), &profiler, asCALL_CDECL);
+
+    StrategyProfile profile;
+    profile.stock = stock;
+    profile.bars = data.dates.size();
+    {
+        const ActiveEvaluatorScope scope(this);
+        bindSeriesHandles(func, stock);
+        active_profiler = &profiler;
+        const ScriptProfiler::Clock::time_point start = ScriptProfiler::Clock::now();
+        for (int t = 0; t < (int) profile.bars; t++)
+        {
+            executeAngelscriptStrategy(ctx, func, stock, t);
+            profiler.EndBar();
+        }
+        profile.seconds = chrono::duration<double>(ScriptProfiler::Clock::now() - start).count();
+        active_profiler = nullptr;
+    }
+    ctx->Release();
+    engine->ShutDownAndRelease();
+
+    // The program starts in the script line where the first part of the function ends.
+    const size_t programStart = strategyFunction.find(program_part_A) + program_part_A.size();
+    const auto programBegin = strategyFunction.begin() + (long) programStart;
+    const int firstLine = 1 + (int) count(strategyFunction.begin(), programBegin, '\n');
+    vector<string> sourceLines;
+    size_t position = 0;
+    while (true)
+    {
+        const size_t next = strategyProgram.find('\n', position);
+        sourceLines.push_back(strategyProgram.substr(position, next - position));
+        if (next == string::npos)
+            break;
+        position = next + 1;
+    }
+
+    // Lines of the function that wraps the program are left out.
+    for (const auto& [line, stats] : profiler.lines)
+    {
+        const int programLine = line - firstLine + 1;
+        if (programLine >= 1 && programLine <= (int) sourceLines.size())
+            profile.lines.push_back({ programLine, sourceLines[size_t(programLine - 1)], stats.first, stats.second });
+    }
+
+    for (size_t a = 0; a < profiler.accessors.size(); a++)
+    {
+        const auto& [calls, seconds] = profiler.accessors[a];
+        if (calls > 0)
+            profile.accessors.push_back({ script_accessor_names[a], calls, seconds });
+    }
+    sort(profile.accessors.begin(), profile.accessors.end(), [](const AccessorProfile& a, const AccessorProfile& b) {
+        return a.seconds > b.seconds;
+    });
+
+    return profile;
+}
+
+
+/****************************
+*    Scores and rankings    *
+****************************/
+
+void Evaluator::runScriptScore(const string& scoreFunction, const string& stock, int begin, int end,
+                               vector<double>& scores) const
+{
+    const ActiveEvaluatorScope scope(this);
+    asIScriptEngine* engine = threadAngelscriptEngine();
+    asIScriptFunction* func = cachedAngelscriptStrategies(engine, { scoreFunction }).front();
+    bindSeriesHandles(func, stock);
+    asIScriptContext* ctx = engine != nullptr ? engine->RequestContext() : nullptr;
 
-    asUnprepareMultithread();
+    for (int t = begin; t < end; t++)
+        scores[size_t(t)] = executeAngelscriptScore(ctx, func, stock, t);
+
+    if (ctx != nullptr)
+        engine->ReturnContext(ctx);
+}
+
+vector<double> Evaluator::RunScore(const string& scoreProgram, const string& stock) const
+{
+    const StockData& data = stockData(stock);
+    vector<double> scores;
+    StrategyExpression expression;
+    if (StrategyExpression::TryCompileScore(scoreProgram, expression) && expression.TryEvaluateScore(data, scores))
+        return scores;
+
+    scores.assign(data.dates.size(), numeric_limits<double>::quiet_NaN());
+    runScriptScore(scoreToBoundFunction(scoreProgram), stock, 0, (int) scores.size(), scores);
+    return scores;
+}
+
+map<string, vector<double>> Evaluator::RunScoreAllStocks(const string& scoreProgram) const
+{
+    StrategyExpression expression;
+    const bool isNative = StrategyExpression::TryCompileScore(scoreProgram, expression);
+    const string scoreFunction = scoreToBoundFunction(scoreProgram);
+    prepare_script_multithread();
+
+    // Evaluate the native scores, one task per stock, and the rest in time ranges of the scripting engine. Ranges of
+    // a stock write distinct positions of its scores.
+    vector<vector<double>> scores(stocks.size());
+    vector<int> timePoints(stocks.size(), 0);
+    WorkerPool::ParallelFor(stocks.size(), [&](size_t i) {
+        const StockData& data = stockData(stocks[i]);
+        if (!isNative || !expression.TryEvaluateScore(data, scores[i]))
+        {
+            scores[i].assign(data.dates.size(), numeric_limits<double>::quiet_NaN());
+            timePoints[i] = (int) data.dates.size();
+        }
+    });
+
+    const vector<StrategyChunk> chunks = split_strategy_chunks(vector<int>(stocks.size(), 0), timePoints,
+                                                               WorkerPool::ThreadCount());
+    WorkerPool::ParallelFor(chunks.size(), [&](size_t c) {
+        const StrategyChunk& chunk = chunks[c];
+        runScriptScore(scoreFunction, stocks[chunk.stock], chunk.begin, chunk.end, scores[chunk.stock]);
+    });
+
+    map<string, vector<double>> output;
+    for (size_t i = 0; i < stocks.size(); i++)
+        output[stocks[i]] = std::move(scores[i]);
 
     return output;
 }
 
+/// Score of a stock on a date, ordered by score and then by the order of the stocks, so that ties are selected in a
+/// deterministic order.
+struct RankedScore
+{
+    double score;
+    size_t stock;
+};
+
+map<string, Signal> Evaluator::selectRanked(const map<string, vector<double>>& scores, size_t k, bool lowest) const
+{
+    // Place the scores of every stock on the common calendar, the sorted union of their dates.
+    vector<const vector<double>*> stockScores;
+    vector<const vector<string>*> stockDates;
+    vector<string> calendar;
+    for (const auto& [stock, values] : scores)
+    {
+        const vector<string>& dates = stockData(stock).dates;
+        if (values.size() != dates.size())
+            throw invalid_argument("The scores of " + stock + " do not have one value per date.");
+
+        stockScores.push_back(&values);
+        stockDates.push_back(&dates);
+        calendar.insert(calendar.end(), dates.begin(), dates.end());
+    }
+    sort(calendar.begin(), calendar.end());
+    calendar.erase(unique(calendar.begin(), calendar.end()), calendar.end());
+
+    const size_t stockCount = stockScores.size();
+    vector<vector<size_t>> calendarIndexes(stockCount);
+    WorkerPool::ParallelFor(stockCount, [&](size_t s) {
+        const vector<string>& dates = *stockDates[s];
+        calendarIndexes[s].resize(dates.size());
+        for (size_t t = 0; t < dates.size(); t++)
+            calendarIndexes[s][t] = size_t(lower_bound(calendar.begin(), calendar.end(), dates[t]) - calendar.begin());
+    });
+
+    // Bucket the scores by date. NaN scores are never selected.
+    vector<size_t> offsets(calendar.size() + 1, 0);
+    for (size_t s = 0; s < stockCount; s++)
+    {
+        for (size_t t = 0; t < calendarIndexes[s].size(); t++)
+            offsets[calendarIndexes[s][t] + 1] += !std::isnan((*stockScores[s])[t]);
+    }
+    for (size_t d = 0; d < calendar.size(); d++)
+        offsets[d + 1] += offsets[d];
+
+    vector<RankedScore> buckets(offsets.back());
+    vector<size_t> fill(offsets.begin(), offsets.end() - 1);
+    for (size_t s = 0; s < stockCount; s++)
+    {
+        for (size_t t = 0; t < calendarIndexes[s].size(); t++)
+        {
+            const double score = (*stockScores[s])[t];
+            if (!std::isnan(score))
+                buckets[fill[calendarIndexes[s][t]]++] = { lowest ? -score : score, s };
+        }
+    }
+
+    // Find the k-th best score of each date in parallel. A stock is selected on a date if it is not worse than it, and
+    // every stock is selected on the dates with at most k scores.
+    auto better = [](const RankedScore& a, const RankedScore& b) {
+        return a.score > b.score || (a.score == b.score && a.stock < b.stock);
+    };
+    constexpr RankedScore none { -numeric_limits<double>::infinity(), numeric_limits<size_t>::max() };
+    vector<RankedScore> cutoffs(calendar.size(), none);
+    const size_t blockSize = max<size_t>(1, (calendar.size() + 63) / 64);
+    WorkerPool::ParallelFor((calendar.size() + blockSize - 1) / blockSize, [&](size_t b) {
+        for (size_t d = b * blockSize; d < min(calendar.size(), (b + 1) * blockSize); d++)
+        {
+            auto first = buckets.begin() + (long) offsets[d], last = buckets.begin() + (long) offsets[d + 1];
+            if (k > 0 && size_t(last - first) > k)
+            {
+                nth_element(first, first + (long) (k - 1), last, better);
+                cutoffs[d] = first[(long) (k - 1)];
+            }
+        }
+    });
+
+    // Mark the selected bars, one task per stock.
+    vector<Signal> signals(stockCount);
+    WorkerPool::ParallelFor(stockCount, [&](size_t s) {
+        const vector<double>& values = *stockScores[s];
+        signals[s] = Signal(values.size());
+        for (size_t t = 0; t < values.size(); t++)
+        {
+            const RankedScore ranked { lowest ? -values[t] : values[t], s };
+            if (k > 0 && !std::isnan(values[t]) && !better(cutoffs[calendarIndexes[s][t]], ranked))
+                signals[s].Set(t, true);
+        }
+    });
+
+    map<string, Signal> output;
+    size_t s = 0;
+    for (const auto& [stock, values] : scores)
+        output[stock] = std::move(signals[s++]);
+
+    return output;
+}
+
+map<string, Signal> Evaluator::SelectTopK(const map<string, vector<double>>& scores, size_t k) const
+{
+    return selectRanked(scores, k, false);
+}
+
+map<string, Signal> Evaluator::SelectBottomK(const map<string, vector<double>>& scores, size_t k) const
+{
+    return selectRanked(scores, k, true);
+}
+
 
 /****************************
 *          Testing          *
 ****************************/
 
-std::pair<bool, std::string> Evaluator::ValidateStrategyProgram(const string& strategyProgram)
+std::pair<bool, std::string> Evaluator::ValidateStrategyProgram(const string& strategyProgram,
+                                                                const string& cacheDirectory)
 {
+    // Programs whose bytecode is in the cache were compiled before.
+    if (!cacheDirectory.empty())
+    {
+        asIScriptEngine* threadEngine = threadAngelscriptEngine();
+        const string path = threadEngine != nullptr ?
+                bytecode_path(threadEngine, cacheDirectory, strategyToBoundFunction(strategyProgram)) : string();
+        if (!path.empty() && FileSystem::FileExist(path))
+            return std::make_pair(true, "The strategy program is valid.");
+    }
+
     string strategyFunction = strategyToFunction(strategyProgram);
 
     // Create the script engine
@@ -342,10 +2100,10 @@ std::pair<bool, std::string> Evaluator::ValidateStrategyProgram(const string& st
         string log = "Error getting StrategyModule.";
         return std::make_pair(false, log + scriptingEngineProgram(strategyFunction));
     }
-    const asIScriptFunction* func = mod->GetFunctionByDecl("bool execute(string, int)");
+    const asIScriptFunction* func = mod->GetFunctionByDecl(strategy_declaration);
     if (func == nullptr)
     {
-        string log = scriptingEngineLogStr("The script must have the function 'bool execute(string, int)'.");
+        string log = scriptingEngineLogStr("The script must have the function '" + string(strategy_declaration) + "'.");
         return std::make_pair(false, log + scriptingEngineProgram(strategyFunction));
     }
 
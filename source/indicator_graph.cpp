@@ -0,0 +1,107 @@
+#include <stdexcept>
+#include "indicator_graph.h"
+using namespace std;
+using namespace backtester;
+
+/****************************
+*      Graph definition     *
+****************************/
+
+void IndicatorGraph::AddNode(IndicatorNode node)
+{
+    if (HasNode(node.name))
+        throw invalid_argument("Indicator node " + node.name + " is already defined.");
+
+    nodeIndex[node.name] = nodes.size();
+    nodes.push_back(std::move(node));
+}
+
+bool IndicatorGraph::HasNode(const string& name) const
+{
+    return nodeIndex.find(name) != nodeIndex.end();
+}
+
+vector<string> IndicatorGraph::NodeNames() const
+{
+    vector<string> names;
+    names.reserve(nodes.size());
+    for (const IndicatorNode& node : nodes)
+        names.push_back(node.name);
+
+    return names;
+}
+
+/****************************
+*     Graph evaluation      *
+****************************/
+
+enum class VisitState
+{
+    Unvisited, Visiting, Visited
+};
+
+/// Depth-first post-order traversal. A node reached while it is still being visited closes a cycle.
+void visit_node(const vector<IndicatorNode>& nodes, const unordered_map<string, size_t>& nodeIndex,
+                size_t node, vector<VisitState>& state, vector<string>& order)
+{
+    if (state[node] == VisitState::Visited)
+        return;
+    if (state[node] == VisitState::Visiting)
+        throw runtime_error("Indicator graph has a cycle through " + nodes[node].name + ".");
+
+    state[node] = VisitState::Visiting;
+    for (const string& input : nodes[node].inputs)
+    {
+        auto it = nodeIndex.find(input);
+        if (it == nodeIndex.end())
+            throw runtime_error("Indicator " + nodes[node].name + " depends on undefined indicator " + input + ".");
+
+        visit_node(nodes, nodeIndex, it->second, state, order);
+    }
+    state[node] = VisitState::Visited;
+    order.push_back(nodes[node].name);
+}
+
+vector<string> IndicatorGraph::TopologicalOrder(const vector<string>& targets) const
+{
+    vector<VisitState> state(nodes.size(), VisitState::Unvisited);
+    vector<string> order;
+
+    if (targets.empty())
+    {
+        for (size_t i = 0; i < nodes.size(); i++)
+            visit_node(nodes, nodeIndex, i, state, order);
+    }
+    else
+    {
+        for (const string& target : targets)
+        {
+            auto it = nodeIndex.find(target);
+            if (it == nodeIndex.end())
+                throw runtime_error("Requested undefined indicator " + target + ".");
+
+            visit_node(nodes, nodeIndex, it->second, state, order);
+        }
+    }
+
+    return order;
+}
+
+Indicators IndicatorGraph::Evaluate(const vector<OCHLVData>& rawData, const vector<string>& targets) const
+{
+    Indicators series;
+    for (const string& name : TopologicalOrder(targets))
+    {
+        const IndicatorNode& node = nodes[nodeIndex.at(name)];
+
+        // Inputs were evaluated earlier in the topological order, so they are only looked up here.
+        IndicatorNode::Inputs inputs;
+        inputs.reserve(node.inputs.size());
+        for (const string& input : node.inputs)
+            inputs.push_back(&series.at(input));
+
+        series[name] = node.compute(rawData, inputs);
+    }
+
+    return series;
+}
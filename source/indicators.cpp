@@ -1,5 +1,7 @@
 #include "indicators.h"
+#include <array>
 #include "vector_ops.h"
+#include "fenwick_tree.h"
 using namespace std;
 using namespace backtester;
 
@@ -57,71 +59,109 @@ double Indicator::ExtensionRatio(const OCHLVData& data)
 }
 double Indicator::EMA(const OCHLVData& data, double previous)
 {
-    const double alpha = 2.0 / (windowSize + 1.0);
-    return alpha * (data.close - previous) + previous;
+    return EMA(data.close, previous);
 }
 double Indicator::RSI(const vector<OCHLVData>& data)
 {
-    vector<double> returns;
-    for (unsigned i = 0; i < data.size() - 1; i++)
-        returns.push_back(data[i + 1].close - data[i].close);
+    const vector<double> close = IndicatorTimeSeries(ClosePrice, data);
+    return RSI(close.data(), close.size());
+}
+double Indicator::VWAP(const vector<OCHLVData>& data)
+{
+    const vector<double> close = IndicatorTimeSeries(ClosePrice, data);
+    const vector<double> volume = IndicatorTimeSeries(TradingVolume, data);
+    return VWAP(close.data(), volume.data(), data.size());
+}
+double Indicator::SMA(const vector<OCHLVData>& data)
+{
+    const vector<double> close = IndicatorTimeSeries(ClosePrice, data);
+    return SMA(close.data(), close.size());
+}
+double Indicator::OBV(const vector<OCHLVData>& data)
+{
+    const vector<double> close = IndicatorTimeSeries(ClosePrice, data);
+    const vector<double> volume = IndicatorTimeSeries(TradingVolume, data);
+    return OBV(close.data(), volume.data(), data.size());
+}
+double Indicator::ROC(const vector<OCHLVData>& data)
+{
+    const vector<double> close = IndicatorTimeSeries(ClosePrice, data);
+    return ROC(close.data(), close.size());
+}
+double Indicator::MFI(const vector<OCHLVData>& data)
+{
+    const vector<double> typicalPrice = IndicatorTimeSeries(TypicalPrice, data);
+    const vector<double> volume = IndicatorTimeSeries(TradingVolume, data);
+    return MFI(typicalPrice.data(), volume.data(), data.size());
+}
+
+double Indicator::EMA(double close, double previous)
+{
+    const double alpha = 2.0 / (windowSize + 1.0);
+    return alpha * (close - previous) + previous;
+}
+double Indicator::SMA(const double* close, size_t size)
+{
+    double sum = 0.0;
+    for (size_t i = 0; i < size; i++)
+        sum += close[i];
 
-    const auto u = (unsigned) count_if(returns.begin(), returns.end(), [](double r) {return r >= 0.0; });
-    const auto d = (unsigned) count_if(returns.begin(), returns.end(), [](double r) {return r < 0.0; });
+    return sum / ((double) size);
+}
+double Indicator::RSI(const double* close, size_t size)
+{
+    unsigned u = 0, d = 0;
+    for (size_t i = 0; i + 1 < size; i++)
+    {
+        const double r = close[i + 1] - close[i];
+        if (r >= 0.0)
+            u++;
+        else if (r < 0.0)
+            d++;
+    }
 
     return 100.0 - (100.0 / (1.0 + ((double)u / (double)d)));
 }
-double Indicator::VWAP(const vector<OCHLVData>& data)
+double Indicator::VWAP(const double* close, const double* volume, size_t size)
 {
     double weightedPrice = 0.0;
     double accumulatedVolume = 0.0;
 
-    for (auto& datapoint : data)
+    for (size_t i = 0; i < size; i++)
     {
-        weightedPrice += datapoint.close * datapoint.volume;
-        accumulatedVolume += datapoint.volume;
+        weightedPrice += close[i] * volume[i];
+        accumulatedVolume += volume[i];
     }
 
     return weightedPrice / accumulatedVolume;
 }
-double Indicator::SMA(const vector<OCHLVData>& data)
-{
-    double sum = 0.0;
-    for (auto& datapoint : data)
-        sum += datapoint.close;
-
-    return sum / ((double) data.size());
-}
-double Indicator::OBV(const vector<OCHLVData>& data)
+double Indicator::OBV(const double* close, const double* volume, size_t size)
 {
     double obv = 0.0;
-    for (unsigned i = 1; i < data.size(); i++)
+    for (size_t i = 1; i < size; i++)
     {
-        if (data[i].close > data[i - 1].close)
-            obv += data[i].volume;
-        else if (data[i].close < data[i - 1].close)
-            obv -= data[i].volume;
+        if (close[i] > close[i - 1])
+            obv += volume[i];
+        else if (close[i] < close[i - 1])
+            obv -= volume[i];
     }
     return obv;
 }
-double Indicator::ROC(const vector<OCHLVData>& data)
+double Indicator::ROC(const double* close, size_t size)
 {
-    return 100.0 * ((data.back().close - data.front().close) / data.front().close);
+    return 100.0 * ((close[size - 1] - close[0]) / close[0]);
 }
-double Indicator::MFI(const vector<OCHLVData>& data)
+double Indicator::MFI(const double* typicalPrice, const double* volume, size_t size)
 {
     double positiveMoneyFlow = 0.0;
     double negativeMoneyFlow = 0.0;
 
-    for (unsigned i = 1; i < data.size(); i++)
+    for (size_t i = 1; i < size; i++)
     {
-        double todayTP = TypicalPrice(data[i]);
-        double yesterdayTP = TypicalPrice(data[i - 1]);
-
-        if (todayTP > yesterdayTP)
-            positiveMoneyFlow += todayTP * data[i].volume;
+        if (typicalPrice[i] > typicalPrice[i - 1])
+            positiveMoneyFlow += typicalPrice[i] * volume[i];
         else
-            negativeMoneyFlow += todayTP * data[i].volume;
+            negativeMoneyFlow += typicalPrice[i] * volume[i];
     }
 
     if (negativeMoneyFlow != 0.0)
@@ -135,62 +175,327 @@ double Indicator::MFI(const vector<OCHLVData>& data)
 }
 
 /****************************
-*   Indicator calculation   *
+*   Quantile calculation    *
 ****************************/
 
-Indicators Indicator::CalculateIndicators(const vector<OCHLVData>& rawData)
+vector<double> Indicator::RollingPercentileRank(const vector<double>& series, unsigned window)
+{
+    // Coordinate-compress the values so that the Fenwick tree counts occurrences per distinct value.
+    vector<double> distinctValues;
+    distinctValues.reserve(series.size());
+    for (double value : series)
+    {
+        if (!std::isnan(value))
+            distinctValues.push_back(value);
+    }
+    sort(distinctValues.begin(), distinctValues.end());
+    distinctValues.erase(unique(distinctValues.begin(), distinctValues.end()), distinctValues.end());
+
+    auto coordinate = [&distinctValues](double value) {
+        return (size_t) (lower_bound(distinctValues.begin(), distinctValues.end(), value) - distinctValues.begin());
+    };
+
+    FenwickTree<int> counts(distinctValues.size());
+    int windowCount = 0;
+
+    vector<double> ranks;
+    ranks.reserve(series.size());
+    for (size_t i = 0; i < series.size(); i++)
+    {
+        // Slide the window: evict the value that falls out of it and insert the current one.
+        if (window > 0 && i >= window && !std::isnan(series[i - window]))
+        {
+            counts.Add(coordinate(series[i - window]), -1);
+            windowCount--;
+        }
+
+        if (std::isnan(series[i]))
+        {
+            ranks.push_back(numeric_limits<double>::quiet_NaN());
+            continue;
+        }
+
+        const size_t c = coordinate(series[i]);
+        counts.Add(c, 1);
+        windowCount++;
+
+        const int below = counts.PrefixSum(c);
+        const int equal = counts.PrefixSum(c + 1) - below;
+        ranks.push_back((below + 0.5 * equal) / windowCount);
+    }
+
+    return ranks;
+}
+
+vector<double> Indicator::RollingQuantileSketch(const vector<double>& series, double percentile, unsigned window,
+                                                unsigned bins)
+{
+    vector<double> quantileTimeSeries;
+    if (window == 0 || bins == 0 || series.size() <= window)
+        return quantileTimeSeries;
+
+    // Infinite values would make the bins infinitely wide, so the range and the counts only cover the finite ones.
+    double minimum = numeric_limits<double>::infinity(), maximum = -numeric_limits<double>::infinity();
+    for (double value : series)
+    {
+        if (std::isfinite(value))
+        {
+            minimum = std::min(minimum, value);
+            maximum = std::max(maximum, value);
+        }
+    }
+
+    const double binWidth = (maximum - minimum) / bins;
+    auto bin = [&](double value) {
+        return binWidth > 0.0 ? std::min(size_t((value - minimum) / binWidth), size_t(bins - 1)) : size_t(0);
+    };
+
+    FenwickTree<int> counts(bins);
+    int windowCount = 0;
+    auto update = [&](double value, int delta) {
+        if (std::isfinite(value))
+        {
+            counts.Add(bin(value), delta);
+            windowCount += delta;
+        }
+    };
+
+    // Same windows as RollingQuantile: [i, i + window) for every i such that i + window < size.
+    for (size_t i = 0; i < window; i++)
+        update(series[i], 1);
+
+    quantileTimeSeries.reserve(series.size() - window);
+    for (size_t i = 0; i + window < series.size(); i++)
+    {
+        if (i > 0)
+        {
+            update(series[i - 1], -1);
+            update(series[i + window - 1], 1);
+        }
+
+        if (windowCount == 0)
+        {
+            quantileTimeSeries.push_back(numeric_limits<double>::quiet_NaN());
+            continue;
+        }
+
+        // Same order statistic as CalculateQuantile.
+        const double poi = Lerp<double>(-0.5, windowCount - 0.5, percentile);
+        const int k = std::min(std::max(int(std::floor(poi)), 0), windowCount - 1);
+        const size_t b = counts.UpperBound(k);
+        quantileTimeSeries.push_back(binWidth > 0.0 ? minimum + (double(b) + 0.5) * binWidth : minimum);
+    }
+
+    return quantileTimeSeries;
+}
+
+/****************************
+*     Indicator graph       *
+****************************/
+
+/// Technical indicator exported to StockData together with the number of leading values dropped to align it with
+/// the dates. Instant indicators are dropped by two windows, windowed ones by one since they already start one window
+/// late. Quantiles consume one more window than their indicator, so they are dropped by one window less.
+struct ExportedIndicator
+{
+    IndicatorId id;
+    int drop;
+
+    [[nodiscard]] string Name() const
+    {
+        return string(IndicatorRegistry::Name(id));
+    }
+};
+
+const array<ExportedIndicator, IndicatorRegistry::indicatorCount> exportedIndicators {{
+        { IndicatorId::OpenPrice, 2 * windowSize },
+        { IndicatorId::ClosePrice, 2 * windowSize },
+        { IndicatorId::HighPrice, 2 * windowSize },
+        { IndicatorId::LowPrice, 2 * windowSize },
+        { IndicatorId::TradingVolume, 2 * windowSize },
+        { IndicatorId::WeightedClose, 2 * windowSize },
+        { IndicatorId::TypicalPrice, 2 * windowSize },
+        { IndicatorId::MedianPrice, 2 * windowSize },
+        { IndicatorId::PricePercentageChangeOpenToClose, 2 * windowSize },
+        { IndicatorId::ClosingBias, 2 * windowSize },
+        { IndicatorId::ExtensionRatio, 2 * windowSize },
+        { IndicatorId::SMA, windowSize },
+        { IndicatorId::EMA, 2 * windowSize },
+        { IndicatorId::RSI, windowSize },
+        { IndicatorId::VWAP, windowSize },
+        { IndicatorId::OBV, windowSize },
+        { IndicatorId::ROC, windowSize },
+        { IndicatorId::MFI, windowSize }
+}};
+
+/// Evaluates f(begin, end) over every window of the series, matching IndicatorTimeSeries over OCHLVData windows.
+IndicatorNode instant_node(const string& name, double (*TechIndFunction)(const OCHLVData&))
+{
+    return { name, {}, [TechIndFunction](const vector<OCHLVData>& rawData, const IndicatorNode::Inputs&) {
+        return Indicator::IndicatorTimeSeries(TechIndFunction, rawData);
+    }};
+}
+
+/// Node of a windowed indicator of one series, evaluated over every window of windowSize values of it.
+IndicatorNode windowed_node(const string& name, const string& input, double (*TechIndFunction)(const double*, size_t))
+{
+    return { name, { input }, [TechIndFunction](const vector<OCHLVData>&, const IndicatorNode::Inputs& in) {
+        vector<double> output;
+        for (size_t i = 0; i + windowSize < in[0]->size(); i++)
+            output.push_back(TechIndFunction(in[0]->data() + i, windowSize));
+
+        return output;
+    }};
+}
+
+/// Node of a windowed indicator of two series of the same length.
+IndicatorNode windowed_node(const string& name, const string& first, const string& second,
+                            double (*TechIndFunction)(const double*, const double*, size_t))
+{
+    return { name, { first, second }, [TechIndFunction](const vector<OCHLVData>&, const IndicatorNode::Inputs& in) {
+        vector<double> output;
+        for (size_t i = 0; i + windowSize < in[0]->size(); i++)
+            output.push_back(TechIndFunction(in[0]->data() + i, in[1]->data() + i, windowSize));
+
+        return output;
+    }};
+}
+
+IndicatorGraph build_indicator_graph()
+{
+    IndicatorGraph graph;
+
+    // Instant indicators are the sources of the graph.
+    graph.AddNode(instant_node("OpenPrice", Indicator::OpenPrice));
+    graph.AddNode(instant_node("ClosePrice", Indicator::ClosePrice));
+    graph.AddNode(instant_node("HighPrice", Indicator::HighPrice));
+    graph.AddNode(instant_node("LowPrice", Indicator::LowPrice));
+    graph.AddNode(instant_node("TradingVolume", Indicator::TradingVolume));
+    graph.AddNode(instant_node("WeightedClose", Indicator::WeightedClose));
+    graph.AddNode(instant_node("TypicalPrice", Indicator::TypicalPrice));
+    graph.AddNode(instant_node("MedianPrice", Indicator::MedianPrice));
+    graph.AddNode(instant_node("PricePercentageChangeOpenToClose", Indicator::PricePercentageChangeOpenToClose));
+    graph.AddNode(instant_node("ClosingBias", Indicator::ClosingBias));
+    graph.AddNode(instant_node("ExtensionRatio", Indicator::ExtensionRatio));
+
+    // Lagged and windowed indicators read the shared instant series instead of the raw data.
+    graph.AddNode({ "EMA", { "ClosePrice" }, [](const vector<OCHLVData>&, const IndicatorNode::Inputs& in) {
+        const vector<double>& close = *in[0];
+        vector<double> output;
+        output.reserve(close.size());
+        for (double value : close)
+            output.push_back(Indicator::EMA(value, output.empty() ? value : output.back()));
+
+        return output;
+    }});
+    graph.AddNode(windowed_node("SMA", "ClosePrice", Indicator::SMA));
+    graph.AddNode(windowed_node("RSI", "ClosePrice", Indicator::RSI));
+    graph.AddNode(windowed_node("VWAP", "ClosePrice", "TradingVolume", Indicator::VWAP));
+    graph.AddNode(windowed_node("OBV", "ClosePrice", "TradingVolume", Indicator::OBV));
+    graph.AddNode(windowed_node("ROC", "ClosePrice", Indicator::ROC));
+    graph.AddNode(windowed_node("MFI", "TypicalPrice", "TradingVolume", Indicator::MFI));
+
+    // Quantiles depend on the already evaluated indicator series.
+    for (const ExportedIndicator& indicator : exportedIndicators)
+    {
+        for (unsigned p = 0; p < IndicatorRegistry::percentileCount; p++)
+        {
+            const double percentile = IndicatorRegistry::percentileValues[p];
+            const string percentileString(IndicatorRegistry::percentileNames[p]);
+            graph.AddNode({ Indicator::QuantileNodeName(indicator.Name(), percentileString), { indicator.Name() },
+                            [percentile](const vector<OCHLVData>&, const IndicatorNode::Inputs& in) {
+                return Indicator::RollingQuantile(*in[0], percentile);
+            }});
+        }
+    }
+
+    // Percentile ranks, like quantiles, only depend on the indicator series.
+    for (const ExportedIndicator& indicator : exportedIndicators)
+    {
+        graph.AddNode({ Indicator::PercentileRankNodeName(indicator.Name()), { indicator.Name() },
+                        [](const vector<OCHLVData>&, const IndicatorNode::Inputs& in) {
+            return Indicator::RollingPercentileRank(*in[0]);
+        }});
+    }
+
+    return graph;
+}
+
+const IndicatorGraph& Indicator::Graph()
+{
+    static const IndicatorGraph graph = build_indicator_graph();
+    return graph;
+}
+
+string Indicator::QuantileNodeName(const string& indicatorName, const string& percentile)
+{
+    return indicatorName + "@" + percentile;
+}
+
+string Indicator::PercentileRankNodeName(const string& indicatorName)
+{
+    return indicatorName + "@rank";
+}
+
+Indicators Indicator::ExportIndicators(const Indicators& series)
 {
     Indicators ind;
-    ind["OpenPrice"] = VectorOps::Drop(IndicatorTimeSeries(OpenPrice, rawData), 2 * windowSize);
-    ind["ClosePrice"] = VectorOps::Drop(IndicatorTimeSeries(ClosePrice, rawData), 2 * windowSize);
-    ind["HighPrice"] = VectorOps::Drop(IndicatorTimeSeries(HighPrice, rawData), 2 * windowSize);
-    ind["LowPrice"] = VectorOps::Drop(IndicatorTimeSeries(LowPrice, rawData), 2 * windowSize);
-    ind["TradingVolume"] = VectorOps::Drop(IndicatorTimeSeries(TradingVolume, rawData), 2 * windowSize);
-    ind["WeightedClose"] = VectorOps::Drop(IndicatorTimeSeries(WeightedClose, rawData), 2 * windowSize);
-    ind["TypicalPrice"] = VectorOps::Drop(IndicatorTimeSeries(TypicalPrice, rawData), 2 * windowSize);
-    ind["MedianPrice"] = VectorOps::Drop(IndicatorTimeSeries(MedianPrice, rawData), 2 * windowSize);
-    ind["PricePercentageChangeOpenToClose"] = VectorOps::Drop(IndicatorTimeSeries(PricePercentageChangeOpenToClose, rawData), 2 * windowSize);
-    ind["ClosingBias"] = VectorOps::Drop(IndicatorTimeSeries(ClosingBias, rawData), 2 * windowSize);
-    ind["ExtensionRatio"] = VectorOps::Drop(IndicatorTimeSeries(ExtensionRatio, rawData), 2 * windowSize);
-    ind["SMA"] = VectorOps::Drop(IndicatorTimeSeries(SMA, rawData, windowSize), windowSize);
-    ind["EMA"] = VectorOps::Drop(IndicatorTimeSeries(EMA, rawData), 2 * windowSize);
-    ind["RSI"] = VectorOps::Drop(IndicatorTimeSeries(RSI, rawData, windowSize),  windowSize);
-    ind["VWAP"] = VectorOps::Drop(IndicatorTimeSeries(VWAP, rawData, windowSize), windowSize);
-    ind["OBV"] = VectorOps::Drop(IndicatorTimeSeries(OBV, rawData, windowSize), windowSize);
-    ind["ROC"] = VectorOps::Drop(IndicatorTimeSeries(ROC, rawData, windowSize), windowSize);
-    ind["MFI"] = VectorOps::Drop(IndicatorTimeSeries(MFI, rawData, windowSize), windowSize);
+    for (const ExportedIndicator& indicator : exportedIndicators)
+        ind[indicator.Name()] = VectorOps::Drop(series.at(indicator.Name()), indicator.drop);
+
     return ind;
 }
-QuantileIndicators Indicator::CalculateQuantileIndicators(const vector<OCHLVData>& rawData)
+
+QuantileIndicators Indicator::ExportQuantileIndicators(const Indicators& series)
 {
-    const vector<double> allPercentiles { 0.05, 0.15, 0.25, 0.75, 0.85, 0.95 };
     QuantileIndicators outputQuantileIndicators;
-
-    for (double percentile : allPercentiles)
+    for (string_view percentile : IndicatorRegistry::percentileNames)
     {
+        const string percentileString(percentile);
+
         Indicators ind;
-        ind["OpenPrice"] = VectorOps::Drop(QuantileTimeSeries<double>(OpenPrice, rawData, percentile), windowSize);
-        ind["ClosePrice"] = VectorOps::Drop(QuantileTimeSeries(ClosePrice, rawData, percentile), windowSize);
-        ind["HighPrice"] = VectorOps::Drop(QuantileTimeSeries(HighPrice, rawData, percentile), windowSize);
-        ind["LowPrice"] = VectorOps::Drop(QuantileTimeSeries(LowPrice, rawData, percentile), windowSize);
-        ind["TradingVolume"] = VectorOps::Drop(QuantileTimeSeries(TradingVolume, rawData, percentile), windowSize);
-        ind["WeightedClose"] = VectorOps::Drop(QuantileTimeSeries(WeightedClose, rawData, percentile), windowSize);
-        ind["TypicalPrice"] = VectorOps::Drop(QuantileTimeSeries(TypicalPrice, rawData, percentile), windowSize);
-        ind["MedianPrice"] = VectorOps::Drop(QuantileTimeSeries(MedianPrice, rawData, percentile), windowSize);
-        ind["PricePercentageChangeOpenToClose"] = VectorOps::Drop(QuantileTimeSeries(PricePercentageChangeOpenToClose, rawData, percentile), windowSize);
-        ind["ClosingBias"] = VectorOps::Drop(QuantileTimeSeries(ClosingBias, rawData, percentile), windowSize);
-        ind["ExtensionRatio"] = VectorOps::Drop(QuantileTimeSeries(ExtensionRatio, rawData, percentile), windowSize);
-        ind["SMA"] = QuantileTimeSeries(SMA, rawData, percentile);
-        ind["EMA"] = VectorOps::Drop(QuantileTimeSeries(EMA, rawData, percentile), windowSize);
-        ind["RSI"] = QuantileTimeSeries(RSI, rawData, percentile);
-        ind["VWAP"] = QuantileTimeSeries(VWAP, rawData, percentile);
-        ind["OBV"] = QuantileTimeSeries(OBV, rawData, percentile);
-        ind["ROC"] = QuantileTimeSeries(ROC, rawData, percentile);
-        ind["MFI"] = QuantileTimeSeries(MFI, rawData, percentile);
-
-        const string percentileString = Utilities::NumberToString(percentile, 2);
+        for (const ExportedIndicator& indicator : exportedIndicators)
+        {
+            const vector<double>& quantile = series.at(QuantileNodeName(indicator.Name(), percentileString));
+            ind[indicator.Name()] = VectorOps::Drop(quantile, indicator.drop - windowSize);
+        }
+
         outputQuantileIndicators[percentileString] = ind;
     }
 
     return outputQuantileIndicators;
-}
\ No newline at end of file
+}
+
+Indicators Indicator::ExportPercentileRanks(const Indicators& series)
+{
+    // Ranks are aligned with their indicator since they are evaluated at every value of it.
+    Indicators ranks;
+    for (const ExportedIndicator& indicator : exportedIndicators)
+        ranks[indicator.Name()] = VectorOps::Drop(series.at(PercentileRankNodeName(indicator.Name())), indicator.drop);
+
+    return ranks;
+}
+
+/****************************
+*   Indicator calculation   *
+****************************/
+
+Indicators Indicator::CalculateIndicators(const vector<OCHLVData>& rawData)
+{
+    vector<string> targets;
+    for (const ExportedIndicator& indicator : exportedIndicators)
+        targets.push_back(indicator.Name());
+
+    return ExportIndicators(Graph().Evaluate(rawData, targets));
+}
+QuantileIndicators Indicator::CalculateQuantileIndicators(const vector<OCHLVData>& rawData)
+{
+    vector<string> targets;
+    for (const ExportedIndicator& indicator : exportedIndicators)
+    {
+        for (string_view percentile : IndicatorRegistry::percentileNames)
+            targets.push_back(QuantileNodeName(indicator.Name(), string(percentile)));
+    }
+
+    return ExportQuantileIndicators(Graph().Evaluate(rawData, targets));
+}
@@ -8,6 +8,7 @@
 #include "loader.h"
 #include "indicators.h"
 #include "utilities.h"
+#include "worker_pool.h"
 using namespace std;
 using namespace backtester;
 
@@ -46,12 +47,48 @@ vector<OCHLVData> Loader::LoadRawData(const string& path)
 
 StockData Loader::LoadStockdataFromRaw(const vector<OCHLVData>& rawData)
 {
+    // Evaluate the whole indicator graph once so that quantiles and ranks reuse the indicator series.
+    const Indicators series = Indicator::Graph().Evaluate(rawData);
+
     StockData stockData;
-    stockData.indicators = Indicator::CalculateIndicators(rawData);
-    stockData.quantileIndicators = Indicator::CalculateQuantileIndicators(rawData);
+    stockData.SetIndicators(Indicator::ExportIndicators(series));
+    stockData.SetQuantileIndicators(Indicator::ExportQuantileIndicators(series));
+    stockData.SetPercentileRanks(Indicator::ExportPercentileRanks(series));
+    DerivedIndicator::EvaluateAll(derivedIndicators, stockData);
     return stockData;
 }
 
+void Loader::RegisterDerivedIndicator(const string& name, const string& expression)
+{
+    derivedIndicators.push_back(DerivedIndicator::Compile(name, expression, derivedIndicators));
+}
+
+void Loader::ClearDerivedIndicators()
+{
+    derivedIndicators.clear();
+}
+
+const vector<DerivedIndicator>& Loader::DerivedIndicators()
+{
+    return derivedIndicators;
+}
+
+/// Are the derived indicators stored in the stock the registered ones?
+bool has_registered_derived_indicators(const StockData& stockData)
+{
+    const vector<DerivedIndicator>& registered = Loader::DerivedIndicators();
+    if (stockData.derivedNames.size() != registered.size())
+        return false;
+
+    for (size_t i = 0; i < registered.size(); i++)
+    {
+        if (stockData.derivedNames[i] != registered[i].Name() ||
+            stockData.derivedExpressions[i] != registered[i].Expression())
+            return false;
+    }
+    return true;
+}
+
 /// <summary>
 /// The checksum table is a hashmap that maps the path of a file to its sha256 checksum.
 /// It is used to re-serialize in the event of a change in the dataset file.
@@ -61,105 +98,135 @@ using ChecksumTable = map<string, string>;
 string calculate_file_checksum(const string& path)
 {
     ifstream file(path, ios_base::in | ios_base::binary);
-    return file.is_open() ? digestpp::sha256().absorb(file).hexdigest() : "File not found";
+    if (!file.is_open())
+        return "File not found";
+
+    // The cache format version and storage precision are part of the checksum so that caches of an older layout,
+    // or written by a build with another precision, are rebuilt.
+    return digestpp::sha256().absorb(file).hexdigest() + "-v" + to_string(Loader::cacheFormatVersion) +
+           "-f" + to_string(StockData::storagePrecision);
 }
 
-StockData Loader::LoadStockdata(const string& path)
+/// Read the checksum table of a cache directory. It is empty if the directory has none.
+ChecksumTable read_checksum_table(const string& serializedDataDir)
 {
-    StockData loadedStockData;
-    const string datasetDirectory = FileSystem::FileDirectory(path);
-
-    // Check if the serialized data directory exists.
-    string serializedDataDir = FileSystem::FilenameJoin({ datasetDirectory, cacheDirectoryName });
-    if (!FileSystem::DirectoryExist(serializedDataDir))
-        FileSystem::CreateDirectory(serializedDataDir);
-
-    // Look-up for the checksum table.
+    ChecksumTable checksumTable;
     string checksumTablePath = FileSystem::FilenameJoin({ serializedDataDir, "ChecksumTable.json" });
     if (FileSystem::FileExist(checksumTablePath))
     {
-        // If it exists, deserialize it.
-        ChecksumTable checksumTable;
         ifstream is(checksumTablePath);
         cereal::JSONInputArchive jsonInputArchive(is);
         jsonInputArchive(checksumTable);
-        is.close();
+    }
 
-        // Validate checksum of file in path.
-        if (checksumTable[path] == calculate_file_checksum(path))
-        {
-            // Deserialize dataset and return it.
-            string serializedFilePath = FileSystem::FilenameJoin({ serializedDataDir, FileSystem::FileBasename(path) + ".bin" });
-            if (FileSystem::FileExist(serializedFilePath))
-            {
-                ifstream istock(serializedFilePath, ios::binary | ios::in);
-
-                if (istock.is_open())
-                {
-                    cereal::BinaryInputArchive binaryInputArchive(istock);
-                    binaryInputArchive(loadedStockData);
-                    return loadedStockData;
-                }
-                else
-                    throw runtime_error("Error opening serialized dataset with path: " + path + ".");
-            }
-            else
-                throw runtime_error("Cannot open serializedFilePath.");
-        }
-        else // Parse the new version of the file, serialize it and update the checksum.
-        {
-            // Parse dataset.
-            vector<OCHLVData> rawDataset = LoadRawData(path);
-            loadedStockData = LoadStockdataFromRaw(rawDataset);
-            loadedStockData.dates = VectorOps::Drop(Indicator::IndicatorTimeSeries(Indicator::Date, rawDataset), 2 * windowSize);
+    return checksumTable;
+}
 
-            // Serialize dataset.
-            ofstream os(FileSystem::FilenameJoin({ serializedDataDir, FileSystem::FileBasename(path) + ".bin" }), ios::binary | ios::out);
-            cereal::BinaryOutputArchive oarchive(os);
-            oarchive(loadedStockData);
+void write_checksum_table(const string& serializedDataDir, const ChecksumTable& checksumTable)
+{
+    ofstream checksumTableOS(FileSystem::FilenameJoin({ serializedDataDir, "ChecksumTable.json" }));
+    cereal::JSONOutputArchive oChecksumTableArchive(checksumTableOS);
+    oChecksumTableArchive(checksumTable);
+}
+
+/// Load a stock from its serialized data if the checksum of the file is the one recorded in the checksum table, or
+/// parse the file and serialize it. Only the serialized data of this stock is written, so stocks of the same dataset
+/// can be loaded in parallel.
+/// @return The checksum of the file.
+string load_stock_data(const string& path, const string& serializedDataDir, const string& recordedChecksum,
+                       StockData& loadedStockData)
+{
+    const string checksum = calculate_file_checksum(path);
+    const string serializedFilePath = FileSystem::FilenameJoin({ serializedDataDir, FileSystem::FileBasename(path) + ".bin" });
 
-            // Update checksum
-            checksumTable[path] = calculate_file_checksum(path);
-            ofstream checksumTableOS(FileSystem::FilenameJoin({ serializedDataDir, "ChecksumTable.json" }));
-            cereal::JSONOutputArchive oChecksumTableArchive(checksumTableOS);
-            oChecksumTableArchive(checksumTable);
+    if (checksum == recordedChecksum)
+    {
+        // Deserialize the stock.
+        if (!FileSystem::FileExist(serializedFilePath))
+            throw runtime_error("Cannot open serializedFilePath.");
+
+        ifstream istock(serializedFilePath, ios::binary | ios::in);
+        if (!istock.is_open())
+            throw runtime_error("Error opening serialized dataset with path: " + path + ".");
 
-            return loadedStockData;
+        cereal::BinaryInputArchive binaryInputArchive(istock);
+        binaryInputArchive(loadedStockData);
+        istock.close();
+
+        // Re-evaluate only the derived indicators if their definitions changed, and update the cache.
+        if (!has_registered_derived_indicators(loadedStockData))
+        {
+            DerivedIndicator::EvaluateAll(Loader::DerivedIndicators(), loadedStockData);
+            ofstream os(serializedFilePath, ios::binary | ios::out);
+            cereal::BinaryOutputArchive oarchive(os);
+            oarchive(loadedStockData);
         }
     }
-    else // If no checksum table is found, parse the dataset and create one.
-    {   
-        // Parse dataset.
-        vector<OCHLVData> rawDataset = LoadRawData(path);
-        loadedStockData = LoadStockdataFromRaw(rawDataset);
+    else // Parse the new version of the file and serialize it.
+    {
+        vector<OCHLVData> rawDataset = Loader::LoadRawData(path);
+        loadedStockData = Loader::LoadStockdataFromRaw(rawDataset);
         loadedStockData.dates = VectorOps::Drop(Indicator::IndicatorTimeSeries(Indicator::Date, rawDataset), 2 * windowSize);
 
-        // Serialize dataset.
-        ofstream os(FileSystem::FilenameJoin({ serializedDataDir, FileSystem::FileBasename(path) + ".bin" }), ios::binary | ios::out);
+        ofstream os(serializedFilePath, ios::binary | ios::out);
         cereal::BinaryOutputArchive oarchive(os);
         oarchive(loadedStockData);
+    }
 
-        // Calculate checksum.
-        ChecksumTable checksumTable;
-        checksumTable[path] = calculate_file_checksum(path);
+    return checksum;
+}
+
+StockData Loader::LoadStockdata(const string& path)
+{
+    // Check if the serialized data directory exists.
+    const string serializedDataDir = FileSystem::FilenameJoin({ FileSystem::FileDirectory(path), cacheDirectoryName });
+    if (!FileSystem::DirectoryExist(serializedDataDir))
+        FileSystem::CreateDirectory(serializedDataDir);
 
-        // Serialize checksum table.
-        ofstream checksumTableOS(FileSystem::FilenameJoin({ serializedDataDir, "ChecksumTable.json" }));
-        cereal::JSONOutputArchive oChecksumTableArchive(checksumTableOS);
-        oChecksumTableArchive(checksumTable);
+    ChecksumTable checksumTable = read_checksum_table(serializedDataDir);
 
-        return loadedStockData;
+    StockData loadedStockData;
+    const string checksum = load_stock_data(path, serializedDataDir, checksumTable[path], loadedStockData);
+    if (checksumTable[path] != checksum)
+    {
+        checksumTable[path] = checksum;
+        write_checksum_table(serializedDataDir, checksumTable);
     }
+
+    return loadedStockData;
 }
 
 Dataset Loader::LoadDataset(const string& path)
 {
     vector<string> datasetFiles = FileSystem::FilesInDirectory(path);
-    vector<StockData> stockDataFromFiles = Utilities::map<StockData, string>(LoadStockdata, datasetFiles);
+    if (datasetFiles.empty())
+        return Dataset();
+
+    const string serializedDataDir = FileSystem::FilenameJoin({ FileSystem::FileDirectory(datasetFiles.front()), cacheDirectoryName });
+    if (!FileSystem::DirectoryExist(serializedDataDir))
+        FileSystem::CreateDirectory(serializedDataDir);
+
+    // Load the stocks in the worker pool. The checksum table is shared, so it is read before and written after.
+    ChecksumTable checksumTable = read_checksum_table(serializedDataDir);
+    vector<string> recordedChecksums, checksums(datasetFiles.size());
+    for (const string& file : datasetFiles)
+        recordedChecksums.push_back(checksumTable[file]);
+
+    vector<StockData> stockDataFromFiles(datasetFiles.size());
+    WorkerPool::ParallelFor(datasetFiles.size(), [&](size_t i) {
+        checksums[i] = load_stock_data(datasetFiles[i], serializedDataDir, recordedChecksums[i], stockDataFromFiles[i]);
+    });
+
+    if (checksums != recordedChecksums)
+    {
+        for (size_t i = 0; i < datasetFiles.size(); i++)
+            checksumTable[datasetFiles[i]] = checksums[i];
+        write_checksum_table(serializedDataDir, checksumTable);
+    }
 
     Dataset dataset;
     for (unsigned i = 0; i < datasetFiles.size(); i++)
-        dataset[FileSystem::FileBasename(datasetFiles[i])] = stockDataFromFiles[i];
+        dataset[FileSystem::FileBasename(datasetFiles[i])] = std::move(stockDataFromFiles[i]);
 
     return dataset;
 }
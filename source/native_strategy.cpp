@@ -0,0 +1,241 @@
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <digestpp.hpp>
+#include "native_strategy.h"
+#include "filesystem.h"
+
+#if defined(__linux__) || defined(__APPLE__)
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <cerrno>
+#endif
+
+using namespace std;
+using namespace backtester;
+
+/// Compiler flags of the shared objects. Floating point contraction is disabled so that the results are the same as
+/// the ones of the other strategy evaluators.
+const vector<string> native_compiler_flags { "-std=c++17", "-O2", "-ffp-contract=off", "-shared", "-fPIC" };
+
+/// Compiled strategy of a source hash. While it is being compiled and loaded, other threads that need it wait.
+struct NativeLibrary
+{
+    bool loading = true;
+    NativeStrategy::Function function = nullptr;
+};
+
+/// Compiled strategies of this process, by the hash of their source. Failures are kept as a null function, and
+/// libraries are never unloaded.
+map<string, NativeLibrary> loaded_strategies;
+mutex loaded_strategies_mutex;
+condition_variable loaded_strategies_ready;
+
+/****************************
+*    Compilation and load   *
+****************************/
+
+/// Compiler command split on whitespace, taken from CXX or c++ if it is not set.
+vector<string> native_compiler()
+{
+    const char* compiler = getenv("CXX");
+    istringstream words(compiler != nullptr && *compiler != '\0' ? string(compiler) : string("c++"));
+    vector<string> command;
+    for (string word; words >> word;)
+        command.push_back(word);
+
+    return command;
+}
+
+#if defined(__linux__) || defined(__APPLE__)
+/// Run a command without a shell, with its standard output and error written to a log file.
+bool run_command(const vector<string>& arguments, const string& logPath)
+{
+    vector<char*> argv;
+    for (const string& argument : arguments)
+        argv.push_back(const_cast<char*>(argument.c_str()));
+    argv.push_back(nullptr);
+
+    // The log is not inherited by the commands that other threads start at the same time.
+    const int log = open(logPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    const pid_t pid = fork();
+    if (pid == 0)
+    {
+        if (log >= 0)
+        {
+            dup2(log, STDOUT_FILENO);
+            dup2(log, STDERR_FILENO);
+        }
+        execvp(argv[0], argv.data());
+        _exit(127);
+    }
+
+    if (log >= 0)
+        close(log);
+    if (pid < 0)
+        return false;
+
+    int status = 0;
+    while (waitpid(pid, &status, 0) < 0)
+    {
+        if (errno != EINTR)
+            return false;
+    }
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+/// Compile the source into the shared object unless it is already in the cache, and load it. A failed compilation
+/// leaves a .failed marker, and the source is not compiled again.
+NativeStrategy::Function compile_and_load(const string& source, const vector<string>& compiler,
+                                          const string& basePath)
+{
+    const string libraryPath = basePath + ".so";
+    const string failedPath = basePath + ".failed";
+    if (FileSystem::FileExist(failedPath))
+        return nullptr;
+
+    if (!FileSystem::FileExist(libraryPath))
+    {
+        // The source, the log and the shared object are written to files of this process and renamed when complete,
+        // so that other processes compiling the same source never read or load a partial file.
+        const string processPath = basePath + "." + to_string(getpid());
+        const string sourcePath = processPath + ".cpp";
+        const string logPath = processPath + ".log";
+        const string temporaryPath = processPath + ".tmp";
+        {
+            ofstream file(sourcePath);
+            file << source;
+            if (!file)
+            {
+                remove(sourcePath.c_str());
+                return nullptr;
+            }
+        }
+
+        vector<string> arguments = compiler;
+        arguments.insert(arguments.end(), native_compiler_flags.begin(), native_compiler_flags.end());
+        arguments.insert(arguments.end(), { "-o", temporaryPath, sourcePath });
+        const bool compiled = run_command(arguments, logPath);
+        rename(sourcePath.c_str(), (basePath + ".cpp").c_str());
+        rename(logPath.c_str(), (basePath + ".log").c_str());
+        if (!compiled)
+        {
+            remove(temporaryPath.c_str());
+            ofstream(failedPath) << "Compilation failed, see " << FileSystem::FileBasename(basePath) << ".log\n";
+            return nullptr;
+        }
+        if (rename(temporaryPath.c_str(), libraryPath.c_str()) != 0)
+        {
+            remove(temporaryPath.c_str());
+            return nullptr;
+        }
+    }
+
+    // A shared object that cannot be loaded is removed, so that it is compiled again by the next run.
+    void* library = dlopen(libraryPath.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (library == nullptr)
+    {
+        remove(libraryPath.c_str());
+        return nullptr;
+    }
+
+    return reinterpret_cast<NativeStrategy::Function>(dlsym(library, "backtester_strategy"));
+}
+#endif
+
+/// Get the compiled function of a source, compiling and loading it once per process. The compiler runs without
+/// holding the lock of the loaded strategies, so only the threads that need the same source wait for it.
+NativeStrategy::Function load_strategy(const string& source, const string& cacheDirectory)
+{
+#if defined(__linux__) || defined(__APPLE__)
+    const vector<string> compiler = native_compiler();
+    string command;
+    for (const string& argument : compiler)
+        command += argument + " ";
+    for (const string& flag : native_compiler_flags)
+        command += flag + " ";
+    const string hash = digestpp::sha256().absorb(command + "\n" + source).hexdigest();
+
+    {
+        unique_lock<mutex> lock(loaded_strategies_mutex);
+        const auto [it, inserted] = loaded_strategies.try_emplace(hash);
+        if (!inserted)
+        {
+            loaded_strategies_ready.wait(lock, [&library = it->second] { return !library.loading; });
+            return it->second.function;
+        }
+    }
+
+    NativeStrategy::Function function = nullptr;
+    try
+    {
+        if (!FileSystem::DirectoryExist(cacheDirectory))
+            FileSystem::CreateDirectory(cacheDirectory);
+        function = compile_and_load(source, compiler, FileSystem::FilenameJoin({ cacheDirectory, "strategy_" + hash }));
+    }
+    catch (...)
+    {
+        function = nullptr;
+    }
+
+    {
+        lock_guard<mutex> lock(loaded_strategies_mutex);
+        NativeLibrary& library = loaded_strategies[hash];
+        library.loading = false;
+        library.function = function;
+    }
+    loaded_strategies_ready.notify_all();
+    return function;
+#else
+    return nullptr;
+#endif
+}
+
+bool NativeStrategy::TryLoad(const StrategyExpression& expression, const string& cacheDirectory,
+                             NativeStrategy& strategy)
+{
+    const Function function = load_strategy(expression.ToCpp(), cacheDirectory);
+    if (function == nullptr)
+        return false;
+
+    strategy.expression = expression;
+    strategy.function = function;
+    return true;
+}
+
+/****************************
+*        Evaluation         *
+****************************/
+
+bool NativeStrategy::TryEvaluate(const StockData& stockData, Signal& signals) const
+{
+    vector<SeriesView> series;
+    if (function == nullptr || !expression.TryResolveSeries(stockData, series))
+        return false;
+
+    vector<const SeriesValue*> data;
+    vector<size_t> sizes;
+    for (const SeriesView& view : series)
+    {
+        data.push_back(view.data);
+        sizes.push_back(view.size);
+    }
+
+    const size_t timePoints = stockData.dates.size();
+    vector<unsigned char> output(timePoints);
+    function(data.data(), sizes.data(), timePoints, output.data());
+
+    signals = Signal(timePoints);
+    for (size_t t = 0; t < timePoints; t++)
+    {
+        if (output[t])
+            signals.Set(t, true);
+    }
+    return true;
+}
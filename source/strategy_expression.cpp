@@ -0,0 +1,975 @@
+#include <cstdint>
+#include <cctype>
+#include <cstring>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <algorithm>
+#include "strategy_expression.h"
+using namespace std;
+using namespace backtester;
+
+/****************************
+*      Expression tree      *
+****************************/
+
+struct StrategyExpression::Node
+{
+    enum class Type
+    {
+        Constant, Indicator, Derived, Quantile, Negate, Add, Subtract, Multiply, Divide,
+        Less, LessEqual, Greater, GreaterEqual, Equal, NotEqual, And, Or, Not
+    };
+
+    Type type = Type::Constant;
+    double constant = 0.0;
+    bool integer = false;
+    IndicatorId indicator {};
+    PercentileId percentile {};
+    string derivedName;
+    size_t lag = 0;
+    vector<shared_ptr<const Node>> children;
+
+    [[nodiscard]] bool IsBoolean() const
+    {
+        return type >= Type::Less;
+    }
+};
+
+using StrategyNode = StrategyExpression::Node;
+using StrategyNodePtr = shared_ptr<const StrategyNode>;
+
+/****************************
+*    Expression parser      *
+****************************/
+
+/// Recursive descent parser of the native subset of the strategy language, with the precedence of AngelScript:
+///     disjunction := conjunction (('||' | 'or') conjunction)*
+///     conjunction := equality (('&&' | 'and') equality)*
+///     equality    := relation (('==' | '!=') relation)?
+///     relation    := sum (('<' | '<=' | '>' | '>=') sum)?
+///     sum         := product (('+' | '-') product)*
+///     product     := unary (('*' | '/') unary)*
+///     unary       := ('-' | '!' | 'not') unary | primary
+///     primary     := number | call | '(' disjunction ')'
+/// Anything outside the subset makes the parse fail, and the program is left to the scripting engine.
+class StrategyExpressionParser
+{
+private:
+    struct Rejected {};
+
+    const string& source;
+    size_t position = 0;
+
+    [[noreturn]] static void reject()
+    {
+        throw Rejected();
+    }
+
+    static bool isIdentifierChar(char c)
+    {
+        return isalnum((unsigned char) c) || c == '_';
+    }
+
+    void skipWhitespace()
+    {
+        while (position < source.size() && isspace((unsigned char) source[position]))
+            position++;
+    }
+
+    bool accept(const string& token)
+    {
+        skipWhitespace();
+        if (source.compare(position, token.size(), token) != 0)
+            return false;
+
+        // Keywords must not be the prefix of an identifier, and operators must not be the prefix of a longer one.
+        const size_t next = position + token.size();
+        if (isIdentifierChar(token.back()) && next < source.size() && isIdentifierChar(source[next]))
+            return false;
+        if ((token == "<" || token == ">" || token == "!") && next < source.size() && source[next] == '=')
+            return false;
+
+        position = next;
+        return true;
+    }
+
+    void expect(const string& token)
+    {
+        if (!accept(token))
+            reject();
+    }
+
+    static StrategyNodePtr makeNode(StrategyNode::Type type, vector<StrategyNodePtr> children)
+    {
+        auto node = make_shared<StrategyNode>();
+        node->type = type;
+        node->children = std::move(children);
+        return node;
+    }
+
+    static StrategyNodePtr makeNumeric(StrategyNode::Type type, const StrategyNodePtr& a, const StrategyNodePtr& b)
+    {
+        // Integer arithmetic does not follow the rules of doubles.
+        if (a->IsBoolean() || b->IsBoolean() || (a->integer && b->integer))
+            reject();
+
+        return makeNode(type, { a, b });
+    }
+
+    static StrategyNodePtr makeComparison(StrategyNode::Type type, const StrategyNodePtr& a, const StrategyNodePtr& b)
+    {
+        if (a->IsBoolean() || b->IsBoolean())
+            reject();
+
+        return makeNode(type, { a, b });
+    }
+
+    static StrategyNodePtr makeLogical(StrategyNode::Type type, vector<StrategyNodePtr> children)
+    {
+        for (const StrategyNodePtr& child : children)
+        {
+            if (!child->IsBoolean())
+                reject();
+        }
+
+        return makeNode(type, std::move(children));
+    }
+
+    StrategyNodePtr parseNumber()
+    {
+        // Decimal literals only: digits, an optional fraction and an optional exponent.
+        const size_t begin = position;
+        bool integer = true;
+        if (position >= source.size() || !isdigit((unsigned char) source[position]))
+            reject();
+        while (position < source.size() && isdigit((unsigned char) source[position]))
+            position++;
+        if (position < source.size() && source[position] == '.')
+        {
+            integer = false;
+            position++;
+            while (position < source.size() && isdigit((unsigned char) source[position]))
+                position++;
+        }
+        if (position < source.size() && (source[position] == 'e' || source[position] == 'E'))
+        {
+            integer = false;
+            position++;
+            if (position < source.size() && (source[position] == '+' || source[position] == '-'))
+                position++;
+            if (position >= source.size() || !isdigit((unsigned char) source[position]))
+                reject();
+            while (position < source.size() && isdigit((unsigned char) source[position]))
+                position++;
+        }
+        if (position < source.size() && (isIdentifierChar(source[position]) || source[position] == '.'))
+            reject();
+
+        auto node = make_shared<StrategyNode>();
+        node->constant = stod(source.substr(begin, position - begin));
+        node->integer = integer;
+        return node;
+    }
+
+    string parseString()
+    {
+        skipWhitespace();
+        if (position >= source.size() || source[position] != '"')
+            reject();
+
+        const size_t end = source.find('"', position + 1);
+        if (end == string::npos)
+            reject();
+
+        string value = source.substr(position + 1, end - position - 1);
+        if (value.find('\\') != string::npos)
+            reject();
+
+        position = end + 1;
+        return value;
+    }
+
+    /// Parses the arguments "stock, time" or "stock, time - k" and returns the lag k.
+    size_t parseStockAndTime()
+    {
+        expect("stock");
+        expect(",");
+        expect("time");
+
+        size_t lag = 0;
+        if (accept("-"))
+        {
+            skipWhitespace();
+            StrategyNodePtr number = parseNumber();
+            if (!number->integer)
+                reject();
+            lag = (size_t) number->constant;
+        }
+        expect(")");
+        return lag;
+    }
+
+    StrategyNodePtr parseCall(const string& function)
+    {
+        auto node = make_shared<StrategyNode>();
+        if (function == "Indicator")
+        {
+            const string name = parseString();
+            expect(",");
+            if (IndicatorRegistry::TryFromName(name, node->indicator))
+                node->type = StrategyNode::Type::Indicator;
+            else
+            {
+                node->type = StrategyNode::Type::Derived;
+                node->derivedName = name;
+            }
+        }
+        else if (function == "IndQuantile")
+        {
+            const string name = parseString();
+            expect(",");
+            const string percentile = parseString();
+            expect(",");
+            if (!IndicatorRegistry::TryFromName(name, node->indicator) ||
+                !IndicatorRegistry::TryFromName(percentile, node->percentile))
+                reject();
+
+            node->type = StrategyNode::Type::Quantile;
+        }
+        else
+            reject();
+
+        node->lag = parseStockAndTime();
+        return node;
+    }
+
+    StrategyNodePtr parsePrimary()
+    {
+        skipWhitespace();
+        if (position >= source.size())
+            reject();
+
+        if (accept("("))
+        {
+            StrategyNodePtr node = parseDisjunction();
+            expect(")");
+            return node;
+        }
+
+        if (isdigit((unsigned char) source[position]))
+            return parseNumber();
+
+        const size_t begin = position;
+        while (position < source.size() && isIdentifierChar(source[position]))
+            position++;
+        const string identifier = source.substr(begin, position - begin);
+        if (identifier.empty() || !accept("("))
+            reject();
+
+        return parseCall(identifier);
+    }
+
+    StrategyNodePtr parseUnary()
+    {
+        if (accept("!") || accept("not"))
+            return makeLogical(StrategyNode::Type::Not, { parseUnary() });
+
+        if (accept("-"))
+        {
+            StrategyNodePtr operand = parseUnary();
+            if (operand->IsBoolean())
+                reject();
+
+            auto node = make_shared<StrategyNode>();
+            node->type = StrategyNode::Type::Negate;
+            node->integer = operand->integer;
+            node->children = { operand };
+            return node;
+        }
+
+        return parsePrimary();
+    }
+
+    StrategyNodePtr parseProduct()
+    {
+        StrategyNodePtr node = parseUnary();
+        while (true)
+        {
+            if (accept("*"))
+                node = makeNumeric(StrategyNode::Type::Multiply, node, parseUnary());
+            else if (accept("/"))
+                node = makeNumeric(StrategyNode::Type::Divide, node, parseUnary());
+            else
+                return node;
+        }
+    }
+
+    StrategyNodePtr parseSum()
+    {
+        StrategyNodePtr node = parseProduct();
+        while (true)
+        {
+            if (accept("+"))
+                node = makeNumeric(StrategyNode::Type::Add, node, parseProduct());
+            else if (accept("-"))
+                node = makeNumeric(StrategyNode::Type::Subtract, node, parseProduct());
+            else
+                return node;
+        }
+    }
+
+    StrategyNodePtr parseRelation()
+    {
+        static const vector<pair<string, StrategyNode::Type>> relations {
+                { "<=", StrategyNode::Type::LessEqual },
+                { ">=", StrategyNode::Type::GreaterEqual },
+                { "<", StrategyNode::Type::Less },
+                { ">", StrategyNode::Type::Greater }
+        };
+
+        StrategyNodePtr node = parseSum();
+        for (const auto& [token, type] : relations)
+        {
+            if (accept(token))
+                return makeComparison(type, node, parseSum());
+        }
+
+        return node;
+    }
+
+    StrategyNodePtr parseEquality()
+    {
+        StrategyNodePtr node = parseRelation();
+        if (accept("=="))
+            return makeComparison(StrategyNode::Type::Equal, node, parseRelation());
+        if (accept("!="))
+            return makeComparison(StrategyNode::Type::NotEqual, node, parseRelation());
+
+        return node;
+    }
+
+    StrategyNodePtr parseConjunction()
+    {
+        StrategyNodePtr node = parseEquality();
+        while (accept("&&") || accept("and"))
+            node = makeLogical(StrategyNode::Type::And, { node, parseEquality() });
+
+        return node;
+    }
+
+    StrategyNodePtr parseDisjunction()
+    {
+        StrategyNodePtr node = parseConjunction();
+        while (accept("||") || accept("or"))
+            node = makeLogical(StrategyNode::Type::Or, { node, parseConjunction() });
+
+        return node;
+    }
+
+public:
+    explicit StrategyExpressionParser(const string& source) : source(source) {}
+
+    /// Returns the expression tree, or nullptr if the program is not in the native subset or its value is not of the
+    /// expected type.
+    StrategyNodePtr Parse(bool boolean)
+    {
+        try
+        {
+            StrategyNodePtr node = parseDisjunction();
+            skipWhitespace();
+            if (position != source.size() || node->IsBoolean() != boolean)
+                return nullptr;
+
+            return node;
+        }
+        catch (const Rejected&)
+        {
+            return nullptr;
+        }
+    }
+};
+
+bool StrategyExpression::TryCompile(const string& program, StrategyExpression& expression)
+{
+    StrategyNodePtr root = StrategyExpressionParser(program).Parse(true);
+    if (root == nullptr)
+        return false;
+
+    expression.program = program;
+    expression.root = std::move(root);
+    return true;
+}
+
+bool StrategyExpression::TryCompileScore(const string& program, StrategyExpression& expression)
+{
+    StrategyNodePtr root = StrategyExpressionParser(program).Parse(false);
+    if (root == nullptr)
+        return false;
+
+    expression.program = program;
+    expression.root = std::move(root);
+    return true;
+}
+
+/****************************
+*    Column evaluation      *
+****************************/
+
+/// Values of a node over every bar: numbers for numeric nodes and 0/1 truth values for boolean nodes. The failure
+/// flags mark the bars where the scripting engine would have raised an exception.
+struct StrategyColumn
+{
+    vector<double> values;
+    vector<uint8_t> truth;
+    vector<uint8_t> failed;
+};
+
+void read_series(const SeriesView& series, size_t lag, size_t timePoints, StrategyColumn& column)
+{
+    column.values.assign(timePoints, 0.0);
+    column.failed.assign(timePoints, 0);
+    for (size_t t = 0; t < timePoints; t++)
+    {
+        if (t < lag || t - lag >= series.size)
+            column.failed[t] = 1;
+        else
+            column.values[t] = series[t - lag];
+    }
+}
+
+/// Comparison with the ordering of the scripting engine, which classifies a pair of doubles as equal, less or else
+/// greater, so NaN compares as greater. Each operator is a branchless loop that the compiler vectorizes.
+void compare_columns(StrategyNode::Type type, const vector<double>& a, const vector<double>& b, vector<uint8_t>& truth)
+{
+    const size_t n = a.size();
+    truth.resize(n);
+    const double* x = a.data();
+    const double* y = b.data();
+    uint8_t* out = truth.data();
+
+    switch (type)
+    {
+        case StrategyNode::Type::Less:
+            for (size_t i = 0; i < n; i++) out[i] = x[i] < y[i];
+            break;
+        case StrategyNode::Type::LessEqual:
+            for (size_t i = 0; i < n; i++) out[i] = (x[i] < y[i]) | (x[i] == y[i]);
+            break;
+        case StrategyNode::Type::Greater:
+            for (size_t i = 0; i < n; i++) out[i] = !((x[i] < y[i]) | (x[i] == y[i]));
+            break;
+        case StrategyNode::Type::GreaterEqual:
+            for (size_t i = 0; i < n; i++) out[i] = !(x[i] < y[i]);
+            break;
+        case StrategyNode::Type::Equal:
+            for (size_t i = 0; i < n; i++) out[i] = x[i] == y[i];
+            break;
+        default:
+            for (size_t i = 0; i < n; i++) out[i] = x[i] != y[i];
+            break;
+    }
+}
+
+bool evaluate_column(const StrategyNode& node, const StockData& stockData, size_t timePoints, StrategyColumn& column)
+{
+    using Type = StrategyNode::Type;
+
+    switch (node.type)
+    {
+        case Type::Constant:
+            column.values.assign(timePoints, node.constant);
+            column.failed.assign(timePoints, 0);
+            return true;
+
+        case Type::Indicator:
+            read_series(stockData.Series(node.indicator), node.lag, timePoints, column);
+            return true;
+
+        case Type::Derived:
+        {
+            size_t index = 0;
+            if (!stockData.TryDerivedIndex(node.derivedName, index))
+                return false;
+
+            read_series(stockData.DerivedSeries(index), node.lag, timePoints, column);
+            return true;
+        }
+
+        case Type::Quantile:
+            read_series(stockData.QuantileSeries(node.indicator, node.percentile), node.lag, timePoints, column);
+            return true;
+
+        case Type::Negate:
+        case Type::Not:
+        {
+            if (!evaluate_column(*node.children[0], stockData, timePoints, column))
+                return false;
+
+            if (node.type == Type::Negate)
+                for (double& value : column.values) value = -value;
+            else
+                for (uint8_t& value : column.truth) value ^= 1;
+            return true;
+        }
+
+        default:
+            break;
+    }
+
+    StrategyColumn right;
+    if (!evaluate_column(*node.children[0], stockData, timePoints, column) ||
+        !evaluate_column(*node.children[1], stockData, timePoints, right))
+        return false;
+
+    double* x = column.values.data();
+    const double* y = right.values.data();
+    uint8_t* failed = column.failed.data();
+    const uint8_t* rightFailed = right.failed.data();
+
+    switch (node.type)
+    {
+        case Type::Add:
+            for (size_t i = 0; i < timePoints; i++) x[i] += y[i];
+            break;
+        case Type::Subtract:
+            for (size_t i = 0; i < timePoints; i++) x[i] -= y[i];
+            break;
+        case Type::Multiply:
+            for (size_t i = 0; i < timePoints; i++) x[i] *= y[i];
+            break;
+        case Type::Divide:
+            // The scripting engine raises an exception on a division by zero.
+            for (size_t i = 0; i < timePoints; i++)
+            {
+                failed[i] |= y[i] == 0.0;
+                x[i] = y[i] == 0.0 ? 0.0 : x[i] / y[i];
+            }
+            break;
+        case Type::And:
+        {
+            // The right operand is only evaluated, and can only fail, when the left one is true.
+            uint8_t* truth = column.truth.data();
+            const uint8_t* rightTruth = right.truth.data();
+            for (size_t i = 0; i < timePoints; i++)
+            {
+                failed[i] |= truth[i] & rightFailed[i];
+                truth[i] &= rightTruth[i];
+            }
+            return true;
+        }
+        case Type::Or:
+        {
+            uint8_t* truth = column.truth.data();
+            const uint8_t* rightTruth = right.truth.data();
+            for (size_t i = 0; i < timePoints; i++)
+            {
+                failed[i] |= (truth[i] ^ 1) & rightFailed[i];
+                truth[i] |= rightTruth[i];
+            }
+            return true;
+        }
+        default:
+            compare_columns(node.type, column.values, right.values, column.truth);
+            column.values.clear();
+            break;
+    }
+
+    for (size_t i = 0; i < timePoints; i++)
+        failed[i] |= rightFailed[i];
+
+    return true;
+}
+
+bool StrategyExpression::TryEvaluate(const StockData& stockData, Signal& signals) const
+{
+    const size_t timePoints = stockData.dates.size();
+    StrategyColumn column;
+    if (root == nullptr || !evaluate_column(*root, stockData, timePoints, column))
+        return false;
+
+    signals = Signal(timePoints);
+    for (size_t t = 0; t < timePoints; t++)
+    {
+        if (column.truth[t] && !column.failed[t])
+            signals.Set(t, true);
+    }
+
+    return true;
+}
+
+bool StrategyExpression::TryEvaluateScore(const StockData& stockData, vector<double>& scores) const
+{
+    const size_t timePoints = stockData.dates.size();
+    StrategyColumn column;
+    if (root == nullptr || root->IsBoolean() || !evaluate_column(*root, stockData, timePoints, column))
+        return false;
+
+    scores = std::move(column.values);
+    for (size_t t = 0; t < timePoints; t++)
+    {
+        if (column.failed[t])
+            scores[t] = numeric_limits<double>::quiet_NaN();
+    }
+
+    return true;
+}
+
+/****************************
+*  Shared predicate batch   *
+****************************/
+
+/// Canonical form of a comparison or numeric node, the same for equal subtrees. The operands of +, * and == are
+/// ordered, since these operations are commutative, also in floating point, and fail on the same bars.
+string canonical_key(const StrategyNode& node)
+{
+    using Type = StrategyNode::Type;
+
+    switch (node.type)
+    {
+        case Type::Constant:
+        {
+            uint64_t bits = 0;
+            memcpy(&bits, &node.constant, sizeof(bits));
+            return "c" + to_string(bits) + (node.integer ? "i" : "");
+        }
+        case Type::Indicator:
+            return "I" + to_string(IndicatorRegistry::Index(node.indicator)) + "@" + to_string(node.lag);
+        case Type::Derived:
+            return "D" + to_string(node.derivedName.size()) + ":" + node.derivedName + "@" + to_string(node.lag);
+        case Type::Quantile:
+            return "Q" + to_string(IndicatorRegistry::Index(node.indicator)) + "," +
+                   to_string(IndicatorRegistry::Index(node.percentile)) + "@" + to_string(node.lag);
+        default:
+            break;
+    }
+
+    vector<string> operands;
+    for (const StrategyNodePtr& child : node.children)
+        operands.push_back(canonical_key(*child));
+    if (node.type == Type::Add || node.type == Type::Multiply || node.type == Type::Equal)
+        sort(operands.begin(), operands.end());
+
+    string key = "(" + to_string(static_cast<int>(node.type));
+    for (const string& operand : operands)
+        key += " " + operand;
+    return key + ")";
+}
+
+/// Pack 0/1 values into a signal, 64 bars per word.
+void pack_column(const vector<uint8_t>& values, Signal& signal)
+{
+    signal = Signal(values.size());
+    Signal::Word* words = signal.Data();
+    for (size_t t = 0; t < values.size(); t++)
+        words[t / Signal::wordBits] |= Signal::Word(values[t] & 1U) << (t % Signal::wordBits);
+}
+
+size_t StrategyExpressionBatch::intern(const BatchNode& node, const string& key)
+{
+    const auto it = nodeIndexes.find(key);
+    if (it != nodeIndexes.end())
+        return it->second;
+
+    nodes.push_back(node);
+    predicateCount += node.type == BatchNode::Type::Predicate;
+    nodeIndexes.emplace(key, nodes.size() - 1);
+    return nodes.size() - 1;
+}
+
+size_t StrategyExpressionBatch::intern(const StrategyNodePtr& node)
+{
+    using Type = StrategyNode::Type;
+
+    // Negations of negations cancel.
+    auto negate = [this](size_t operand) {
+        if (nodes[operand].type == BatchNode::Type::Not)
+            return nodes[operand].left;
+
+        BatchNode negation;
+        negation.type = BatchNode::Type::Not;
+        negation.left = operand;
+        return intern(negation, "!" + to_string(operand));
+    };
+
+    switch (node->type)
+    {
+        case Type::Not:
+            return negate(intern(node->children[0]));
+
+        case Type::And:
+        case Type::Or:
+        {
+            BatchNode combination;
+            combination.type = node->type == Type::And ? BatchNode::Type::And : BatchNode::Type::Or;
+            combination.left = intern(node->children[0]);
+            combination.right = intern(node->children[1]);
+            return intern(combination, string(node->type == Type::And ? "&" : "|") + to_string(combination.left) +
+                                       "," + to_string(combination.right));
+        }
+
+        case Type::Greater:
+        case Type::GreaterEqual:
+        case Type::NotEqual:
+        {
+            // With the ordering of the scripting engine these are the negations of <=, < and ==.
+            auto complement = make_shared<StrategyNode>(*node);
+            complement->type = node->type == Type::Greater      ? Type::LessEqual :
+                               node->type == Type::GreaterEqual ? Type::Less : Type::Equal;
+            return negate(intern(complement));
+        }
+
+        default:
+        {
+            BatchNode predicate;
+            predicate.predicate = node;
+            return intern(predicate, canonical_key(*node));
+        }
+    }
+}
+
+size_t StrategyExpressionBatch::Add(const StrategyExpression& expression)
+{
+    if (expression.root == nullptr || !expression.root->IsBoolean())
+        throw invalid_argument("Only strategy expressions can be added to a batch.");
+
+    roots.push_back(intern(expression.root));
+    return roots.size() - 1;
+}
+
+void StrategyExpressionBatch::Evaluate(const StockData& stockData, vector<Signal>& signals,
+                                       vector<bool>& evaluated) const
+{
+    // Nodes are stored after their operands, so they are evaluated in order.
+    const size_t timePoints = stockData.dates.size();
+    vector<Signal> truth(nodes.size());
+    vector<Signal> failed(nodes.size());
+    vector<bool> valid(nodes.size(), false);
+    for (size_t i = 0; i < nodes.size(); i++)
+    {
+        const BatchNode& node = nodes[i];
+        switch (node.type)
+        {
+            case BatchNode::Type::Predicate:
+            {
+                StrategyColumn column;
+                valid[i] = evaluate_column(*node.predicate, stockData, timePoints, column);
+                if (valid[i])
+                {
+                    pack_column(column.truth, truth[i]);
+                    pack_column(column.failed, failed[i]);
+                }
+                break;
+            }
+
+            case BatchNode::Type::Not:
+                valid[i] = valid[node.left];
+                if (valid[i])
+                {
+                    truth[i] = truth[node.left];
+                    truth[i].Flip();
+                    failed[i] = failed[node.left];
+                }
+                break;
+
+            default:
+            {
+                valid[i] = valid[node.left] && valid[node.right];
+                if (!valid[i])
+                    break;
+
+                // The right operand is only evaluated, and can only fail, when the left one is true for a
+                // conjunction and false for a disjunction.
+                const bool conjunction = node.type == BatchNode::Type::And;
+                Signal rightFailed = truth[node.left];
+                if (!conjunction)
+                    rightFailed.Flip();
+                rightFailed &= failed[node.right];
+                failed[i] = failed[node.left];
+                failed[i] |= rightFailed;
+
+                truth[i] = truth[node.left];
+                if (conjunction)
+                    truth[i] &= truth[node.right];
+                else
+                    truth[i] |= truth[node.right];
+                break;
+            }
+        }
+    }
+
+    signals.assign(roots.size(), Signal());
+    evaluated.assign(roots.size(), false);
+    for (size_t e = 0; e < roots.size(); e++)
+    {
+        if (!valid[roots[e]])
+            continue;
+
+        Signal passed = failed[roots[e]];
+        passed.Flip();
+        signals[e] = truth[roots[e]];
+        signals[e] &= passed;
+        evaluated[e] = true;
+    }
+}
+
+/****************************
+*     C++ translation       *
+****************************/
+
+/// Series leaves of the expression in depth-first order, which is the order of the series given to the C++ code.
+void collect_leaves(const StrategyNode& node, vector<const StrategyNode*>& leaves)
+{
+    if (node.type == StrategyNode::Type::Indicator || node.type == StrategyNode::Type::Derived ||
+        node.type == StrategyNode::Type::Quantile)
+        leaves.push_back(&node);
+
+    for (const StrategyNodePtr& child : node.children)
+        collect_leaves(*child, leaves);
+}
+
+bool StrategyExpression::TryResolveSeries(const StockData& stockData, vector<SeriesView>& series) const
+{
+    if (root == nullptr)
+        return false;
+
+    vector<const Node*> leaves;
+    collect_leaves(*root, leaves);
+
+    vector<SeriesView> output;
+    for (const Node* leaf : leaves)
+    {
+        if (leaf->type == Node::Type::Indicator)
+            output.push_back(stockData.Series(leaf->indicator));
+        else if (leaf->type == Node::Type::Quantile)
+            output.push_back(stockData.QuantileSeries(leaf->indicator, leaf->percentile));
+        else
+        {
+            size_t index = 0;
+            if (!stockData.TryDerivedIndex(leaf->derivedName, index))
+                return false;
+            output.push_back(stockData.DerivedSeries(index));
+        }
+    }
+
+    series = std::move(output);
+    return true;
+}
+
+/// Helpers of the generated code, with the semantics of the column evaluation.
+const char* const cpp_prelude = R"(#include <cstddef>
+
+static inline double read(const SeriesValue* series, size_t size, size_t t, size_t lag, bool& ok)
+{
+    if (t < lag || t - lag >= size)
+    {
+        ok = false;
+        return 0.0;
+    }
+    return series[t - lag];
+}
+
+static inline double divide(double a, double b, bool& ok)
+{
+    if (b == 0.0)
+    {
+        ok = false;
+        return 0.0;
+    }
+    return a / b;
+}
+
+static inline bool less(double a, double b) { return a < b; }
+static inline bool less_equal(double a, double b) { return a < b || a == b; }
+static inline bool greater(double a, double b) { return !(a < b || a == b); }
+static inline bool greater_equal(double a, double b) { return !(a < b); }
+static inline bool equal(double a, double b) { return a == b; }
+static inline bool not_equal(double a, double b) { return !(a == b); }
+
+)";
+
+void node_to_cpp(const StrategyNode& node, const vector<const StrategyNode*>& leaves, ostringstream& out)
+{
+    using Type = StrategyNode::Type;
+
+    const auto binary = [&](const char* function) {
+        out << function << "(";
+        node_to_cpp(*node.children[0], leaves, out);
+        out << ", ";
+        node_to_cpp(*node.children[1], leaves, out);
+        out << (node.type == Type::Divide ? ", ok)" : ")");
+    };
+    const auto infix = [&](const char* op) {
+        out << "(";
+        node_to_cpp(*node.children[0], leaves, out);
+        out << " " << op << " ";
+        node_to_cpp(*node.children[1], leaves, out);
+        out << ")";
+    };
+
+    switch (node.type)
+    {
+        case Type::Constant:
+            out << "double(" << node.constant << ")";
+            break;
+        case Type::Indicator:
+        case Type::Derived:
+        case Type::Quantile:
+        {
+            const size_t k = size_t(find(leaves.begin(), leaves.end(), &node) - leaves.begin());
+            out << "read(data[" << k << "], sizes[" << k << "], t, " << node.lag << ", ok)";
+            break;
+        }
+        case Type::Negate:
+            out << "(-";
+            node_to_cpp(*node.children[0], leaves, out);
+            out << ")";
+            break;
+        case Type::Not:
+            out << "(!";
+            node_to_cpp(*node.children[0], leaves, out);
+            out << ")";
+            break;
+        case Type::Add: infix("+"); break;
+        case Type::Subtract: infix("-"); break;
+        case Type::Multiply: infix("*"); break;
+        case Type::Divide: binary("divide"); break;
+        case Type::Less: binary("less"); break;
+        case Type::LessEqual: binary("less_equal"); break;
+        case Type::Greater: binary("greater"); break;
+        case Type::GreaterEqual: binary("greater_equal"); break;
+        case Type::Equal: binary("equal"); break;
+        case Type::NotEqual: binary("not_equal"); break;
+        case Type::And: infix("&&"); break;
+        case Type::Or: infix("||"); break;
+    }
+}
+
+string StrategyExpression::ToCpp() const
+{
+    vector<const Node*> leaves;
+    if (root != nullptr)
+        collect_leaves(*root, leaves);
+
+    ostringstream out;
+    out.precision(17);
+    string comment = program;
+    replace(comment.begin(), comment.end(), '\n', ' ');
+    replace(comment.begin(), comment.end(), '\r', ' ');
+    out << "// Strategy: " << comment << "\n";
+    out << "typedef " << (sizeof(SeriesValue) == sizeof(float) ? "float" : "double") << " SeriesValue;\n";
+    out << cpp_prelude;
+    out << "extern \"C\" void backtester_strategy(const SeriesValue* const* data, const size_t* sizes, "
+           "size_t timePoints, unsigned char* signals)\n{\n";
+    out << "    for (size_t t = 0; t < timePoints; t++)\n    {\n";
+    out << "        bool ok = true;\n";
+    out << "        const bool result = ";
+    if (root != nullptr)
+        node_to_cpp(*root, leaves, out);
+    else
+        out << "false";
+    out << ";\n";
+    out << "        signals[t] = result && ok;\n";
+    out << "    }\n}\n";
+    return out.str();
+}
@@ -0,0 +1,144 @@
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <stdexcept>
+#include "wavelet_tree.h"
+using namespace std;
+using namespace backtester;
+
+/****************************
+*       Rank directory      *
+****************************/
+
+unsigned popcount(uint64_t x)
+{
+    x = x - ((x >> 1) & 0x5555555555555555ULL);
+    x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+    x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    return unsigned((x * 0x0101010101010101ULL) >> 56);
+}
+
+size_t WaveletTree::Level::Rank0(size_t position) const
+{
+    const size_t word = position / 64;
+    const unsigned offset = position % 64;
+    size_t ones = ranks[word];
+    if (offset != 0)
+        ones += popcount(bits[word] & ((uint64_t(1) << offset) - 1));
+
+    return position - ones;
+}
+
+/****************************
+*       Construction        *
+****************************/
+
+WaveletTree::WaveletTree(const vector<double>& series)
+{
+    const vector<SeriesValue> stored(series.begin(), series.end());
+    *this = WaveletTree(stored.data(), stored.data() + stored.size());
+}
+
+WaveletTree::WaveletTree(const SeriesValue* begin, const SeriesValue* end) : size(size_t(end - begin))
+{
+    // Map the values to their rank among the distinct values. NaN gets the largest code.
+    const auto isNan = [](SeriesValue x) { return std::isnan(x); };
+    alphabet.assign(begin, end);
+    alphabet.erase(remove_if(alphabet.begin(), alphabet.end(), isNan), alphabet.end());
+    sort(alphabet.begin(), alphabet.end());
+    alphabet.erase(unique(alphabet.begin(), alphabet.end()), alphabet.end());
+    const auto finiteEnd = (long) alphabet.size();
+    if (any_of(begin, end, isNan))
+        alphabet.push_back(numeric_limits<SeriesValue>::quiet_NaN());
+
+    vector<uint32_t> codes(size);
+    for (size_t i = 0; i < size; i++)
+    {
+        codes[i] = std::isnan(begin[i]) ? uint32_t(finiteEnd)
+                   : uint32_t(lower_bound(alphabet.begin(), alphabet.begin() + finiteEnd, begin[i]) - alphabet.begin());
+    }
+
+    unsigned levelCount = 1;
+    while ((size_t(1) << levelCount) < alphabet.size())
+        levelCount++;
+
+    // Each level stores one bit of the codes, from the most significant one, and stably moves the zeros first.
+    levels.resize(levelCount);
+    vector<uint32_t> zeros, ones;
+    for (unsigned l = 0; l < levelCount; l++)
+    {
+        const unsigned bit = levelCount - 1 - l;
+        Level& level = levels[l];
+        level.bits.assign(size / 64 + 1, 0);
+        level.ranks.assign(size / 64 + 1, 0);
+
+        zeros.clear();
+        ones.clear();
+        for (size_t i = 0; i < size; i++)
+        {
+            if ((codes[i] >> bit) & 1u)
+            {
+                level.bits[i / 64] |= uint64_t(1) << (i % 64);
+                ones.push_back(codes[i]);
+            }
+            else
+                zeros.push_back(codes[i]);
+        }
+
+        for (size_t w = 1; w < level.ranks.size(); w++)
+            level.ranks[w] = level.ranks[w - 1] + popcount(level.bits[w - 1]);
+
+        level.zeros = zeros.size();
+        codes.assign(zeros.begin(), zeros.end());
+        codes.insert(codes.end(), ones.begin(), ones.end());
+    }
+}
+
+/****************************
+*          Queries          *
+****************************/
+
+double WaveletTree::KthSmallest(size_t begin, size_t end, size_t k) const
+{
+    if (begin > end || end > size || k >= end - begin)
+        throw out_of_range("Invalid range quantile query.");
+
+    uint32_t code = 0;
+    for (const Level& level : levels)
+    {
+        const size_t zerosBegin = level.Rank0(begin);
+        const size_t zerosEnd = level.Rank0(end);
+        const size_t zerosInRange = zerosEnd - zerosBegin;
+
+        code <<= 1;
+        if (k < zerosInRange)
+        {
+            begin = zerosBegin;
+            end = zerosEnd;
+        }
+        else
+        {
+            k -= zerosInRange;
+            begin = level.zeros + (begin - zerosBegin);
+            end = level.zeros + (end - zerosEnd);
+            code |= 1u;
+        }
+    }
+
+    return alphabet[code];
+}
+
+double WaveletTree::Quantile(size_t begin, size_t end, double percentile) const
+{
+    if (begin >= end)
+        return numeric_limits<double>::quiet_NaN();
+
+    const size_t count = end - begin;
+    if (count == 1)
+        return KthSmallest(begin, end, 0);
+
+    // Same position of interest as Indicator::CalculateQuantile.
+    const double poi = (1 - percentile) * -0.5 + percentile * (double(count) - 0.5);
+    const size_t k = std::min(size_t(std::max(int64_t(std::floor(poi)), int64_t(0))), count - 1);
+    return KthSmallest(begin, end, k);
+}
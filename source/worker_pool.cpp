@@ -0,0 +1,99 @@
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <future>
+#include <stdexcept>
+#include "worker_pool.h"
+#include "thread_pool.h"
+using namespace std;
+using namespace backtester;
+
+/// The pool, created on first use, and the thread count requested before it was created.
+unique_ptr<BS::thread_pool> worker_pool;
+unsigned worker_pool_thread_count = 0;
+mutex worker_pool_mutex;
+
+/// True in the threads of the pool while they run a task.
+thread_local bool in_worker_pool = false;
+
+/****************************
+*           Pool            *
+****************************/
+
+BS::thread_pool& get_worker_pool()
+{
+    lock_guard<mutex> lock(worker_pool_mutex);
+    if (worker_pool == nullptr)
+        worker_pool = make_unique<BS::thread_pool>(worker_pool_thread_count);
+
+    return *worker_pool;
+}
+
+void WorkerPool::SetThreadCount(unsigned threadCount)
+{
+    // Resizing waits for the running tasks, so it would never return when called from one of them.
+    if (in_worker_pool)
+        throw logic_error("The worker pool cannot be resized from one of its tasks.");
+
+    lock_guard<mutex> lock(worker_pool_mutex);
+    worker_pool_thread_count = threadCount;
+    if (worker_pool != nullptr)
+        worker_pool->reset(threadCount);
+}
+
+unsigned WorkerPool::ThreadCount()
+{
+    return get_worker_pool().get_thread_count();
+}
+
+/****************************
+*      Parallel loops       *
+****************************/
+
+/// Marks the current thread as running a task of the pool for the lifetime of the object.
+struct WorkerScope
+{
+    WorkerScope() { in_worker_pool = true; }
+    ~WorkerScope() { in_worker_pool = false; }
+};
+
+void WorkerPool::ParallelFor(size_t count, const function<void(size_t)>& task)
+{
+    // Run in place when there is nothing to distribute, or when called from a worker, which would otherwise wait for
+    // tasks queued behind itself.
+    if (count == 1 || in_worker_pool)
+    {
+        for (size_t i = 0; i < count; i++)
+            task(i);
+        return;
+    }
+
+    BS::thread_pool& pool = get_worker_pool();
+    vector<future<void>> results;
+    results.reserve(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        results.push_back(pool.submit([&task, i]() {
+            WorkerScope scope;
+            task(i);
+        }));
+    }
+
+    // Wait for every task before rethrowing, since they refer to the caller's state.
+    exception_ptr error;
+    for (future<void>& result : results)
+    {
+        try
+        {
+            result.get();
+        }
+        catch (...)
+        {
+            if (error == nullptr)
+                error = current_exception();
+        }
+    }
+
+    if (error != nullptr)
+        rethrow_exception(error);
+}
@@ -1,16 +1,25 @@
+#include <cmath>
+#include <thread>
+#include <fstream>
+#include <cereal/archives/binary.hpp>
 #include <doctest.h>
 #include "../include/loader.h"
 #include "../include/backtester.h"
+#include "../include/indicators.h"
+#include "../include/filesystem.h"
+#include "../include/worker_pool.h"
+#include "../include/strategy_expression.h"
+#include "../include/native_strategy.h"
 using namespace std;
 using namespace backtester;
 
 TEST_CASE("Test strategy results")
 {
     Dataset dataset = Loader::LoadDataset("../dataset");
-    Evaluator::SetStrategyEvaluatorDataset(dataset);
+    Evaluator evaluator(dataset);
 
     const string strategyProgram = R"(Indicator("EMA", stock, time) < Indicator("ClosePrice", stock, time))";
-    vector<bool> strategyResults = Evaluator::RunStrategy(strategyProgram, "AAPL");
+    Signal strategyResults = evaluator.RunStrategy(strategyProgram, "AAPL");
 
     CHECK((strategyResults.at(13) == false));
     CHECK((strategyResults.at(14) == true));
@@ -19,13 +28,13 @@ TEST_CASE("Test strategy results")
 TEST_CASE("Test backtester")
 {
     Dataset dataset = Loader::LoadDataset("../dataset");
-    Evaluator::SetStrategyEvaluatorDataset(dataset);
+    Evaluator evaluator(dataset);
 
     const string strategyProgram = R"(Indicator("EMA", stock, time) < Indicator("ClosePrice", stock, time))";
     CHECK((Evaluator::ValidateStrategyProgram(strategyProgram).first == true));
 
-    vector<bool> strategyResults = Evaluator::RunStrategy(strategyProgram, "AAPL");
-    vector<ExecutionData> executionData = Backtester::BacktestStoplossProfittake(strategyResults, "AAPL",
+    Signal strategyResults = evaluator.RunStrategy(strategyProgram, "AAPL");
+    vector<ExecutionData> executionData = Backtester::BacktestStoplossProfittake(evaluator, strategyResults, "AAPL",
                                                                                  0.05, 0.05, 0.05);
 
     vector<double> returns = Returns::SimpleReturns(executionData, 0.05);
@@ -38,13 +47,13 @@ TEST_CASE("Test backtester")
 TEST_CASE("Test backtester ind quantile")
 {
     Dataset dataset = Loader::LoadDataset("../dataset");
-    Evaluator::SetStrategyEvaluatorDataset(dataset);
+    Evaluator evaluator(dataset);
 
     const string strategyProgram = R"(Indicator("EMA", stock, time) < IndQuantile("ClosePrice", "0.75",  stock, time))";
     CHECK((Evaluator::ValidateStrategyProgram(strategyProgram).first == true));
 
-    vector<bool> strategyResults = Evaluator::RunStrategy(strategyProgram, "AAPL");
-    vector<ExecutionData> executionData = Backtester::BacktestStoplossProfittake(strategyResults, "AAPL",
+    Signal strategyResults = evaluator.RunStrategy(strategyProgram, "AAPL");
+    vector<ExecutionData> executionData = Backtester::BacktestStoplossProfittake(evaluator, strategyResults, "AAPL",
                                                                                  0.05, 0.05, 0.05);
 
     vector<double> returns = Returns::SimpleReturns(executionData, 0.05);
@@ -56,17 +65,17 @@ TEST_CASE("Test backtester ind quantile")
 TEST_CASE("Test parallel backtester")
 {
     Dataset dataset = Loader::LoadDataset("../dataset");
-    Evaluator::SetStrategyEvaluatorDataset(dataset);
+    Evaluator evaluator(dataset);
 
     const string strategyProgram = R"(Indicator("EMA", stock, time) < Indicator("ClosePrice", stock, time))";
     CHECK((Evaluator::ValidateStrategyProgram(strategyProgram).first == true));
 
-    map<string, vector<bool>> strategyResults = Evaluator::RunStrategyAllStocks(strategyProgram);
+    map<string, Signal> strategyResults = evaluator.RunStrategyAllStocks(strategyProgram);
 
     vector<double> returns;
     for (auto const& [key, val] : strategyResults)
     {
-        vector<ExecutionData> executionData = Backtester::BacktestStoplossProfittake(val, key,
+        vector<ExecutionData> executionData = Backtester::BacktestStoplossProfittake(evaluator, val, key,
                                                                                      0.05, 0.05, 0.05);
 
         double ret = VectorOps::Total(Returns::SimpleReturns(executionData, 0.05));
@@ -76,4 +85,787 @@ TEST_CASE("Test parallel backtester")
 
     double totalRet = VectorOps::Total(returns);
     CHECK((abs(totalRet) > 0));
-}
\ No newline at end of file
+}
+TEST_CASE("Test percentile rank strategy")
+{
+    Dataset dataset = Loader::LoadDataset("../dataset");
+    Evaluator evaluator(dataset);
+
+    const string rankProgram = R"(IndPercentileRank("ClosePrice", stock, time) > 0.75)";
+    CHECK((Evaluator::ValidateStrategyProgram(rankProgram).first == true));
+
+    Signal strategyResults = evaluator.RunStrategy(rankProgram, "AAPL");
+    vector<double> ranks = evaluator.IndPercentileRankTimeSeries("ClosePrice", "AAPL");
+
+    REQUIRE((strategyResults.size() == ranks.size()));
+    size_t mismatches = 0;
+    for (size_t i = 0; i < ranks.size(); i++)
+    {
+        if (ranks[i] <= 0.0 || ranks[i] >= 1.0 || strategyResults[i] != (ranks[i] > 0.75))
+            mismatches++;
+    }
+    CHECK((mismatches == 0));
+
+    // Out of range time indexes and stocks without ranks give NaN.
+    StockData withoutRanks(evaluator.Dates("AAPL"), evaluator.GetDataset().at("AAPL").IndicatorMap(),
+                           evaluator.GetDataset().at("AAPL").QuantileIndicatorMap());
+    CHECK(std::isnan(evaluator.IndPercentileRank("ClosePrice", "AAPL", -1)));
+    CHECK(std::isnan(evaluator.IndPercentileRank("ClosePrice", "AAPL", (int) ranks.size())));
+    CHECK(std::isnan(withoutRanks.PercentileRank(IndicatorId::ClosePrice, 0)));
+}
+
+TEST_CASE("Test quantile window strategy")
+{
+    Dataset dataset = Loader::LoadDataset("../dataset");
+    Evaluator evaluator(dataset);
+
+    CHECK((evaluator.IndQuantile("ClosePrice", "0.75", "AAPL", 100) ==
+           evaluator.IndQuantileWindow("ClosePrice", 0.75, 40, "AAPL", 100)));
+    CHECK((evaluator.IndQuantile("ClosePrice", "0.5", "AAPL", 100) ==
+           evaluator.IndQuantileWindow("ClosePrice", 0.5, 40, "AAPL", 100)));
+    CHECK_THROWS_AS((void) evaluator.IndQuantile("ClosePrice", "high", "AAPL", 100), invalid_argument);
+
+    // Windows that extend past the last bar are NaN.
+    const int timePoints = (int) evaluator.Dates("AAPL").size();
+    CHECK((!std::isnan(evaluator.RollingMean("ClosePrice", 20, "AAPL", timePoints))));
+    CHECK((std::isnan(evaluator.RollingMean("ClosePrice", 20, "AAPL", timePoints + 5))));
+    CHECK((std::isnan(evaluator.RollingStd("ClosePrice", 20, "AAPL", timePoints + 1))));
+    CHECK((std::isnan(evaluator.RollingVWAP(20, "AAPL", timePoints + 1))));
+
+    const string program = R"(Indicator("ClosePrice", stock, time) > IndQuantileWindow("ClosePrice", 0.9, 120, stock, time))";
+    CHECK((Evaluator::ValidateStrategyProgram(program).first == true));
+
+    Signal strategyResults = evaluator.RunStrategy(program, "AAPL");
+    vector<double> close = evaluator.IndicatorTimeSeries("ClosePrice", "AAPL");
+    size_t mismatches = 0;
+    for (size_t t = 1; t < close.size(); t++)
+    {
+        vector<double> window(close.begin() + (long) (t < 120 ? 0 : t - 120), close.begin() + (long) t);
+        const bool expected = close[t] > Indicator::CalculateQuantile(window, 0.9);
+        mismatches += strategyResults[t] != expected;
+    }
+    CHECK((mismatches == 0));
+}
+
+TEST_CASE("Test rolling correlation")
+{
+    Dataset dataset = Loader::LoadDataset("../dataset");
+    Evaluator evaluator(dataset);
+    evaluator.ComputeCorrelations(60);
+
+    // Brute force over the aligned returns of the last 60 calendar dates.
+    const CorrelationMatrix matrix(dataset, 60);
+    const vector<string> calendar = matrix.Calendar();
+    auto returns_on_calendar = [&](const string& stock) {
+        map<string, double> returns;
+        const vector<double> close = evaluator.IndicatorTimeSeries("ClosePrice", stock);
+        for (size_t t = 1; t < close.size(); t++)
+            returns[dataset.at(stock).dates[t]] = close[t] / close[t - 1] - 1.0;
+        return returns;
+    };
+    const map<string, double> aapl = returns_on_calendar("AAPL"), zion = returns_on_calendar("ZION");
+
+    const size_t time = 500;
+    const string& date = dataset.at("AAPL").dates[time];
+    const size_t c = size_t(lower_bound(calendar.begin(), calendar.end(), date) - calendar.begin());
+    vector<double> x, y;
+    for (size_t i = c + 1 - 60; i <= c; i++)
+    {
+        if (aapl.count(calendar[i]) && zion.count(calendar[i]))
+        {
+            x.push_back(aapl.at(calendar[i]));
+            y.push_back(zion.at(calendar[i]));
+        }
+    }
+    double mx = 0.0, my = 0.0, sxy = 0.0, sxx = 0.0, syy = 0.0;
+    for (size_t i = 0; i < x.size(); i++)
+    {
+        mx += x[i] / double(x.size());
+        my += y[i] / double(y.size());
+    }
+    for (size_t i = 0; i < x.size(); i++)
+    {
+        sxy += (x[i] - mx) * (y[i] - my);
+        sxx += (x[i] - mx) * (x[i] - mx);
+        syy += (y[i] - my) * (y[i] - my);
+    }
+
+    CHECK((evaluator.RollingCorrelation("AAPL", "ZION", (int) time) == doctest::Approx(sxy / std::sqrt(sxx * syy)).epsilon(1e-5)));
+    CHECK((evaluator.RollingBeta("AAPL", "ZION", (int) time) == doctest::Approx(sxy / syy).epsilon(1e-5)));
+    CHECK((matrix.Correlation("ZION", "AAPL", (int) (lower_bound(dataset.at("ZION").dates.begin(), dataset.at("ZION").dates.end(), date) - dataset.at("ZION").dates.begin()))
+           == doctest::Approx(sxy / std::sqrt(sxx * syy)).epsilon(1e-5)));
+
+    const string program = R"(RollingCorrelation(stock, "ZION", time) > 0.5)";
+    CHECK((Evaluator::ValidateStrategyProgram(program).first == true));
+    Signal strategyResults = evaluator.RunStrategy(program, "AAPL");
+    vector<double> correlations = matrix.CorrelationTimeSeries("AAPL", "ZION");
+    size_t mismatches = 0;
+    for (size_t t = 1; t < correlations.size(); t++)
+        mismatches += !std::isnan(correlations[t]) && strategyResults[t] != (correlations[t] > 0.5);
+    CHECK((mismatches == 0));
+    CHECK((std::isnan(evaluator.RollingCorrelation("AAPL", "ZION", -1))));
+    CHECK((std::isnan(evaluator.RollingBeta("AAPL", "AAPL", -1))));
+
+    // Pairs evicted from a cache of one pair are computed again with the same moments.
+    Dataset triple = dataset;
+    triple["ZION2"] = dataset.at("ZION");
+    const CorrelationMatrix smallCache(triple, 60, 1);
+    auto same = [](double x, double y) { return std::isnan(x) ? std::isnan(y) : x == y; };
+    mismatches = 0;
+    for (size_t t = 0; t < correlations.size(); t += 97)
+    {
+        for (const string other : { "ZION", "ZION2" })
+        {
+            mismatches += !same(smallCache.Correlation("AAPL", other, (int) t), correlations[t]);
+            mismatches += !same(smallCache.Beta("AAPL", other, (int) t), matrix.Beta("AAPL", "ZION", (int) t));
+        }
+    }
+    CHECK((mismatches == 0));
+}
+
+TEST_CASE("Test compiled strategy cache")
+{
+    Dataset dataset = Loader::LoadDataset("../dataset");
+    Evaluator evaluator(dataset);
+
+    // The time condition keeps the program out of the native subset, so that it is compiled by the scripting engine.
+    const string strategyProgram = R"(Indicator("ClosePrice", stock, time) > Indicator("SMA", stock, time) * 1.0123 && time >= 0)";
+    const size_t compiledBefore = Evaluator::CompiledStrategyCount();
+    Signal first = evaluator.RunStrategy(strategyProgram, "AAPL");
+    Signal second = evaluator.RunStrategy(strategyProgram, "ZION");
+    Signal third = evaluator.RunStrategy(strategyProgram, "AAPL");
+
+    CHECK((Evaluator::CompiledStrategyCount() == compiledBefore + 1));
+    CHECK((first == third));
+    CHECK((evaluator.RunStrategyAllStocks(strategyProgram).at("ZION") == second));
+}
+
+TEST_CASE("Test pre-bound indicator series")
+{
+    Dataset dataset = Loader::LoadDataset("../dataset");
+    Evaluator evaluator(dataset);
+
+    const string boundProgram = R"(Indicator("ClosePrice", stock, time) > Indicator( "SMA" , stock, time - (time > 0 ? 1 : 0)))";
+    const string lookupProgram = R"(Indicator("Close" + "Price", stock, time) > Indicator("S" + "MA", stock, time - (time > 0 ? 1 : 0)))";
+    const string handleProgram = R"(GetSeries("ClosePrice", stock)[time] > GetSeries("SMA", stock)[time - (time > 0 ? 1 : 0)])";
+
+    for (const string stock : {"AAPL", "ZION"})
+    {
+        Signal bound = evaluator.RunStrategy(boundProgram, stock);
+        CHECK((bound == evaluator.RunStrategy(lookupProgram, stock)));
+        CHECK((bound == evaluator.RunStrategy(handleProgram, stock)));
+    }
+}
+
+TEST_CASE("Test script series views")
+{
+    Dataset dataset = Loader::LoadDataset("../dataset");
+    for (auto& [stock, stockData] : dataset)
+        stockData.AddDerivedIndicator("CloseCopy", "", stockData.Series(IndicatorId::ClosePrice).ToVector());
+    Evaluator evaluator(dataset);
+
+    // Close above the EMA for the last three bars, with one lookup per lag or one read per lag of a view.
+    const string lookupProgram = R"(time >= 2 && Indicator("ClosePrice", stock, time) > Indicator("EMA", stock, time) &&
+        Indicator("ClosePrice", stock, time - 1) > Indicator("EMA", stock, time - 1) &&
+        Indicator("ClosePrice", stock, time - 2) > Indicator("EMA", stock, time - 2))";
+    const string viewProgram = R"(time >= 2 && time < GetSeries("ClosePrice", stock).length() &&
+        GetSeries("ClosePrice", stock)[time] > GetSeries("EMA", stock)[time] &&
+        GetSeries("ClosePrice", stock)[time - 1] > GetSeries("EMA", stock)[time - 1] &&
+        GetSeries("ClosePrice", stock)[time - 2] > GetSeries("EMA", stock)[time - 2])";
+    const string quantileProgram = R"(GetQuantileSeries("ClosePrice", "0.85", stock)[time] < GetSeries("CloseCopy", stock)[time] &&
+        GetPercentileRankSeries("ClosePrice", stock)[time] > 0.5)";
+    const string quantileLookupProgram = R"(IndQuantile("ClosePrice", "0.85", stock, time) < Indicator("CloseCopy", stock, time) &&
+        IndPercentileRank("ClosePrice", stock, time) > 0.5)";
+    const string outOfRangeProgram = R"(GetSeries("ClosePrice", stock)[time + 1] > 0)";
+
+    CHECK(Evaluator::ValidateStrategyProgram(viewProgram).first);
+    size_t mismatches = 0;
+    for (const string stock : {"AAPL", "ZION"})
+    {
+        const Signal lookup = evaluator.RunStrategy(lookupProgram, stock);
+        mismatches += lookup.Count() == 0;
+        mismatches += evaluator.RunStrategy(viewProgram, stock) != lookup;
+        mismatches += evaluator.RunStrategy(quantileProgram, stock) != evaluator.RunStrategy(quantileLookupProgram, stock);
+
+        // Reads past the last bar raise a script exception, so only the last bar is false.
+        const Signal outOfRange = evaluator.RunStrategy(outOfRangeProgram, stock);
+        mismatches += outOfRange.size() == 0 || outOfRange[outOfRange.size() - 1];
+        mismatches += outOfRange.Count() != outOfRange.size() - 1;
+    }
+    CHECK((mismatches == 0));
+}
+
+TEST_CASE("Test strategy profiler")
+{
+    const Evaluator evaluator(Loader::LoadDataset("../dataset"));
+
+    // The first indicator is looked up by name on every bar and the second one is read from its pre-bound series.
+    const string program = "Indicator(\"Close\" + \"Price\", stock, time) >\n    Indicator(\"SMA\", stock, time)";
+    const StrategyProfile profile = evaluator.ProfileStrategy(program, "AAPL");
+    const size_t bars = evaluator.Dates("AAPL").size();
+
+    map<string, size_t> calls;
+    for (const AccessorProfile& accessor : profile.accessors)
+        calls[accessor.name] = accessor.calls;
+
+    CHECK((profile.bars == bars));
+    REQUIRE((profile.lines.size() == 1));
+    CHECK((profile.lines[0].line == 1));
+    CHECK((profile.lines[0].hits == bars));
+    CHECK((profile.lines[0].source == "Indicator(\"Close\" + \"Price\", stock, time) >"));
+    CHECK((calls["Indicator"] == bars));
+    CHECK((calls["Series[]"] == bars));
+    CHECK((profile.ToString().find("Series[]") != string::npos));
+    CHECK_THROWS_AS((void) evaluator.ProfileStrategy("time >", "AAPL"), invalid_argument);
+}
+
+TEST_CASE("Test native strategy expressions")
+{
+    Dataset dataset = Loader::LoadDataset("../dataset");
+    for (auto& [stock, stockData] : dataset)
+    {
+        // Close price with a NaN every seventh bar, to check that comparisons order NaN like the scripting engine.
+        vector<double> series = stockData.Series(IndicatorId::ClosePrice).ToVector();
+        for (size_t t = 0; t < series.size(); t += 7)
+            series[t] = numeric_limits<double>::quiet_NaN();
+        stockData.AddDerivedIndicator("SparseClose", "", series);
+    }
+    Evaluator evaluator(dataset);
+
+    const vector<string> programs {
+        R"(Indicator("ClosePrice", stock, time) > Indicator("SMA", stock, time) * 1.0123)",
+        R"(Indicator("EMA", stock, time - 1) <= Indicator("SMA", stock, time - 2) || !(Indicator("RSI", stock, time) >= 70))",
+        R"(Indicator("SparseClose", stock, time) > Indicator("SMA", stock, time) and Indicator("ClosePrice", stock, time - 1) != 0)",
+        R"(Indicator("SparseClose", stock, time) < Indicator("SMA", stock, time) or Indicator("SMA", stock, time) >= Indicator("SparseClose", stock, time))",
+        R"(Indicator("SparseClose", stock, time) == Indicator("ClosePrice", stock, time) && -Indicator("ROC", stock, time) / 2 < 0.5)",
+        R"(IndQuantile("ClosePrice", "0.85", stock, time) < Indicator("ClosePrice", stock, time) - 1e-3 * Indicator("OBV", stock, time - 3))",
+        R"(Indicator("ClosePrice", stock, time) / (Indicator("OpenPrice", stock, time) - Indicator("OpenPrice", stock, time)) > 1 || Indicator("RSI", stock, time) > 50)"
+    };
+
+    size_t mismatches = 0;
+    for (const string& program : programs)
+    {
+        CHECK(Evaluator::IsNativeStrategy(program));
+
+        // Appending a condition outside the native subset runs the same program in the scripting engine.
+        const string scriptProgram = "(" + program + ") && time >= 0";
+        CHECK_FALSE(Evaluator::IsNativeStrategy(scriptProgram));
+        for (const string stock : {"AAPL", "ZION"})
+            mismatches += evaluator.RunStrategy(program, stock) != evaluator.RunStrategy(scriptProgram, stock);
+    }
+    CHECK((mismatches == 0));
+
+    CHECK_FALSE(Evaluator::IsNativeStrategy(R"(Indicator("ClosePrice", stock, time) > 1 / 2)"));
+    CHECK_FALSE(Evaluator::IsNativeStrategy(R"(IndQuantile("ClosePrice", "0.5", stock, time) > 0)"));
+    CHECK_FALSE(Evaluator::IsNativeStrategy(R"(Indicator("ClosePrice", stock, time))"));
+}
+
+TEST_CASE("Test shared predicates")
+{
+    Dataset dataset = Loader::LoadDataset("../dataset");
+    for (auto& [stock, stockData] : dataset)
+    {
+        vector<double> series = stockData.Series(IndicatorId::ClosePrice).ToVector();
+        for (size_t t = 0; t < series.size(); t += 5)
+            series[t] = numeric_limits<double>::quiet_NaN();
+        stockData.AddDerivedIndicator("SparseClose", "", series);
+    }
+    Evaluator evaluator(dataset);
+
+    const vector<string> programs {
+        R"(Indicator("EMA", stock, time) < Indicator("ClosePrice", stock, time))",
+        R"(Indicator("EMA", stock, time) < Indicator("ClosePrice", stock, time) && Indicator("RSI", stock, time) > 50)",
+        R"(!(Indicator("EMA", stock, time) >= Indicator("ClosePrice", stock, time)) || Indicator("RSI", stock, time) > 50)",
+        R"(Indicator("SparseClose", stock, time) == Indicator("ClosePrice", stock, time) and Indicator("ClosePrice", stock, time) / (Indicator("OpenPrice", stock, time) - Indicator("OpenPrice", stock, time)) > 1)",
+        R"(Indicator("ClosePrice", stock, time) != Indicator("SparseClose", stock, time) or Indicator("RSI", stock, time) <= 50)"
+    };
+
+    // EMA < close, RSI <= 50, SparseClose == close and the division by zero are the only distinct comparisons.
+    StrategyExpressionBatch batch;
+    for (const string& program : programs)
+    {
+        StrategyExpression expression;
+        REQUIRE(StrategyExpression::TryCompile(program, expression));
+        batch.Add(expression);
+    }
+    CHECK((batch.Size() == programs.size()));
+    CHECK((batch.PredicateCount() == 4));
+
+    vector<string> scriptPrograms;
+    for (const string& program : programs)
+        scriptPrograms.push_back("(" + program + ") && time >= 0");
+
+    const vector<map<string, Signal>> shared = evaluator.RunStrategiesAllStocks(programs);
+    const vector<map<string, Signal>> scripts = evaluator.RunStrategiesAllStocks(scriptPrograms);
+    size_t mismatches = 0;
+    for (size_t i = 0; i < programs.size(); i++)
+    {
+        for (const string& stock : evaluator.GetStocksInDataset())
+            mismatches += shared[i].at(stock) != scripts[i].at(stock);
+    }
+    CHECK((mismatches == 0));
+}
+
+TEST_CASE("Test compiled native strategies")
+{
+    Dataset dataset = Loader::LoadDataset("../dataset");
+    Evaluator evaluator(dataset);
+
+    // The compiler runs without a shell, so the characters of the path are not interpreted.
+    const string cacheDirectory = "NativeStrategyCache $HOME `false` \"quoted\"";
+    FileSystem::Delete(cacheDirectory);
+
+    const vector<string> programs {
+        R"(Indicator("ClosePrice", stock, time) > Indicator("SMA", stock, time) * 1.0123)",
+        R"(Indicator("EMA", stock, time - 1) <= Indicator("SMA", stock, time - 2) || !(Indicator("RSI", stock, time) >= 70))",
+        R"(IndQuantile("ClosePrice", "0.85", stock, time) < Indicator("ClosePrice", stock, time) - 1e-3 * Indicator("OBV", stock, time - 3))",
+        R"(Indicator("ClosePrice", stock, time) / (Indicator("OpenPrice", stock, time) - Indicator("OpenPrice", stock, time)) > 1 || Indicator("RSI", stock, time) > 50)"
+    };
+
+    size_t mismatches = 0;
+    for (const string& program : programs)
+    {
+        for (const string stock : {"AAPL", "ZION"})
+        {
+            evaluator.DisableNativeCompilation();
+            const Signal script = evaluator.RunStrategy("(" + program + ") && time >= 0", stock);
+            evaluator.EnableNativeCompilation(cacheDirectory);
+            mismatches += evaluator.RunStrategy(program, stock) != script;
+        }
+    }
+    evaluator.DisableNativeCompilation();
+
+    // The files of the compiling process are renamed to the shared names once complete.
+    size_t libraries = 0, processFiles = 0;
+    for (const string& file : FileSystem::FilesInDirectory(cacheDirectory))
+    {
+        libraries += FileSystem::FileExtension(file) == "so";
+        processFiles += count(file.begin(), file.end(), '.') != 1;
+    }
+
+    CHECK((mismatches == 0));
+    CHECK((libraries == programs.size()));
+    CHECK((processFiles == 0));
+
+    // A failed compilation is remembered, so the compiler is not run again, and leaves a marker for the next runs.
+    StrategyExpression expression;
+    NativeStrategy strategy;
+    CHECK(StrategyExpression::TryCompile(programs[0], expression));
+    const char* compiler = getenv("CXX");
+    const string previousCompiler = compiler != nullptr ? compiler : "";
+    setenv("CXX", "false", 1);
+    CHECK_FALSE(NativeStrategy::TryLoad(expression, cacheDirectory, strategy));
+
+    size_t failed = 0;
+    for (const string& file : FileSystem::FilesInDirectory(cacheDirectory))
+    {
+        failed += FileSystem::FileExtension(file) == "failed";
+        if (FileSystem::FileExtension(file) == "log")
+            FileSystem::Delete(file);
+    }
+    CHECK_FALSE(NativeStrategy::TryLoad(expression, cacheDirectory, strategy));
+
+    size_t logs = 0;
+    for (const string& file : FileSystem::FilesInDirectory(cacheDirectory))
+        logs += FileSystem::FileExtension(file) == "log";
+    if (compiler != nullptr)
+        setenv("CXX", previousCompiler.c_str(), 1);
+    else
+        unsetenv("CXX");
+
+    CHECK((failed == 1));
+    CHECK((logs == 0));
+    FileSystem::Delete(cacheDirectory);
+}
+
+TEST_CASE("Test bytecode cache")
+{
+    Dataset dataset = Loader::LoadDataset("../dataset");
+    Evaluator evaluator(dataset);
+
+    const string cacheDirectory = "BytecodeCache";
+    FileSystem::Delete(cacheDirectory);
+    evaluator.EnableBytecodeCache(cacheDirectory);
+
+    // Each thread has its own engine, so the second run can only skip the compilation by loading the bytecode.
+    const string program = R"(Indicator("ClosePrice", stock, time) > Indicator("EMA", stock, time) * 1.0117 && time >= 3)";
+    const size_t compiledBefore = Evaluator::CompiledStrategyCount();
+    Signal first, second;
+    thread([&]() { first = evaluator.RunStrategy(program, "AAPL"); }).join();
+    const size_t compiledAfterFirst = Evaluator::CompiledStrategyCount();
+    thread([&]() { second = evaluator.RunStrategy(program, "AAPL"); }).join();
+    const size_t compiledAfterSecond = Evaluator::CompiledStrategyCount();
+
+    // The cache is an option of the evaluator, so another evaluator does not use it.
+    const Evaluator other(dataset);
+    thread([&]() { (void) other.RunStrategy(program + " && time >= 4", "AAPL"); }).join();
+
+    size_t bytecodeFiles = 0;
+    for (const string& file : FileSystem::FilesInDirectory(cacheDirectory))
+        bytecodeFiles += FileSystem::FileExtension(file) == "asbc";
+
+    CHECK((compiledAfterFirst == compiledBefore + 1));
+    CHECK((compiledAfterSecond == compiledAfterFirst));
+    CHECK((bytecodeFiles == 1));
+    CHECK((first == second));
+    CHECK(Evaluator::ValidateStrategyProgram(program, cacheDirectory).first);
+
+    evaluator.DisableBytecodeCache();
+    FileSystem::Delete(cacheDirectory);
+}
+
+TEST_CASE("Test strategy batch")
+{
+    Dataset dataset = Loader::LoadDataset("../dataset");
+    Evaluator evaluator(dataset);
+
+    const vector<string> programs {
+        R"(Indicator("ClosePrice", stock, time) > Indicator("SMA", stock, time) * 1.0123)",
+        R"(Indicator("ClosePrice", stock, time) > Indicator("SMA", stock, time) * 1.0123 && time >= 0)",
+        R"(IndPercentileRank("RSI", stock, time) > 0.5 || time % 5 == 0)",
+        R"(Indicator("ClosePrice", stock, time) > Indicator("SMA", stock, time) * 1.0123)"
+    };
+
+    const vector<map<string, Signal>> batch = evaluator.RunStrategiesAllStocks(programs);
+    REQUIRE((batch.size() == programs.size()));
+
+    size_t mismatches = 0;
+    for (size_t i = 0; i < programs.size(); i++)
+    {
+        for (const string& stock : evaluator.GetStocksInDataset())
+            mismatches += batch[i].at(stock) != evaluator.RunStrategy(programs[i], stock);
+    }
+    CHECK((mismatches == 0));
+    CHECK((batch[0] == batch[1]));
+    CHECK((batch[0] == batch[3]));
+}
+
+TEST_CASE("Test concurrent evaluators")
+{
+    auto full = make_shared<const Dataset>(Loader::LoadDataset("../dataset"));
+    auto single = make_shared<const Dataset>(Dataset { { "ZION", full->at("ZION") } });
+    const Evaluator fullEvaluator(full);
+    const Evaluator singleEvaluator(single);
+
+    CHECK((singleEvaluator.GetStocksInDataset() == vector<string> { "ZION" }));
+    CHECK_FALSE(singleEvaluator.HasStock("AAPL"));
+    CHECK_THROWS_AS((void) singleEvaluator.Indicator("ClosePrice", "AAPL", 0), out_of_range);
+
+    // Both evaluators run the same strategies at once, through the native and the scripting paths.
+    const vector<string> programs {
+        R"(Indicator("EMA", stock, time) < Indicator("ClosePrice", stock, time))",
+        R"(IndPercentileRank("RSI", stock, time) > 0.5 || time % 5 == 0)"
+    };
+    vector<map<string, Signal>> fullResults, singleResults;
+    thread fullThread([&]() { fullResults = fullEvaluator.RunStrategiesAllStocks(programs); });
+    thread singleThread([&]() { singleResults = singleEvaluator.RunStrategiesAllStocks(programs); });
+    fullThread.join();
+    singleThread.join();
+
+    REQUIRE((fullResults.size() == programs.size()));
+    REQUIRE((singleResults.size() == programs.size()));
+    for (size_t i = 0; i < programs.size(); i++)
+    {
+        CHECK((fullResults[i].size() == 2));
+        CHECK((singleResults[i].size() == 1));
+        CHECK((singleResults[i].at("ZION") == fullResults[i].at("ZION")));
+        CHECK((fullResults[i].at("AAPL") == fullEvaluator.RunStrategy(programs[i], "AAPL")));
+    }
+}
+
+TEST_CASE("Test worker pool")
+{
+    const Evaluator evaluator(Loader::LoadDataset("../dataset"));
+    const string strategyProgram = R"(IndPercentileRank("RSI", stock, time) > 0.5 || time % 5 == 0)";
+    const map<string, Signal> expected = evaluator.RunStrategyAllStocks(strategyProgram);
+
+    WorkerPool::SetThreadCount(3);
+    CHECK((WorkerPool::ThreadCount() == 3));
+
+    // Nested loops run in place in the worker that starts them.
+    vector<size_t> sums(8, 0);
+    WorkerPool::ParallelFor(sums.size(), [&sums](size_t i) {
+        WorkerPool::ParallelFor(i + 1, [&sums, i](size_t j) { sums[i] += j; });
+    });
+    size_t mismatches = 0;
+    for (size_t i = 0; i < sums.size(); i++)
+        mismatches += sums[i] != i * (i + 1) / 2;
+    CHECK((mismatches == 0));
+
+    CHECK_THROWS_AS(WorkerPool::ParallelFor(4, [](size_t i) { if (i == 2) throw runtime_error("Task failed."); }),
+                    runtime_error);
+    CHECK((evaluator.RunStrategyAllStocks(strategyProgram) == expected));
+
+    WorkerPool::SetThreadCount(0);
+    CHECK((WorkerPool::ThreadCount() == max(1U, thread::hardware_concurrency())));
+    CHECK((evaluator.RunStrategyAllStocks(strategyProgram) == expected));
+}
+
+TEST_CASE("Test time range chunks")
+{
+    const Evaluator evaluator(Loader::LoadDataset("../dataset"));
+    const vector<string> programs {
+        R"(IndPercentileRank("RSI", stock, time) > 0.5 || time % 7 == 0)",
+        R"(Indicator("EMA", stock, time) < Indicator("ClosePrice", stock, time))",
+        R"(time > 0 && Indicator("ClosePrice", stock, time) > Indicator("ClosePrice", stock, time - 1))"
+    };
+
+    // Many workers split each stock into several ranges, which must be stitched back in order.
+    WorkerPool::SetThreadCount(4);
+    const vector<map<string, Signal>> batch = evaluator.RunStrategiesAllStocks(programs);
+    WorkerPool::SetThreadCount(0);
+
+    size_t mismatches = 0;
+    for (size_t i = 0; i < programs.size(); i++)
+    {
+        for (const string& stock : evaluator.GetStocksInDataset())
+        {
+            const Signal expected = evaluator.RunStrategy(programs[i], stock);
+            mismatches += batch[i].at(stock).size() != evaluator.Dates(stock).size();
+            mismatches += batch[i].at(stock) != expected;
+        }
+    }
+    CHECK((mismatches == 0));
+}
+
+TEST_CASE("Test incremental signal cache")
+{
+    const Dataset dataset = Loader::LoadDataset("../dataset");
+    const vector<string> programs {
+        R"(IndPercentileRank("RSI", stock, time) > 0.5 || time % 7 == 0)",
+        R"(time > 0 && Indicator("ClosePrice", stock, time) > Indicator("ClosePrice", stock, time - 1))",
+        R"(Indicator("ClosePrice", stock, time + 3) > Indicator("ClosePrice", stock, time))"
+    };
+
+    // Programs that read another stock or read further ahead than the cache margin are not cached.
+    const vector<string> uncachedPrograms {
+        R"(Indicator("ClosePrice", "ZION", time) > Indicator("ClosePrice", stock, time))",
+        R"(GetSeries("EMA", "ZION")[time] > 0 || time % 5 == 0)",
+        R"(Indicator("ClosePrice", stock, time + 100) > Indicator("ClosePrice", stock, time))"
+    };
+    vector<string> allPrograms = programs;
+    allPrograms.insert(allPrograms.end(), uncachedPrograms.begin(), uncachedPrograms.end());
+
+    // History of every stock before the last 37 bars were appended.
+    Dataset truncatedDataset;
+    for (const auto& [stock, stockData] : dataset)
+    {
+        const size_t timePoints = stockData.dates.size() - 37;
+        auto truncate = [timePoints](Indicators indicators) {
+            for (auto& [name, series] : indicators)
+                series.resize(timePoints);
+            return indicators;
+        };
+        QuantileIndicators quantiles = stockData.QuantileIndicatorMap();
+        for (auto& [percentile, indicators] : quantiles)
+            indicators = truncate(indicators);
+        truncatedDataset[stock] = StockData(vector<string>(stockData.dates.begin(), stockData.dates.begin() + (long) timePoints),
+                                            truncate(stockData.IndicatorMap()), quantiles,
+                                            truncate(stockData.PercentileRankMap()));
+    }
+
+    const string cacheDirectory = "SignalCache";
+    FileSystem::Delete(cacheDirectory);
+    const vector<map<string, Signal>> expected = Evaluator(dataset).RunStrategiesAllStocks(programs);
+
+    auto cachedEvaluator = [&cacheDirectory](const Dataset& history) {
+        Evaluator evaluator(history);
+        evaluator.EnableSignalCache(cacheDirectory);
+        return evaluator;
+    };
+    (void) cachedEvaluator(truncatedDataset).RunStrategiesAllStocks(programs);
+    for (const string& program : uncachedPrograms)
+        (void) cachedEvaluator(truncatedDataset).RunStrategyAllStocks(program);
+
+    // Flip the first cached bar, so that the signals taken from the cache can be told apart from evaluated ones.
+    size_t cachedFiles = 0;
+    for (const string& path : FileSystem::FilesInDirectory(cacheDirectory))
+    {
+        uint64_t timePoints = 0, layout = 0, checkpoint = 0;
+        vector<uint64_t> checkpointHashes, hashes;
+        vector<Signal::Word> words;
+        {
+            ifstream is(path, ios::binary);
+            cereal::BinaryInputArchive archive(is);
+            archive(timePoints, layout, checkpoint, checkpointHashes, hashes, words);
+        }
+        words[0] ^= 1;
+        ofstream os(path, ios::binary);
+        cereal::BinaryOutputArchive archive(os);
+        archive(timePoints, layout, checkpoint, checkpointHashes, hashes, words);
+        cachedFiles++;
+    }
+
+    // Appended bars are evaluated and the others are taken from the cache. The last cached bars of the program that
+    // reads ahead could not be evaluated before, and are evaluated again.
+    const vector<map<string, Signal>> incremental = cachedEvaluator(dataset).RunStrategiesAllStocks(programs);
+    const vector<map<string, Signal>> uncached = cachedEvaluator(dataset).RunStrategiesAllStocks(allPrograms);
+
+    // A revised bar before the checkpoint does not match the hashes of the history.
+    Dataset oldRevisedDataset = dataset;
+    for (auto& [stock, stockData] : oldRevisedDataset)
+    {
+        const size_t timePoints = stockData.dates.size();
+        stockData.indicatorValues[IndicatorRegistry::Index(IndicatorId::ClosePrice) * timePoints + 100] *= 2;
+    }
+    const vector<map<string, Signal>> oldRevised = cachedEvaluator(oldRevisedDataset).RunStrategiesAllStocks(programs);
+
+    // A revised bar between the checkpoint and the cached length does not match the hashes.
+    Dataset revisedDataset = dataset;
+    for (auto& [stock, stockData] : revisedDataset)
+    {
+        const size_t timePoints = stockData.dates.size();
+        stockData.indicatorValues[IndicatorRegistry::Index(IndicatorId::ClosePrice) * timePoints + timePoints - 40] *= 2;
+    }
+    const vector<map<string, Signal>> revised = cachedEvaluator(revisedDataset).RunStrategiesAllStocks(programs);
+
+    // A changed history does not match the fingerprint, so it is evaluated in full.
+    Dataset changedDataset = dataset;
+    for (auto& [stock, stockData] : changedDataset)
+        stockData.AddDerivedIndicator("CloseCopy", "", stockData.Series(IndicatorId::ClosePrice).ToVector());
+    const vector<map<string, Signal>> changed = cachedEvaluator(changedDataset).RunStrategiesAllStocks(programs);
+    const vector<map<string, Signal>> revisedExpected = Evaluator(revisedDataset).RunStrategiesAllStocks(programs);
+    const vector<map<string, Signal>> oldRevisedExpected = Evaluator(oldRevisedDataset).RunStrategiesAllStocks(programs);
+    const vector<map<string, Signal>> uncachedExpected = Evaluator(dataset).RunStrategiesAllStocks(uncachedPrograms);
+
+    size_t mismatches = 0;
+    for (size_t i = 0; i < programs.size(); i++)
+    {
+        for (const auto& [stock, signals] : expected[i])
+        {
+            Signal flipped = signals;
+            flipped.Set(0, !signals[0]);
+            mismatches += incremental[i].at(stock) != flipped;
+            mismatches += changed[i].at(stock) != signals;
+            mismatches += revised[i].at(stock) != revisedExpected[i].at(stock);
+            mismatches += oldRevised[i].at(stock) != oldRevisedExpected[i].at(stock);
+        }
+    }
+    for (size_t i = 0; i < uncachedPrograms.size(); i++)
+    {
+        for (const auto& [stock, signals] : uncachedExpected[i])
+            mismatches += uncached[programs.size() + i].at(stock) != signals;
+    }
+    CHECK((cachedFiles == programs.size() * dataset.size()));
+    CHECK((mismatches == 0));
+    FileSystem::Delete(cacheDirectory);
+}
+
+TEST_CASE("Test packed signals")
+{
+    vector<bool> values(130);
+    for (size_t t = 0; t < values.size(); t++)
+        values[t] = t % 7 == 0 || t == 127;
+
+    const Signal signal(values);
+    CHECK((signal.size() == 130));
+    CHECK((signal.Words().size() == 3));
+    CHECK((signal.ToVector() == values));
+    CHECK((signal.Count() == size_t(count(values.begin(), values.end(), true))));
+    CHECK((signal.FindNext(1) == 7));
+    CHECK((signal.FindNext(120) == 126));
+    CHECK((signal.FindNext(128) == 130));
+    CHECK_THROWS_AS((void) signal.at(130), out_of_range);
+
+    // The bits after the last bar are zero, so signals of the same bars compare equal.
+    const Signal full(70, true);
+    CHECK((full.Words()[1] == (Signal::Word(1) << 6) - 1));
+    CHECK((full.Count() == 70));
+    Signal cleared = full;
+    cleared.Set(69, false);
+    CHECK((cleared != full));
+    cleared.Set(69, true);
+    CHECK((cleared == full));
+
+    // Time stop backtests skip the words of false signals and enter at the same bars as a scan of every bar.
+    const Evaluator evaluator(Loader::LoadDataset("../dataset"));
+    const string strategyProgram = R"(Indicator("EMA", stock, time) < Indicator("ClosePrice", stock, time))";
+    const Signal strategyResults = evaluator.RunStrategy(strategyProgram, "AAPL");
+    const vector<ExecutionData> executions = Backtester::BacktestTimestopHit(evaluator, strategyResults, "AAPL", 5);
+
+    vector<size_t> entries;
+    for (size_t t = 0; t < strategyResults.size(); t += strategyResults[t] ? 5 : 1)
+    {
+        if (strategyResults[t])
+            entries.push_back(t);
+    }
+    REQUIRE((executions.size() == 2 * entries.size()));
+    size_t mismatches = 0;
+    for (size_t i = 0; i < entries.size(); i++)
+        mismatches += executions[2 * i].timeIndex != entries[i];
+    CHECK((mismatches == 0));
+    CHECK((!entries.empty()));
+}
+
+TEST_CASE("Test score strategies")
+{
+    const Evaluator evaluator(Loader::LoadDataset("../dataset"));
+    const string nativeProgram = R"(Indicator("RSI", stock, time) - Indicator("RSI", stock, time - 1))";
+    const string scriptProgram = "(" + nativeProgram + ") + 0 * time";
+
+    StrategyExpression expression;
+    CHECK(StrategyExpression::TryCompileScore(nativeProgram, expression));
+    CHECK_FALSE(StrategyExpression::TryCompileScore(scriptProgram, expression));
+    CHECK_FALSE(StrategyExpression::TryCompileScore(nativeProgram + " > 0", expression));
+
+    // Native and script scores agree, including the NaN of the bars that read before the first one.
+    auto same = [](const vector<double>& a, const vector<double>& b) {
+        if (a.size() != b.size())
+            return false;
+        for (size_t t = 0; t < a.size(); t++)
+        {
+            if (!(a[t] == b[t] || (std::isnan(a[t]) && std::isnan(b[t]))))
+                return false;
+        }
+        return true;
+    };
+    const map<string, vector<double>> nativeScores = evaluator.RunScoreAllStocks(nativeProgram);
+    const map<string, vector<double>> scriptScores = evaluator.RunScoreAllStocks(scriptProgram);
+    size_t mismatches = 0;
+    for (const string& stock : evaluator.GetStocksInDataset())
+    {
+        mismatches += !same(nativeScores.at(stock), scriptScores.at(stock));
+        mismatches += !same(nativeScores.at(stock), evaluator.RunScore(scriptProgram, stock));
+    }
+    CHECK((mismatches == 0));
+    CHECK(std::isnan(nativeScores.at("AAPL").at(0)));
+
+    // Per-date selection against a ranking of every date.
+    map<string, vector<pair<double, string>>> byDate;
+    for (const auto& [stock, scores] : nativeScores)
+    {
+        for (size_t t = 0; t < scores.size(); t++)
+        {
+            if (!std::isnan(scores[t]))
+                byDate[evaluator.Date(stock, (int) t)].emplace_back(scores[t], stock);
+        }
+    }
+    const map<string, Signal> top = evaluator.SelectTopK(nativeScores, 1);
+    const map<string, Signal> bottom = evaluator.SelectBottomK(nativeScores, 1);
+    mismatches = 0;
+    for (const auto& [stock, scores] : nativeScores)
+    {
+        for (size_t t = 0; t < scores.size(); t++)
+        {
+            bool isTop = false, isBottom = false;
+            if (!std::isnan(scores[t]))
+            {
+                const auto& candidates = byDate.at(evaluator.Date(stock, (int) t));
+                isTop = max_element(candidates.begin(), candidates.end(), [](const auto& a, const auto& b) {
+                    return a.first < b.first || (a.first == b.first && a.second > b.second);
+                })->second == stock;
+                isBottom = min_element(candidates.begin(), candidates.end())->second == stock;
+            }
+            mismatches += top.at(stock)[t] != isTop;
+            mismatches += bottom.at(stock)[t] != isBottom;
+        }
+    }
+    CHECK((mismatches == 0));
+
+    const map<string, Signal> all = evaluator.SelectTopK(nativeScores, 2);
+    const map<string, Signal> none = evaluator.SelectTopK(nativeScores, 0);
+    CHECK((all.at("AAPL").Count() == size_t(count_if(nativeScores.at("AAPL").begin(), nativeScores.at("AAPL").end(),
+                                                     [](double s) { return !std::isnan(s); }))));
+    CHECK((none.at("AAPL").Count() == 0));
+    CHECK_THROWS_AS((void) evaluator.SelectTopK({ { "AAPL", vector<double>(3) } }, 1), invalid_argument);
+}
@@ -0,0 +1,297 @@
+#include <cmath>
+#include <algorithm>
+#include <doctest.h>
+#include "../include/loader.h"
+#include "../include/indicators.h"
+#include "../include/filesystem.h"
+#include "../include/fenwick_tree.h"
+#include "../include/derived_indicators.h"
+#include "../include/wavelet_tree.h"
+#include "../include/prefix_sums.h"
+using namespace std;
+using namespace backtester;
+
+TEST_CASE("Test indicator graph evaluation order")
+{
+    int evaluations = 0;
+    auto counted = [&evaluations](const vector<OCHLVData>& rawData, const IndicatorNode::Inputs&) {
+        evaluations++;
+        return vector<double>(rawData.size(), 1.0);
+    };
+    auto sum = [](const vector<OCHLVData>&, const IndicatorNode::Inputs& in) {
+        return VectorOps::Add(*in[0], *in[1]);
+    };
+
+    IndicatorGraph graph;
+    graph.AddNode({ "C", { "A", "B" }, sum });
+    graph.AddNode({ "A", {}, counted });
+    graph.AddNode({ "B", { "A", "A" }, sum });
+
+    CHECK((graph.TopologicalOrder() == vector<string>{ "A", "B", "C" }));
+    CHECK_THROWS_AS(graph.AddNode({ "A", {}, counted }), invalid_argument);
+
+    Indicators series = graph.Evaluate(vector<OCHLVData>(3));
+    CHECK((evaluations == 1));
+    CHECK((series.at("C") == vector<double>{ 3.0, 3.0, 3.0 }));
+
+    graph.AddNode({ "D", { "E" }, counted });
+    graph.AddNode({ "E", { "D" }, counted });
+    CHECK_THROWS_AS((void) graph.TopologicalOrder({ "D" }), runtime_error);
+    CHECK((graph.TopologicalOrder({ "B" }) == vector<string>{ "A", "B" }));
+}
+
+TEST_CASE("Test indicator graph matches indicator functions")
+{
+    string aaplStockPath = FileSystem::FilenameJoin({ "../dataset", "AAPL.csv" });
+    vector<OCHLVData> rawDataset = Loader::LoadRawData(aaplStockPath);
+
+    Indicators indicators = Indicator::CalculateIndicators(rawDataset);
+    QuantileIndicators quantiles = Indicator::CalculateQuantileIndicators(rawDataset);
+
+    CHECK((indicators.at("MFI") == VectorOps::Drop(Indicator::IndicatorTimeSeries(Indicator::MFI, rawDataset, windowSize), windowSize)));
+    CHECK((indicators.at("RSI") == VectorOps::Drop(Indicator::IndicatorTimeSeries(Indicator::RSI, rawDataset, windowSize), windowSize)));
+    CHECK((indicators.at("EMA") == VectorOps::Drop(Indicator::IndicatorTimeSeries(Indicator::EMA, rawDataset), 2 * windowSize)));
+    CHECK((quantiles.at("0.75").at("ClosePrice") == VectorOps::Drop(Indicator::QuantileTimeSeries(Indicator::ClosePrice, rawDataset, 0.75), windowSize)));
+    CHECK((quantiles.at("0.05").at("VWAP") == Indicator::QuantileTimeSeries(Indicator::VWAP, rawDataset, 0.05)));
+    CHECK((quantiles.at("0.95").at("MFI").size() == indicators.at("MFI").size()));
+}
+
+TEST_CASE("Test rolling percentile rank")
+{
+    FenwickTree<int> tree(4);
+    tree.Add(1, 2);
+    tree.Add(3, 1);
+    CHECK((tree.PrefixSum(1) == 0));
+    CHECK((tree.PrefixSum(2) == 2));
+    CHECK((tree.PrefixSum(4) == 3));
+
+    const vector<double> series { 3.0, 1.0, 4.0, 1.0, 5.0, 9.0, 2.0, 6.0, 5.0, 3.0, 5.0 };
+    const unsigned window = 4;
+    vector<double> ranks = Indicator::RollingPercentileRank(series, window);
+
+    REQUIRE((ranks.size() == series.size()));
+    for (size_t i = 0; i < series.size(); i++)
+    {
+        const size_t begin = i + 1 >= window ? i + 1 - window : 0;
+        double below = 0.0, equal = 0.0;
+        for (size_t j = begin; j <= i; j++)
+        {
+            below += series[j] < series[i];
+            equal += series[j] == series[i];
+        }
+        CHECK((ranks[i] == doctest::Approx((below + 0.5 * equal) / double(i + 1 - begin))));
+    }
+}
+
+TEST_CASE("Test derived indicators")
+{
+    string aaplStockPath = FileSystem::FilenameJoin({ "../dataset", "AAPL.csv" });
+    StockData stockData = Loader::LoadStockdataFromRaw(Loader::LoadRawData(aaplStockPath));
+    const SeriesView close = stockData.Series(IndicatorId::ClosePrice);
+    const SeriesView high = stockData.Series(IndicatorId::HighPrice);
+    const SeriesView low = stockData.Series(IndicatorId::LowPrice);
+
+    CHECK_THROWS_AS((void) DerivedIndicator::Compile("Range", "HighPrice - "), invalid_argument);
+    CHECK_THROWS_AS((void) DerivedIndicator::Compile("Range", "HighPrice - Unknown"), invalid_argument);
+    CHECK_THROWS_AS((void) DerivedIndicator::Compile("Range", "Lag(HighPrice, 1.5)"), invalid_argument);
+    CHECK_THROWS_AS((void) DerivedIndicator::Compile("ClosePrice", "HighPrice"), invalid_argument);
+
+    vector<DerivedIndicator> derived;
+    derived.push_back(DerivedIndicator::Compile("Range", "(HighPrice - LowPrice) / ClosePrice"));
+    derived.push_back(DerivedIndicator::Compile("Momentum", "ClosePrice - Lag(ClosePrice, 5)", derived));
+    derived.push_back(DerivedIndicator::Compile("RangeStats", "RollingMean(Range, 10) + -RollingStd(Range, 10) * 2", derived));
+    derived.push_back(DerivedIndicator::Compile("Channel", "RollingMax(HighPrice, 20) - RollingMin(LowPrice, 20)", derived));
+    DerivedIndicator::EvaluateAll(derived, stockData);
+
+    const Indicators series = stockData.DerivedIndicatorMap();
+    const vector<double>& range = series.at("Range");
+    size_t mismatches = 0;
+    for (size_t t = 0; t < stockData.TimePoints(); t++)
+    {
+        mismatches += range[t] != static_cast<SeriesValue>((high[t] - low[t]) / close[t]);
+        mismatches += t < 5 ? !std::isnan(series.at("Momentum")[t]) : series.at("Momentum")[t] != static_cast<SeriesValue>(close[t] - close[t - 5]);
+
+        if (t + 1 < 20)
+        {
+            mismatches += !std::isnan(series.at("Channel")[t]);
+            continue;
+        }
+
+        double mean = 0.0, variance = 0.0;
+        for (size_t i = t + 1 - 10; i <= t; i++)
+            mean += range[i] / 10.0;
+        for (size_t i = t + 1 - 10; i <= t; i++)
+            variance += (range[i] - mean) * (range[i] - mean) / 9.0;
+        mismatches += series.at("RangeStats")[t] != doctest::Approx(mean - 2.0 * std::sqrt(variance)).epsilon(1e-6);
+
+        const double channel = *max_element(high.begin() + t + 1 - 20, high.begin() + t + 1) -
+                               *min_element(low.begin() + t + 1 - 20, low.begin() + t + 1);
+        mismatches += series.at("Channel")[t] != static_cast<SeriesValue>(channel);
+    }
+    CHECK((mismatches == 0));
+
+    // A division by zero gives infinite values, which only make the windows that contain them NaN.
+    vector<DerivedIndicator> jumps;
+    jumps.push_back(DerivedIndicator::Compile("Jump", "1 / (ClosePrice - Lag(ClosePrice, 1))"));
+    jumps.push_back(DerivedIndicator::Compile("JumpMean", "RollingMean(Jump, 5)", jumps));
+    DerivedIndicator::EvaluateAll(jumps, stockData);
+
+    const Indicators jumpSeries = stockData.DerivedIndicatorMap();
+    const vector<double>& jump = jumpSeries.at("Jump");
+    const vector<double>& jumpMean = jumpSeries.at("JumpMean");
+    size_t infinite = 0, finiteMeans = 0;
+    mismatches = 0;
+    for (size_t t = 5; t < jump.size(); t++)
+    {
+        infinite += std::isinf(jump[t]);
+        double mean = 0.0;
+        for (size_t i = t + 1 - 5; i <= t; i++)
+            mean += jump[i] / 5.0;
+
+        finiteMeans += std::isfinite(jumpMean[t]);
+        mismatches += std::isfinite(mean) ? jumpMean[t] != doctest::Approx(mean).epsilon(1e-5) : !std::isnan(jumpMean[t]);
+    }
+    CHECK((infinite > 0));
+    CHECK((finiteMeans + 5 * infinite >= jump.size() - 5));
+    CHECK((mismatches == 0));
+}
+
+TEST_CASE("Test derived indicators are cached with the stock")
+{
+    string aaplStockPath = FileSystem::FilenameJoin({ "../dataset", "AAPL.csv" });
+
+    Loader::ClearDerivedIndicators();
+    Loader::RegisterDerivedIndicator("Range", "HighPrice - LowPrice");
+    StockData first = Loader::LoadStockdata(aaplStockPath);
+    StockData cached = Loader::LoadStockdata(aaplStockPath);
+    CHECK((first == cached));
+    CHECK((cached.derivedNames == vector<string>{ "Range" }));
+
+    // Changing the definitions re-evaluates the derived series of the cached stock.
+    Loader::ClearDerivedIndicators();
+    Loader::RegisterDerivedIndicator("Range", "(HighPrice - LowPrice) / 2");
+    StockData updated = Loader::LoadStockdata(aaplStockPath);
+    CHECK((updated.indicatorValues == first.indicatorValues));
+    CHECK((updated.DerivedSeries(0)[7] == first.DerivedSeries(0)[7] / 2.0));
+
+    Loader::ClearDerivedIndicators();
+    CHECK((Loader::LoadStockdata(aaplStockPath).derivedNames.empty()));
+}
+
+TEST_CASE("Test range quantile index")
+{
+    const vector<double> series { 5.0, 3.0, 8.0, 3.0, 1.0, 9.0, 7.0, 2.0, 6.0, 4.0, 8.0, 0.5 };
+    WaveletTree index(series);
+
+    size_t mismatches = 0;
+    for (size_t begin = 0; begin < series.size(); begin++)
+    {
+        for (size_t end = begin + 1; end <= series.size(); end++)
+        {
+            vector<double> sorted(series.begin() + begin, series.begin() + end);
+            sort(sorted.begin(), sorted.end());
+            for (size_t k = 0; k < sorted.size(); k++)
+                mismatches += index.KthSmallest(begin, end, k) != sorted[k];
+
+            const vector<double> window(series.begin() + begin, series.begin() + end);
+            for (double percentile : { 0.0, 0.05, 0.3, 0.5, 0.95, 1.0 })
+                mismatches += index.Quantile(begin, end, percentile) != Indicator::CalculateQuantile(window, percentile);
+        }
+    }
+    CHECK((mismatches == 0));
+    CHECK_THROWS_AS((void) index.KthSmallest(2, 4, 2), out_of_range);
+
+    // The index reproduces the precomputed quantiles, which are taken over the windowSize preceding values.
+    string aaplStockPath = FileSystem::FilenameJoin({ "../dataset", "AAPL.csv" });
+    StockData stockData = Loader::LoadStockdataFromRaw(Loader::LoadRawData(aaplStockPath));
+    const SeriesView quantiles = stockData.QuantileSeries(IndicatorId::RSI, PercentileId::P85);
+    mismatches = 0;
+    for (size_t t = windowSize; t < stockData.TimePoints(); t++)
+        mismatches += stockData.RangeQuantile(IndicatorId::RSI, 0.85, t - windowSize, t) != quantiles[t];
+    CHECK((mismatches == 0));
+
+    // Indexes are built on first use and are not shared by copies, which build their own.
+    const StockData copy = stockData;
+    CHECK((copy.RangeQuantile(IndicatorId::RSI, 0.85, 10, 10 + windowSize) ==
+           stockData.RangeQuantile(IndicatorId::RSI, 0.85, 10, 10 + windowSize)));
+}
+
+TEST_CASE("Test prefix sum rolling aggregates")
+{
+    const vector<double> series { 5.0, 3.0, 8.0, 3.0, 1.0, 9.0, 7.0, 2.0, 6.0, 4.0 };
+    PrefixSums prefixSums(series);
+    CHECK((prefixSums.Sum(2, 5) == doctest::Approx(12.0)));
+    CHECK((prefixSums.Mean(0, 4) == doctest::Approx(4.75)));
+    CHECK((prefixSums.Std(3, 6) == doctest::Approx(std::sqrt(52.0 / 3.0))));
+    CHECK((std::isnan(prefixSums.Std(3, 4))));
+    CHECK((std::isnan(PrefixSums({ 1.0, NAN, 2.0 }).Mean(0, 2))));
+    CHECK((PrefixSums({ 1.0, NAN, 2.0 }).Mean(2, 3) == 2.0));
+    CHECK((std::isnan(prefixSums.Sum(8, 11))));
+    CHECK((std::isnan(prefixSums.Mean(11, 12))));
+    CHECK((std::isnan(prefixSums.Std(5, 2))));
+
+    // An infinite value only affects the ranges that contain it.
+    vector<double> spiky(200, 1.0);
+    spiky[100] = INFINITY;
+    const PrefixSums spikySums(spiky);
+    CHECK((std::isnan(spikySums.Mean(98, 103))));
+    CHECK((spikySums.Mean(195, 200) == 1.0));
+    CHECK((spikySums.Std(150, 160) == 0.0));
+
+    // Windows of windowSize preceding values reproduce the SMA and VWAP indicators.
+    string aaplStockPath = FileSystem::FilenameJoin({ "../dataset", "AAPL.csv" });
+    StockData stockData = Loader::LoadStockdataFromRaw(Loader::LoadRawData(aaplStockPath));
+    size_t mismatches = 0;
+    for (size_t t = windowSize; t < stockData.TimePoints(); t++)
+    {
+        mismatches += stockData.RangeMean(IndicatorId::ClosePrice, t - windowSize, t) !=
+                      doctest::Approx(stockData.Value(IndicatorId::SMA, t)).epsilon(1e-6);
+        mismatches += stockData.RangeVWAP(t - windowSize, t) !=
+                      doctest::Approx(stockData.Value(IndicatorId::VWAP, t)).epsilon(1e-6);
+    }
+    CHECK((mismatches == 0));
+}
+
+TEST_CASE("Test approximate rolling quantile")
+{
+    string aaplStockPath = FileSystem::FilenameJoin({ "../dataset", "AAPL.csv" });
+    vector<OCHLVData> rawDataset = Loader::LoadRawData(aaplStockPath);
+    const vector<double> close = Indicator::IndicatorTimeSeries(Indicator::ClosePrice, rawDataset);
+    const double range = *max_element(close.begin(), close.end()) - *min_element(close.begin(), close.end());
+
+    for (unsigned window : { 40u, 252u })
+    {
+        vector<double> exact = Indicator::QuantileTimeSeries(Indicator::ClosePrice, rawDataset, 0.85, window);
+        vector<double> approximate = Indicator::QuantileTimeSeries(Indicator::ClosePrice, rawDataset, 0.85, window,
+                                                                   QuantileMode::Approximate);
+        REQUIRE((approximate.size() == exact.size()));
+
+        double maximumError = 0.0;
+        for (size_t i = 0; i < exact.size(); i++)
+            maximumError = std::max(maximumError, std::abs(approximate[i] - exact[i]));
+        CHECK((maximumError <= range / (2.0 * quantileSketchBins) * (1.0 + 1e-9)));
+    }
+
+    // An infinite value is not counted, and the bins still cover the finite range.
+    vector<double> spiky = close;
+    spiky[100] = INFINITY;
+    const vector<double> spikySketch = Indicator::RollingQuantileSketch(spiky, 0.85, 40);
+    REQUIRE((spikySketch.size() == spiky.size() - 40));
+    double spikyError = 0.0;
+    for (size_t i = 0; i < spikySketch.size(); i++)
+    {
+        vector<double> finite;
+        copy_if(spiky.begin() + (long) i, spiky.begin() + (long) i + 40, back_inserter(finite),
+                [](double value) { return std::isfinite(value); });
+        spikyError = std::max(spikyError, std::abs(spikySketch[i] - Indicator::CalculateQuantile(finite, 0.85)));
+    }
+    CHECK((spikyError <= range / (2.0 * quantileSketchBins) * (1.0 + 1e-9)));
+
+    FenwickTree<int> counts(5);
+    counts.Add(1, 2);
+    counts.Add(3, 1);
+    CHECK((counts.UpperBound(0) == 1));
+    CHECK((counts.UpperBound(1) == 1));
+    CHECK((counts.UpperBound(2) == 3));
+    CHECK((counts.UpperBound(3) == 5));
+}
@@ -18,7 +18,7 @@ TEST_CASE("Test stock data loading")
     string aaplStockPath = FileSystem::FilenameJoin({ "../dataset", "AAPL.csv" });
     StockData stockData = Loader::LoadStockdata(aaplStockPath);
 
-    CHECK((stockData.indicators.at("TradingVolume").at(0) == 789905200.0));
+    CHECK((stockData.Series(IndicatorId::TradingVolume).at(0) == static_cast<SeriesValue>(789905200.0)));
     CHECK((stockData.dates.at(0) == "\"2008-05-27\""));
 }
 
@@ -26,7 +26,7 @@ TEST_CASE("Test dataset loading")
 {
     Dataset dataset = Loader::LoadDataset("../dataset");
 
-    CHECK((dataset.at("AAPL").indicators.at("TradingVolume").at(0) == 789905200.0));
+    CHECK((dataset.at("AAPL").Series(IndicatorId::TradingVolume).at(0) == static_cast<SeriesValue>(789905200.0)));
     CHECK((dataset.at("AAPL").dates.at(0) == "\"2008-05-27\""));
 }
 